@@ -83,13 +83,14 @@ static bool readImagePoints(const cv::Mat& image,
  * @param[out] distortion 歪み係数ベクトル
  * @param[out] rvecs 各画像におけるカメラの回転ベクトル
  * @param[out] tvecs 各画像におけるカメラの並進ベクトル
+ * @param[out] imageSize 画像の大きさ
  * @return キャリブレーションに成功した場合はtrue、そうでなければfalse
  */
 static bool calibrateCamera(const std::string& imageDirName, int numImages,
         cv::Mat& intrinsic, cv::Mat& distortion,
-        std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) {
+        std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs, cv::Size& imageSize) {
     std::vector<std::vector<cv::Point2f> > imagePointsList;
-    cv::Size imageSize;
+    imageSize = cv::Size();
     for (int i = 0; i < numImages; i++) {
         std::stringstream ss;
         ss << imageDirName << "/" << i << ".png";
@@ -134,11 +135,12 @@ static bool calibrateCamera(const std::string& imageDirName, int numImages,
  * @param[in] distortion 歪み係数ベクトル
  * @param[in] rvec カメラの回転ベクトル
  * @param[in] tvec カメラの並進ベクトル
+ * @param[in] imageSize 画像の大きさ
  * @return 書き込めた場合はtrue、そうでなければfalse
  */
 static bool writeCameraInfo(const std::string& filename,
         const cv::Mat& intrinsic, const cv::Mat& distortion,
-        const cv::Mat& rvec, const cv::Mat& tvec) {
+        const cv::Mat& rvec, const cv::Mat& tvec, const cv::Size& imageSize) {
     cv::FileStorage fs(filename, cv::FileStorage::WRITE);
     if (!fs.isOpened()) {
         std::cerr << "ERROR: Failed to open the file: " << filename << std::endl;
@@ -148,6 +150,8 @@ static bool writeCameraInfo(const std::string& filename,
     fs << "distortion" << distortion;
     fs << "rotation" << rvec;
     fs << "translation" << tvec;
+    fs << "image_width" << imageSize.width;
+    fs << "image_height" << imageSize.height;
     fs.release();
     return true;
 }
@@ -169,7 +173,8 @@ int main(int argc, char* argv[]) {
 
     cv::Mat intrinsic, distortion;
     std::vector<cv::Mat> rvecs, tvecs;
-    if (!calibrateCamera(imageDirName, numImages, intrinsic, distortion, rvecs, tvecs)) {
+    cv::Size imageSize;
+    if (!calibrateCamera(imageDirName, numImages, intrinsic, distortion, rvecs, tvecs, imageSize)) {
         std::cerr << "ERROR: Failed to calibrate camera" << std::endl;
         return 1;
     }
@@ -183,7 +188,7 @@ int main(int argc, char* argv[]) {
 
     const std::string cameraInfoFileName = "camera.xml";
     if (writeCameraInfo(cameraInfoFileName,
-                intrinsic, distortion, rvecs[0], tvecs[0])) {
+                intrinsic, distortion, rvecs[0], tvecs[0], imageSize)) {
         std::cout << "Write the camera info to " << cameraInfoFileName << std::endl;
     }
     return 0;
@@ -1,7 +1,14 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <opencv2/opencv.hpp>
 
+static const int kNumPoseFields = 6; // rx,ry,rz,tx,ty,tz
+static const std::size_t kStreamBufferSize = 1 << 20;
+
 /**
  * 射影行列を計算します。
  *
@@ -78,12 +85,155 @@ static bool readCameraPosition(const std::string& filename,
     return rvec.total() != 0 && tvec.total() != 0;
 }
 
+/**
+ * 回転ベクトルを回転行列に変換します（ロドリゲスの公式）。
+ *
+ * @param[in] rvec カメラの回転ベクトル
+ * @return 回転行列
+ */
+static cv::Matx33d rodrigues(const cv::Vec3d& rvec) {
+    double theta = std::sqrt(rvec[0] * rvec[0] + rvec[1] * rvec[1] + rvec[2] * rvec[2]);
+    if (theta < 1e-12) {
+        return cv::Matx33d::eye();
+    }
+    double kx = rvec[0] / theta, ky = rvec[1] / theta, kz = rvec[2] / theta;
+    double c = std::cos(theta), s = std::sin(theta), v = 1.0 - c;
+    return cv::Matx33d(
+            kx * kx * v + c,      kx * ky * v - kz * s, kx * kz * v + ky * s,
+            ky * kx * v + kz * s, ky * ky * v + c,      ky * kz * v - kx * s,
+            kz * kx * v - ky * s, kz * ky * v + kx * s, kz * kz * v + c);
+}
+
+/**
+ * 回転ベクトルからオイラー角を計算します。
+ * decomposeProjectionMatrix と同じく、R = Rz(yaw) * Ry(pitch) * Rx(roll) となる角度を求めます。
+ * 射影行列のRQ分解を経由しないため、内部パラメータを必要としません。
+ *
+ * @param[in] rvec カメラの回転ベクトル
+ * @return [roll, pitch, yaw] [deg]
+ */
+static cv::Vec3d calculateEulerAngles(const cv::Vec3d& rvec) {
+    const double kRadToDeg = 180.0 / CV_PI;
+    cv::Matx33d r = rodrigues(rvec);
+    double roll  = std::atan2(r(2, 1), r(2, 2));
+    double pitch = std::atan2(-r(2, 0), std::sqrt(r(2, 1) * r(2, 1) + r(2, 2) * r(2, 2)));
+    double yaw   = std::atan2(r(1, 0), r(0, 0));
+    return cv::Vec3d(roll * kRadToDeg, pitch * kRadToDeg, yaw * kRadToDeg);
+}
+
+/**
+ * 行末のkNumPoseFields個の列を姿勢として読み込みます。
+ *
+ * @param[in,out] line 1行分の文字列（改行を除く）。姿勢より前の列だけが残るように書き換える
+ * @param[out] prefix 姿勢より前の列（ない場合は空文字列）
+ * @param[out] pose rx,ry,rz,tx,ty,tz
+ * @return 姿勢を読み込めた場合はtrue、そうでなければfalse
+ */
+static bool parsePoseLine(char* line, const char*& prefix, double pose[kNumPoseFields]) {
+    // 後ろからkNumPoseFields個目の区切りを探す
+    char* fields = line;
+    int numSeparators = 0;
+    for (char* p = line + strlen(line); p > line; p--) {
+        if (p[-1] == ',' && ++numSeparators == kNumPoseFields) {
+            p[-1] = '\0';
+            fields = p;
+            break;
+        }
+    }
+    prefix = (fields == line) ? "" : line;
+
+    char* p = fields;
+    for (int i = 0; i < kNumPoseFields; i++) {
+        char* end;
+        pose[i] = strtod(p, &end);
+        if (end == p || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return true;
+}
+
+/**
+ * 姿勢が1行ずつ書かれたファイルを読み込み、各姿勢のオイラー角を書き出します。
+ * 各行の末尾6列を rx,ry,rz,tx,ty,tz とみなし、それより前の列（画像ファイル名や時刻）はそのまま出力します。
+ *
+ * @param[in] in 入力
+ * @param[in] out 出力
+ * @return 処理した姿勢の数
+ */
+static std::size_t convertPosesToEulerAngles(FILE* in, FILE* out) {
+    // 行の長さに合わせて伸ばすバッファを使い回す
+    char* line = NULL;
+    std::size_t capacity = 0;
+    std::size_t count = 0;
+    while (getline(&line, &capacity, in) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+
+        const char* prefix;
+        double pose[kNumPoseFields];
+        bool parsed = parsePoseLine(line, prefix, pose);
+        const char* separator = (prefix[0] == '\0') ? "" : ",";
+        if (line[0] == '#') {
+            fprintf(out, "%s%sroll,pitch,yaw\n", prefix[0] == '\0' ? "# " : prefix, separator);
+        } else if (!parsed) {
+            fprintf(out, "%s%s,,\n", prefix, separator);
+        } else {
+            cv::Vec3d eulerAngles = calculateEulerAngles(cv::Vec3d(pose[0], pose[1], pose[2]));
+            fprintf(out, "%s%s%.6f,%.6f,%.6f\n", prefix, separator,
+                    eulerAngles[0], eulerAngles[1], eulerAngles[2]);
+            count++;
+        }
+    }
+    free(line);
+    return count;
+}
+
+static void printUsage(const char* program) {
+    std::cerr << "usage: "
+            << program
+            << " <camera parameters file> <camera position file>\n"
+            << "       "
+            << program
+            << " -b <pose file | -> [output file]"
+            << std::endl;
+}
+
 int main(int argc, char* argv[]) {
+    if (argc > 2 && std::string(argv[1]) == "-b") {
+        const std::string poseFileName(argv[2]);
+        FILE* in = (poseFileName == "-") ? stdin : fopen(poseFileName.c_str(), "r");
+        if (in == NULL) {
+            std::cerr << "ERROR: Failed to open file: " << poseFileName << std::endl;
+            return 1;
+        }
+        FILE* out = (argc > 3) ? fopen(argv[3], "w") : stdout;
+        if (out == NULL) {
+            std::cerr << "ERROR: Failed to open file: " << argv[3] << std::endl;
+            return 1;
+        }
+        setvbuf(in, NULL, _IOFBF, kStreamBufferSize);
+        setvbuf(out, NULL, _IOFBF, kStreamBufferSize);
+
+        int64 startTick = cv::getTickCount();
+        std::size_t count = convertPosesToEulerAngles(in, out);
+        double elapsed = (cv::getTickCount() - startTick) / cv::getTickFrequency();
+        std::cerr << count << " poses in " << elapsed << " [s]" << std::endl;
+        bool written = !ferror(out);
+        if (fclose(out) != 0 || !written) {
+            std::cerr << "ERROR: Failed to write file: " << (argc > 3 ? argv[3] : "stdout") << std::endl;
+            fclose(in);
+            return 1;
+        }
+        fclose(in);
+        return 0;
+    }
+
     if (argc <= 2) {
-        std::cerr << "usage: "
-                << argv[0]
-                << " <camera parameters file> <camera position file>"
-                << std::endl;
+        printUsage(argv[0]);
         return 1;
     }
     const std::string cameraParamsFileName(argv[1]);
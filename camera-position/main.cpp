@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <cassert>
-#include <fstream>
+#include <cmath>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <opencv2/opencv.hpp>
+#include "points.h"
+#include "ransac.h"
 
 static std::string s_shownWindowName;
 static cv::Mat s_shownImage;
@@ -16,29 +19,6 @@ static void drawCross(cv::Mat& image, const cv::Point2f& point, const cv::Scalar
     cv::line(image, cv::Point2f(point.x, point.y - length), cv::Point2f(point.x, point.y + length), color, thickness);
 }
 
-/**
- * ファイルから物体座標空間における物体上の点座標を読み込みます。
- *
- * @param[in] filename ファイル名
- * @param[out] objectPoints 物体上の点
- * @return 読み込めた場合はtrue、そうでなければfalse
- */
-static bool readObjectPoints(const std::string& filename,
-        std::vector<cv::Point3f>& objectPoints) {
-    std::ifstream ifs(filename.c_str());
-    if (!ifs.is_open()) {
-        std::cerr << "ERROR: Failed to open file: " << filename << std::endl;
-        return false;
-    }
-    std::string line;
-    while (std::getline(ifs, line)) {
-        int x, y, z;
-        sscanf(line.c_str(), "%d,%d,%d", &x, &y, &z);
-        objectPoints.push_back(cv::Point3f(x, y, z));
-    }
-    return true;
-}
-
 static void onMouse(int event, int x, int y, int flags, void* params) {
     switch (event) {
         case cv::EVENT_LBUTTONDOWN:
@@ -131,12 +111,52 @@ static void evaluateImagePoints(const std::vector<cv::Point2f>& points,
     std::cout << "reprojectedImagePoints:\n" << reprojectedPoints << "\n\n";
 }
 
+/**
+ * 再投影誤差の統計量を表示します。
+ *
+ * @param[in] imagePoints 画像上の対応点
+ * @param[in] reprojectedPoints 再投影した画像上の対応点
+ * @param[in] inlierMask 各対応点がインライアであれば1、そうでなければ0（空の場合はすべてインライアとする）
+ */
+static void printReprojectionErrors(const std::vector<cv::Point2f>& imagePoints,
+        const std::vector<cv::Point2f>& reprojectedPoints,
+        const std::vector<uchar>& inlierMask) {
+    std::vector<double> errors;
+    errors.reserve(imagePoints.size());
+    double sum = 0.0, sum2 = 0.0;
+    for (std::size_t i = 0; i < imagePoints.size(); i++) {
+        if (!inlierMask.empty() && !inlierMask[i]) {
+            continue;
+        }
+        cv::Point2f d = imagePoints[i] - reprojectedPoints[i];
+        double e = std::sqrt(d.x * d.x + d.y * d.y);
+        errors.push_back(e);
+        sum += e;
+        sum2 += e * e;
+    }
+    if (errors.empty()) {
+        return;
+    }
+    std::size_t n = errors.size();
+    std::nth_element(errors.begin(), errors.begin() + n / 2, errors.end());
+    double median = errors[n / 2];
+    double max = *std::max_element(errors.begin(), errors.end());
+    std::cout << "inliers: " << n << "/" << imagePoints.size()
+            << " (" << 100.0 * n / imagePoints.size() << "%)\n";
+    std::cout << "reprojection error [px]:"
+            << " mean=" << sum / n
+            << ", median=" << median
+            << ", max=" << max
+            << ", rms=" << std::sqrt(sum2 / n) << "\n\n";
+}
+
 /**
  * 物体座標空間におけるカメラ位置を推定します。
  *
  * @param[in] objectPointsFileName 物体上の点座標が書かれたファイル名
- * @param[in] imageFileName 対応する物体が写っている画像ファイル名
+ * @param[in] imageFileName 対応する物体が写っている画像ファイル名、または画像上の対応点が書かれたファイル名
  * @param[in] cameraParamsFileName カメラの内部パラメータが書かれたファイル名
+ * @param[in] ransacParams RANSACのパラメータ（NULLの場合はすべての対応点を使って推定する）
  * @param[out] rvec カメラの回転ベクトル
  * @param[out] tvec カメラの並進ベクトル
  * @return 推定できた場合はtrue、そうでなければfalse
@@ -144,6 +164,7 @@ static void evaluateImagePoints(const std::vector<cv::Point2f>& points,
 static bool estimateCameraPosition(const std::string& objectPointsFileName,
         const std::string& imageFileName,
         const std::string& cameraParamsFileName,
+        const RansacParams* ransacParams,
         cv::Mat& rvec,
         cv::Mat& tvec) {
     std::vector<cv::Point3f> objectPoints;
@@ -153,7 +174,10 @@ static bool estimateCameraPosition(const std::string& objectPointsFileName,
     }
 
     std::vector<cv::Point2f> imagePoints;
-    if (!readImagePoints(imageFileName, objectPoints.size(), imagePoints)) {
+    bool imagePointsRead = isPointsFile(imageFileName)
+            ? readImagePoints(imageFileName, imagePoints)
+            : readImagePoints(imageFileName, objectPoints.size(), imagePoints);
+    if (!imagePointsRead || imagePoints.size() != objectPoints.size()) {
         std::cerr << "ERROR: Failed to read image points\n";
         return false;
     }
@@ -164,11 +188,27 @@ static bool estimateCameraPosition(const std::string& objectPointsFileName,
         return false;
     }
 
-    cv::solvePnP(objectPoints, imagePoints, intrinsic, distortion, rvec, tvec);
+    std::vector<uchar> inlierMask;
+    if (ransacParams != NULL) {
+        int iterations;
+        int64 startTick = cv::getTickCount();
+        if (!estimateCameraPositionRansac(objectPoints, imagePoints, intrinsic, distortion,
+                    *ransacParams, rvec, tvec, inlierMask, iterations)) {
+            std::cerr << "ERROR: Failed to find a consistent camera position\n";
+            return false;
+        }
+        double elapsed = (cv::getTickCount() - startTick) * 1000.0 / cv::getTickFrequency();
+        std::cout << "RANSAC: " << iterations << " hypotheses, " << elapsed << " [ms]\n";
+    } else {
+        cv::solvePnP(objectPoints, imagePoints, intrinsic, distortion, rvec, tvec);
+    }
 
     std::vector<cv::Point2f> reprojectedImagePoints;
     cv::projectPoints(objectPoints, rvec, tvec, intrinsic, distortion, reprojectedImagePoints);
-    evaluateImagePoints(imagePoints, reprojectedImagePoints);
+    printReprojectionErrors(imagePoints, reprojectedImagePoints, inlierMask);
+    if (s_shownImage.data != NULL) {
+        evaluateImagePoints(imagePoints, reprojectedImagePoints);
+    }
     return true;
 }
 
@@ -192,21 +232,59 @@ static bool writeCameraPosition(const std::string& filename,
     return true;
 }
 
+static void printUsage(const char* program) {
+    std::cerr << "usage: "
+            << program
+            << " [-r [-p]] <object points file> <image file | image points file> <camera parameters file>\n"
+            << "       "
+            << program
+            << " -c <points file> <binary points file>"
+            << std::endl;
+}
+
 int main(int argc, char** argv) {
-    if (argc <= 3) {
-        std::cerr << "usage: "
-                << argv[0]
-                << " <object points file> <image file> <camera parameters file>"
-                << std::endl;
+    if (argc > 1 && std::string(argv[1]) == "-c") {
+        if (argc <= 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        // 点群ファイルをバイナリ形式に変換する
+        int dimension = 0;
+        std::vector<float> values;
+        if (!readPoints(argv[2], dimension, values) || !writePoints(argv[3], dimension, values)) {
+            std::cerr << "ERROR: Failed to convert points file" << std::endl;
+            return 1;
+        }
+        std::cout << "Write " << values.size() / dimension << " points to " << argv[3] << std::endl;
+        return 0;
+    }
+
+    // -r: RANSACで外れ値を除去する、-p: 仮説を並列に評価する
+    bool robust = false;
+    RansacParams ransacParams;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        std::string option(argv[argi]);
+        if (option == "-r") {
+            robust = true;
+        } else if (option == "-p") {
+            ransacParams.parallel = true;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - argi < 3) {
+        printUsage(argv[0]);
         return 1;
     }
-    const std::string objectPointsFileName(argv[1]);
-    const std::string imageFileName(argv[2]);
-    const std::string cameraParamsFileName(argv[3]);
+    const std::string objectPointsFileName(argv[argi]);
+    const std::string imageFileName(argv[argi + 1]);
+    const std::string cameraParamsFileName(argv[argi + 2]);
 
     cv::Mat rvec, tvec;
     if(!estimateCameraPosition(objectPointsFileName, imageFileName, cameraParamsFileName,
-            rvec, tvec)) {
+            robust ? &ransacParams : NULL, rvec, tvec)) {
         std::cerr << "ERROR: Failed to estimate camera position" << std::endl;
         return 1;
     }
@@ -0,0 +1,390 @@
+#include "points.h"
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kBinaryMagic[4] = { 'P', 'T', 'S', 'F' };
+static const std::size_t kBinaryHeaderSize = 16;
+static const uint64_t kMaxMantissa = 100000000000000000ULL; // これ以上の桁は指数で表す
+static const double kPowersOf10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+static const int kMaxExactPower = 22;
+
+/**
+ * 読み込み専用でメモリマップしたファイルです。
+ */
+class MappedFile {
+public:
+    MappedFile() : data_(NULL), size_(0) {
+    }
+
+    ~MappedFile() {
+        if (data_ != NULL) {
+            munmap(data_, size_);
+        }
+    }
+
+    bool open(const std::string& filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return false;
+        }
+        size_ = st.st_size;
+        if (size_ > 0) {
+            data_ = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data_ == MAP_FAILED) {
+                data_ = NULL;
+                close(fd);
+                return false;
+            }
+            madvise(data_, size_, MADV_SEQUENTIAL);
+        }
+        close(fd);
+        return true;
+    }
+
+    const char* begin() const {
+        return static_cast<const char*>(data_);
+    }
+
+    const char* end() const {
+        return begin() + size_;
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    void* data_;
+    std::size_t size_;
+};
+
+static bool isDigit(char c) {
+    return '0' <= c && c <= '9';
+}
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char* skipSpaces(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * ロケールに依存せずに10進数の実数を読み込みます。
+ *
+ * @param[in] p 読み込みを開始する位置
+ * @param[in] end 読み込み可能な範囲の終端
+ * @param[out] value 読み込んだ値
+ * @return 読み込んだ直後の位置。数値でない場合はNULL
+ */
+static const char* parseFloat(const char* p, const char* end, float& value) {
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int numDigits = 0;
+    for (; p < end && isDigit(*p); p++, numDigits++) {
+        if (mantissa < kMaxMantissa) {
+            mantissa = mantissa * 10 + (*p - '0');
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && isDigit(*p); p++, numDigits++) {
+            if (mantissa < kMaxMantissa) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if (numDigits == 0) {
+        return NULL;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negativeExponent = false;
+        if (p < end && (*p == '+' || *p == '-')) {
+            negativeExponent = *p == '-';
+            p++;
+        }
+        if (p >= end || !isDigit(*p)) {
+            return NULL;
+        }
+        int e = 0;
+        for (; p < end && isDigit(*p); p++) {
+            if (e < 10000) {
+                e = e * 10 + (*p - '0');
+            }
+        }
+        exponent += negativeExponent ? -e : e;
+    }
+
+    double v = static_cast<double>(mantissa);
+    if (mantissa != 0) {
+        if (exponent < 0) {
+            v = (-exponent <= kMaxExactPower) ? v / kPowersOf10[-exponent] : v * std::pow(10.0, exponent);
+        } else if (exponent > 0) {
+            v = (exponent <= kMaxExactPower) ? v * kPowersOf10[exponent] : v * std::pow(10.0, exponent);
+        }
+    }
+    if (v > FLT_MAX) {
+        v = HUGE_VAL; // 呼び出し側で範囲外として扱う
+    }
+    value = static_cast<float>(negative ? -v : v);
+    return p;
+}
+
+/**
+ * 値と値の区切り（カンマまたは空白）を読み飛ばします。
+ *
+ * @return 区切りの次の位置。区切りがなければNULL
+ */
+static const char* skipSeparator(const char* p, const char* end) {
+    const char* start = p;
+    p = skipSpaces(p, end);
+    if (p < end && *p == ',') {
+        return skipSpaces(p + 1, end);
+    }
+    return (p != start) ? p : NULL;
+}
+
+static const char* findLineEnd(const char* p, const char* end) {
+    const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+    return eol != NULL ? eol : end;
+}
+
+static std::size_t countLines(const char* p, const char* end) {
+    std::size_t count = 0;
+    while (p < end) {
+        p = findLineEnd(p, end) + 1;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * 最初のデータ行に含まれる値の数を数えます。
+ *
+ * @return 値の数。データ行がない、または数値でない値を含む場合は0
+ */
+static int countValuesInFirstLine(const char* p, const char* end) {
+    while (p < end) {
+        const char* eol = findLineEnd(p, end);
+        p = skipSpaces(p, eol);
+        if (p == eol || *p == '#') {
+            p = eol + 1;
+            continue;
+        }
+        int count = 0;
+        while (p < eol) {
+            float value;
+            p = parseFloat(p, eol, value);
+            if (p == NULL) {
+                return 0;
+            }
+            count++;
+            if (p < eol && (p = skipSeparator(p, eol)) == NULL) {
+                return 0;
+            }
+        }
+        return count;
+    }
+    return 0;
+}
+
+/**
+ * テキスト形式の点座標を読み込みます。
+ *
+ * @param[in] p 読み込みを開始する位置
+ * @param[in] end 読み込み可能な範囲の終端
+ * @param[in] dimension 1点あたりの座標の数
+ * @param[out] values 読み込んだ値の書き込み先（行数 * dimension 個分の領域が必要）
+ * @param[out] numPoints 読み込んだ点の数
+ * @param[in] filename エラー表示に使うファイル名
+ * @return 読み込めた場合はtrue、そうでなければfalse
+ */
+static bool parseText(const char* p, const char* end, int dimension,
+        float* values, std::size_t& numPoints, const std::string& filename) {
+    numPoints = 0;
+    for (std::size_t lineNumber = 1; p < end; lineNumber++) {
+        const char* eol = findLineEnd(p, end);
+        p = skipSpaces(p, eol);
+        if (p == eol || *p == '#') {
+            p = eol + 1;
+            continue;
+        }
+
+        float* dst = values + numPoints * dimension;
+        for (int i = 0; i < dimension; i++) {
+            if (i > 0 && p < eol && (p = skipSeparator(p, eol)) == NULL) {
+                std::cerr << "ERROR: Missing separator at " << filename << ":" << lineNumber << std::endl;
+                return false;
+            }
+            p = parseFloat(p, eol, dst[i]);
+            if (p == NULL || !std::isfinite(dst[i])) {
+                std::cerr << "ERROR: Invalid number at " << filename << ":" << lineNumber << std::endl;
+                return false;
+            }
+        }
+        if (skipSpaces(p, eol) != eol) {
+            std::cerr << "ERROR: Expected " << dimension << " values at "
+                    << filename << ":" << lineNumber << std::endl;
+            return false;
+        }
+        numPoints++;
+        p = eol + 1;
+    }
+    return true;
+}
+
+/**
+ * ファイルから点座標を読み込みます。
+ * 読み込み先の要素は float を dimension の約数個だけ並べた型でなければなりません。
+ */
+template <typename T>
+static bool readPointsInto(const std::string& filename, int& dimension, std::vector<T>& points) {
+    const int valuesPerElement = sizeof(T) / sizeof(float);
+
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "ERROR: Failed to open file: " << filename << std::endl;
+        return false;
+    }
+
+    if (file.size() >= kBinaryHeaderSize && memcmp(file.begin(), kBinaryMagic, sizeof(kBinaryMagic)) == 0) {
+        uint32_t fileDimension;
+        uint64_t count;
+        memcpy(&fileDimension, file.begin() + 4, sizeof(fileDimension));
+        memcpy(&count, file.begin() + 8, sizeof(count));
+        if (fileDimension == 0 || (dimension != 0 && fileDimension != static_cast<uint32_t>(dimension))
+                || fileDimension % valuesPerElement != 0) {
+            std::cerr << "ERROR: Unexpected dimension " << fileDimension << ": " << filename << std::endl;
+            return false;
+        }
+        uint64_t dataSize = file.size() - kBinaryHeaderSize;
+        if (count > dataSize / (fileDimension * sizeof(float))
+                || dataSize != count * fileDimension * sizeof(float)) {
+            std::cerr << "ERROR: Corrupted points file: " << filename << std::endl;
+            return false;
+        }
+        dimension = fileDimension;
+        points.resize(count * fileDimension / valuesPerElement);
+        if (!points.empty()) {
+            memcpy(&points[0], file.begin() + kBinaryHeaderSize, dataSize);
+        }
+        return true;
+    }
+
+    if (dimension == 0) {
+        dimension = countValuesInFirstLine(file.begin(), file.end());
+        if (dimension == 0) {
+            std::cerr << "ERROR: No valid points found: " << filename << std::endl;
+            return false;
+        }
+    }
+    if (dimension % valuesPerElement != 0) {
+        std::cerr << "ERROR: Unexpected dimension " << dimension << ": " << filename << std::endl;
+        return false;
+    }
+
+    // 行数を上限として領域を確保し、解析結果を直接書き込む
+    std::size_t numLines = countLines(file.begin(), file.end());
+    points.resize(numLines * dimension / valuesPerElement);
+    std::size_t numPoints = 0;
+    float* values = points.empty() ? NULL : reinterpret_cast<float*>(&points[0]);
+    if (!parseText(file.begin(), file.end(), dimension, values, numPoints, filename)) {
+        points.clear();
+        return false;
+    }
+    points.resize(numPoints * dimension / valuesPerElement);
+    return true;
+}
+
+bool readPoints(const std::string& filename, int& dimension, std::vector<float>& values) {
+    return readPointsInto(filename, dimension, values);
+}
+
+bool writePoints(const std::string& filename, int dimension, const std::vector<float>& values) {
+    if (dimension <= 0 || values.size() % dimension != 0) {
+        std::cerr << "ERROR: Invalid dimension: " << dimension << std::endl;
+        return false;
+    }
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (fp == NULL) {
+        std::cerr << "ERROR: Failed to open file: " << filename << std::endl;
+        return false;
+    }
+    uint32_t fileDimension = dimension;
+    uint64_t count = values.size() / dimension;
+    bool ok = fwrite(kBinaryMagic, sizeof(kBinaryMagic), 1, fp) == 1
+            && fwrite(&fileDimension, sizeof(fileDimension), 1, fp) == 1
+            && fwrite(&count, sizeof(count), 1, fp) == 1
+            && (values.empty() || fwrite(&values[0], sizeof(float), values.size(), fp) == values.size());
+    ok = fclose(fp) == 0 && ok;
+    if (!ok) {
+        std::cerr << "ERROR: Failed to write file: " << filename << std::endl;
+    }
+    return ok;
+}
+
+bool readObjectPoints(const std::string& filename, std::vector<cv::Point3f>& objectPoints) {
+    int dimension = 3;
+    if (!readPointsInto(filename, dimension, objectPoints)) {
+        return false;
+    }
+    if (objectPoints.empty()) {
+        std::cerr << "ERROR: No points found: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool readImagePoints(const std::string& filename, std::vector<cv::Point2f>& imagePoints) {
+    int dimension = 2;
+    if (!readPointsInto(filename, dimension, imagePoints)) {
+        return false;
+    }
+    if (imagePoints.empty()) {
+        std::cerr << "ERROR: No points found: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool isPointsFile(const std::string& filename) {
+    std::string::size_type dot = filename.find_last_of('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+    std::string extension = filename.substr(dot);
+    return extension == ".csv" || extension == ".txt" || extension == ".bin";
+}
@@ -0,0 +1,69 @@
+#ifndef POINTS_H
+#define POINTS_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+//
+// 点群ファイルの形式
+//
+// テキスト形式:
+//   1行に1点の座標をカンマまたは空白区切りで書く（例: "12.5,-3.25,0"）。
+//   空行と'#'で始まる行は読み飛ばす。
+//
+// バイナリ形式（リトルエンディアン）:
+//   char     magic[4]   "PTSF"
+//   uint32_t dimension  1点あたりの座標の数
+//   uint64_t count      点の数
+//   float    values[count * dimension]
+//
+
+/**
+ * ファイルから点座標を読み込みます。
+ * ファイルはメモリマップし、テキスト形式の場合はロケールに依存しないパーサで直接valuesに書き込みます。
+ *
+ * @param[in] filename ファイル名
+ * @param[in,out] dimension 1点あたりの座標の数。0の場合はファイルの内容から決定する
+ * @param[out] values 点座標（dimension個ずつ連続して並ぶ）
+ * @return 読み込めた場合はtrue、そうでなければfalse
+ */
+bool readPoints(const std::string& filename, int& dimension, std::vector<float>& values);
+
+/**
+ * ファイルにバイナリ形式で点座標を書き込みます。
+ *
+ * @param[in] filename ファイル名
+ * @param[in] dimension 1点あたりの座標の数
+ * @param[in] values 点座標（dimension個ずつ連続して並ぶ）
+ * @return 書き込めた場合はtrue、そうでなければfalse
+ */
+bool writePoints(const std::string& filename, int dimension, const std::vector<float>& values);
+
+/**
+ * ファイルから物体座標空間における物体上の点座標を読み込みます。
+ *
+ * @param[in] filename ファイル名
+ * @param[out] objectPoints 物体上の点
+ * @return 読み込めた場合はtrue、そうでなければfalse
+ */
+bool readObjectPoints(const std::string& filename, std::vector<cv::Point3f>& objectPoints);
+
+/**
+ * ファイルから画像上の対応点を読み込みます。
+ *
+ * @param[in] filename ファイル名
+ * @param[out] imagePoints 画像上の対応点
+ * @return 読み込めた場合はtrue、そうでなければfalse
+ */
+bool readImagePoints(const std::string& filename, std::vector<cv::Point2f>& imagePoints);
+
+/**
+ * 点群ファイルとして読み込むファイルかどうかを拡張子から判定します。
+ *
+ * @param[in] filename ファイル名
+ * @return 拡張子が.csv、.txt、.binのいずれかであればtrue、そうでなければfalse
+ */
+bool isPointsFile(const std::string& filename);
+
+#endif /* POINTS_H */
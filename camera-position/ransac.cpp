@@ -0,0 +1,262 @@
+#include "ransac.h"
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__)
+ #include <emmintrin.h>
+#endif
+
+static const int kSampleSize = 4; // P3Pに必要な点の数
+static const uint64 kRandomSeed = 0x12345678;
+
+/**
+ * インライアの判定に使う対応点です。
+ * SIMDでまとめて読み込めるように、座標ごとに別々の配列に格納します。
+ */
+struct Correspondences {
+    std::vector<float> x, y, z; // 物体上の点
+    std::vector<float> u, v;    // 歪みを除去した正規化画像座標
+    float fx, fy;               // 正規化画像座標の誤差を画素単位に変換する係数
+};
+
+/**
+ * 仮説の評価結果です。
+ */
+struct Hypothesis {
+    int numInliers;
+    cv::Mat rvec, tvec;
+};
+
+/**
+ * 仮説の姿勢ですべての点を再投影し、再投影誤差が閾値未満の点を数えます。
+ *
+ * @param[in] c 対応点
+ * @param[in] rvec カメラの回転ベクトル
+ * @param[in] tvec カメラの並進ベクトル
+ * @param[in] threshold インライアとみなす再投影誤差の上限 [px]
+ * @param[out] mask 各点がインライアであれば1、そうでなければ0（NULLの場合は書き込まない）
+ * @return インライアの数
+ */
+static int countInliers(const Correspondences& c, const cv::Mat& rvec, const cv::Mat& tvec,
+        double threshold, uchar* mask) {
+    cv::Mat rotMat;
+    cv::Rodrigues(rvec, rotMat);
+    float r[9], t[3];
+    for (int i = 0; i < 9; i++) {
+        r[i] = static_cast<float>(rotMat.at<double>(i / 3, i % 3));
+    }
+    for (int i = 0; i < 3; i++) {
+        t[i] = static_cast<float>(tvec.at<double>(i, 0));
+    }
+    const float threshold2 = static_cast<float>(threshold * threshold);
+    const std::size_t n = c.x.size();
+
+    int count = 0;
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    static const int kBitCount[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    const __m128 r0 = _mm_set1_ps(r[0]), r1 = _mm_set1_ps(r[1]), r2 = _mm_set1_ps(r[2]);
+    const __m128 r3 = _mm_set1_ps(r[3]), r4 = _mm_set1_ps(r[4]), r5 = _mm_set1_ps(r[5]);
+    const __m128 r6 = _mm_set1_ps(r[6]), r7 = _mm_set1_ps(r[7]), r8 = _mm_set1_ps(r[8]);
+    const __m128 t0 = _mm_set1_ps(t[0]), t1 = _mm_set1_ps(t[1]), t2 = _mm_set1_ps(t[2]);
+    const __m128 fx = _mm_set1_ps(c.fx), fy = _mm_set1_ps(c.fy);
+    const __m128 th = _mm_set1_ps(threshold2);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(&c.x[i]);
+        __m128 y = _mm_loadu_ps(&c.y[i]);
+        __m128 z = _mm_loadu_ps(&c.z[i]);
+        __m128 xc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r0, x), _mm_mul_ps(r1, y)), _mm_add_ps(_mm_mul_ps(r2, z), t0));
+        __m128 yc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r3, x), _mm_mul_ps(r4, y)), _mm_add_ps(_mm_mul_ps(r5, z), t1));
+        __m128 zc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r6, x), _mm_mul_ps(r7, y)), _mm_add_ps(_mm_mul_ps(r8, z), t2));
+        __m128 inv = _mm_div_ps(one, zc);
+        __m128 dx = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(xc, inv), _mm_loadu_ps(&c.u[i])), fx);
+        __m128 dy = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(yc, inv), _mm_loadu_ps(&c.v[i])), fy);
+        __m128 e = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        // カメラの後方にある点はインライアとしない
+        int bits = _mm_movemask_ps(_mm_and_ps(_mm_cmplt_ps(e, th), _mm_cmpgt_ps(zc, zero)));
+        count += kBitCount[bits];
+        if (mask != NULL) {
+            mask[i]     = bits & 1;
+            mask[i + 1] = (bits >> 1) & 1;
+            mask[i + 2] = (bits >> 2) & 1;
+            mask[i + 3] = (bits >> 3) & 1;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        float xc = r[0] * c.x[i] + r[1] * c.y[i] + r[2] * c.z[i] + t[0];
+        float yc = r[3] * c.x[i] + r[4] * c.y[i] + r[5] * c.z[i] + t[1];
+        float zc = r[6] * c.x[i] + r[7] * c.y[i] + r[8] * c.z[i] + t[2];
+        float dx = (xc / zc - c.u[i]) * c.fx;
+        float dy = (yc / zc - c.v[i]) * c.fy;
+        bool inlier = zc > 0 && dx * dx + dy * dy < threshold2;
+        count += inlier;
+        if (mask != NULL) {
+            mask[i] = inlier;
+        }
+    }
+    return count;
+}
+
+/**
+ * 無作為に選んだ4点から仮説を生成し、評価します。
+ */
+class HypothesisEvaluator : public cv::ParallelLoopBody {
+public:
+    HypothesisEvaluator(const std::vector<cv::Point3f>& objectPoints,
+            const std::vector<cv::Point2f>& normalizedPoints,
+            const Correspondences& correspondences, double threshold,
+            int firstIteration, std::vector<Hypothesis>& hypotheses)
+        : objectPoints_(objectPoints), normalizedPoints_(normalizedPoints),
+          correspondences_(correspondences), threshold_(threshold),
+          firstIteration_(firstIteration), hypotheses_(hypotheses) {
+    }
+
+    virtual void operator()(const cv::Range& range) const {
+        const int n = static_cast<int>(objectPoints_.size());
+        cv::Mat identity = cv::Mat::eye(3, 3, CV_64FC1);
+        cv::Mat noDistortion;
+        for (int h = range.start; h < range.end; h++) {
+            // 反復ごとに乱数系列を固定し、並列実行の有無によらず同じ結果になるようにする
+            cv::RNG rng(kRandomSeed + firstIteration_ + h);
+            int indices[kSampleSize];
+            std::vector<cv::Point3f> sampleObjectPoints(kSampleSize);
+            std::vector<cv::Point2f> sampleImagePoints(kSampleSize);
+            for (int i = 0; i < kSampleSize; i++) {
+                bool duplicated;
+                do {
+                    indices[i] = rng.uniform(0, n);
+                    duplicated = std::find(indices, indices + i, indices[i]) != indices + i;
+                } while (duplicated);
+                sampleObjectPoints[i] = objectPoints_[indices[i]];
+                sampleImagePoints[i] = normalizedPoints_[indices[i]];
+            }
+
+            Hypothesis& hypothesis = hypotheses_[h];
+            hypothesis.numInliers = 0;
+            if (!cv::solvePnP(sampleObjectPoints, sampleImagePoints, identity, noDistortion,
+                    hypothesis.rvec, hypothesis.tvec, false, CV_P3P)) {
+                continue; // 前の反復で求めた値が残っているので評価しない
+            }
+            if (hypothesis.rvec.total() != 3 || hypothesis.tvec.total() != 3
+                    || !cv::checkRange(hypothesis.rvec) || !cv::checkRange(hypothesis.tvec)) {
+                continue;
+            }
+            hypothesis.numInliers = countInliers(correspondences_, hypothesis.rvec, hypothesis.tvec,
+                    threshold_, NULL);
+        }
+    }
+
+private:
+    const std::vector<cv::Point3f>& objectPoints_;
+    const std::vector<cv::Point2f>& normalizedPoints_;
+    const Correspondences& correspondences_;
+    double threshold_;
+    int firstIteration_;
+    std::vector<Hypothesis>& hypotheses_;
+};
+
+/**
+ * インライア率から、外れ値を含まない標本を信頼度以上の確率で引くのに必要な反復回数を求めます。
+ */
+static int calculateNumIterations(double confidence, double inlierRatio, int maxIterations) {
+    double p = std::pow(inlierRatio, kSampleSize);
+    if (p >= 1.0) {
+        return 1;
+    }
+    if (p <= 0.0) {
+        return maxIterations;
+    }
+    double n = std::log(1.0 - confidence) / std::log(1.0 - p);
+    return n < maxIterations ? static_cast<int>(std::ceil(n)) : maxIterations;
+}
+
+bool estimateCameraPositionRansac(const std::vector<cv::Point3f>& objectPoints,
+        const std::vector<cv::Point2f>& imagePoints,
+        const cv::Mat& intrinsic, const cv::Mat& distortion,
+        const RansacParams& params,
+        cv::Mat& rvec, cv::Mat& tvec,
+        std::vector<uchar>& inlierMask, int& iterations) {
+    const std::size_t n = objectPoints.size();
+    if (n < static_cast<std::size_t>(kSampleSize) || n != imagePoints.size()) {
+        return false;
+    }
+
+    // 歪みの除去は最初に一度だけ行い、以降は正規化画像座標で誤差を評価する
+    std::vector<cv::Point2f> normalizedPoints;
+    cv::undistortPoints(imagePoints, normalizedPoints, intrinsic, distortion);
+    Correspondences correspondences;
+    correspondences.x.resize(n);
+    correspondences.y.resize(n);
+    correspondences.z.resize(n);
+    correspondences.u.resize(n);
+    correspondences.v.resize(n);
+    for (std::size_t i = 0; i < n; i++) {
+        correspondences.x[i] = objectPoints[i].x;
+        correspondences.y[i] = objectPoints[i].y;
+        correspondences.z[i] = objectPoints[i].z;
+        correspondences.u[i] = normalizedPoints[i].x;
+        correspondences.v[i] = normalizedPoints[i].y;
+    }
+    correspondences.fx = static_cast<float>(intrinsic.at<double>(0, 0));
+    correspondences.fy = static_cast<float>(intrinsic.at<double>(1, 1));
+
+    const int batchSize = params.parallel ? std::max(2 * cv::getNumThreads(), 8) : 1;
+    std::vector<Hypothesis> hypotheses(batchSize);
+    Hypothesis best;
+    best.numInliers = 0;
+    int numIterations = params.maxIterations;
+    iterations = 0;
+    while (iterations < numIterations) {
+        int size = std::min(batchSize, numIterations - iterations);
+        HypothesisEvaluator evaluator(objectPoints, normalizedPoints, correspondences,
+                params.threshold, iterations, hypotheses);
+        if (params.parallel) {
+            cv::parallel_for_(cv::Range(0, size), evaluator);
+        } else {
+            evaluator(cv::Range(0, size));
+        }
+
+        // 逐次実行と同じ結果になるように、番号の順に1つずつ反映して反復回数を更新し、
+        // 更新した反復回数を超えた仮説は評価済みでも捨てる
+        for (int h = 0; h < size && iterations < numIterations; h++, iterations++) {
+            if (hypotheses[h].numInliers > best.numInliers) {
+                best.numInliers = hypotheses[h].numInliers;
+                best.rvec = hypotheses[h].rvec.clone();
+                best.tvec = hypotheses[h].tvec.clone();
+                numIterations = std::min(numIterations, calculateNumIterations(params.confidence,
+                        static_cast<double>(best.numInliers) / n, params.maxIterations));
+            }
+        }
+    }
+    if (best.numInliers < kSampleSize) {
+        return false;
+    }
+
+    // インライアのみを使って最適化する
+    inlierMask.resize(n);
+    countInliers(correspondences, best.rvec, best.tvec, params.threshold, &inlierMask[0]);
+    std::vector<cv::Point3f> inlierObjectPoints;
+    std::vector<cv::Point2f> inlierImagePoints;
+    inlierObjectPoints.reserve(best.numInliers);
+    inlierImagePoints.reserve(best.numInliers);
+    for (std::size_t i = 0; i < n; i++) {
+        if (inlierMask[i]) {
+            inlierObjectPoints.push_back(objectPoints[i]);
+            inlierImagePoints.push_back(imagePoints[i]);
+        }
+    }
+    rvec = best.rvec.clone();
+    tvec = best.tvec.clone();
+    cv::solvePnP(inlierObjectPoints, inlierImagePoints, intrinsic, distortion, rvec, tvec, true);
+
+    // 最適化でインライアが減った場合は最良の仮説を採用する
+    std::vector<uchar> refinedMask(n);
+    if (countInliers(correspondences, rvec, tvec, params.threshold, &refinedMask[0]) >= best.numInliers) {
+        inlierMask.swap(refinedMask);
+    } else {
+        rvec = best.rvec;
+        tvec = best.tvec;
+    }
+    return true;
+}
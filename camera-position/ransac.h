@@ -0,0 +1,44 @@
+#ifndef RANSAC_H
+#define RANSAC_H
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+/**
+ * RANSACによるカメラ位置推定のパラメータです。
+ */
+struct RansacParams {
+    double threshold;  // インライアとみなす再投影誤差の上限 [px]
+    double confidence; // 外れ値を含まない標本を少なくとも1回引く確率
+    int maxIterations; // 仮説の最大生成数
+    bool parallel;     // 仮説の評価を並列に実行するかどうか
+
+    RansacParams() : threshold(2.0), confidence(0.99), maxIterations(1000), parallel(false) {
+    }
+};
+
+/**
+ * 外れ値を含む対応点から、RANSACで物体座標空間におけるカメラ位置を推定します。
+ * 4点から求めた仮説（P3P）ごとにすべての点を再投影してインライアを数え、
+ * インライア率から必要な反復回数を更新して打ち切ります。
+ * 最後にインライアのみを使ってカメラ位置を最適化します。
+ *
+ * @param[in] objectPoints 物体上の点
+ * @param[in] imagePoints 画像上の対応点
+ * @param[in] intrinsic カメラの内部パラメータ行列
+ * @param[in] distortion 歪み係数ベクトル
+ * @param[in] params パラメータ
+ * @param[out] rvec カメラの回転ベクトル
+ * @param[out] tvec カメラの並進ベクトル
+ * @param[out] inlierMask 各対応点がインライアであれば1、そうでなければ0
+ * @param[out] iterations 反復回数。並列に評価した仮説のうち、打ち切った後の番号のものは含まない
+ * @return 推定できた場合はtrue、そうでなければfalse
+ */
+bool estimateCameraPositionRansac(const std::vector<cv::Point3f>& objectPoints,
+        const std::vector<cv::Point2f>& imagePoints,
+        const cv::Mat& intrinsic, const cv::Mat& distortion,
+        const RansacParams& params,
+        cv::Mat& rvec, cv::Mat& tvec,
+        std::vector<uchar>& inlierMask, int& iterations);
+
+#endif /* RANSAC_H */
@@ -1,11 +1,20 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <opencv2/opencv.hpp>
 
 static const int kChessPatternRows = 7;
 static const int kChessPatternColumns = 10;
 static const int kChessGridSize = 24; // [mm]
+static const std::size_t kBatchChunkSize = 256; // 一度に並列処理する画像の数
+static const int kTrackingMargin = 16; // 追跡時の探索領域の余白 [px]
+static const double kMaxReprojectionError = 1.5; // 追跡を継続する再投影誤差(RMS)の上限 [px]
 
 /**
  * 物体座標空間におけるチェスボードの内側交点座標を読み込みます。
@@ -151,12 +160,487 @@ static bool writeCameraPosition(const std::string& filename,
     return true;
 }
 
+/**
+ * 1枚の画像に対するカメラ位置の推定結果です。
+ */
+struct PoseResult {
+    const char* status; // "ok", "read_error", "not_found", "detected", "tracked", "lost"
+    cv::Mat rvec;
+    cv::Mat tvec;
+};
+
+/**
+ * 複数の画像に対してカメラ位置の推定を並列に実行します。
+ */
+class BatchEstimator : public cv::ParallelLoopBody {
+public:
+    BatchEstimator(const std::vector<std::string>& filenames, std::size_t offset,
+            const std::vector<cv::Point3f>& objectPoints,
+            const cv::Mat& intrinsic, const cv::Mat& distortion,
+            std::vector<PoseResult>& results)
+        : filenames_(filenames), offset_(offset), objectPoints_(objectPoints),
+          intrinsic_(intrinsic), distortion_(distortion), results_(results) {
+    }
+
+    virtual void operator()(const cv::Range& range) const {
+        cv::Size patternSize(kChessPatternColumns, kChessPatternRows);
+        for (int i = range.start; i < range.end; i++) {
+            PoseResult& result = results_[i];
+            // 交点の検出にはグレースケール画像のみが必要なので、カラー変換を省略する
+            cv::Mat image = cv::imread(filenames_[offset_ + i], CV_LOAD_IMAGE_GRAYSCALE);
+            if (image.data == NULL) {
+                result.status = "read_error";
+                continue;
+            }
+            std::vector<cv::Point2f> imagePoints;
+            bool found = cv::findChessboardCorners(image, patternSize, imagePoints,
+                    CV_CALIB_CB_ADAPTIVE_THRESH | CV_CALIB_CB_NORMALIZE_IMAGE | CV_CALIB_CB_FAST_CHECK);
+            if (!found) {
+                result.status = "not_found";
+                continue;
+            }
+            cv::cornerSubPix(image,
+                    imagePoints,
+                    cv::Size(3, 3),
+                    cv::Size(-1, -1),
+                    cv::TermCriteria(CV_TERMCRIT_ITER | CV_TERMCRIT_EPS, 20, 0.03));
+            cv::solvePnP(objectPoints_, imagePoints, intrinsic_, distortion_,
+                    result.rvec, result.tvec);
+            result.status = "ok";
+        }
+    }
+
+private:
+    const std::vector<std::string>& filenames_;
+    std::size_t offset_;
+    const std::vector<cv::Point3f>& objectPoints_;
+    const cv::Mat& intrinsic_;
+    const cv::Mat& distortion_;
+    std::vector<PoseResult>& results_;
+};
+
+static int filterHiddenFile(const struct dirent* file) {
+    return file->d_name[0] != '.';
+}
+
+/**
+ * ディレクトリ、または画像ファイル名を1行ずつ書いたファイルから画像ファイル名の一覧を読み込みます。
+ *
+ * @param[in] path ディレクトリ名、またはファイル名
+ * @param[out] filenames 画像ファイル名の一覧
+ * @return 読み込めた場合はtrue、そうでなければfalse
+ */
+static bool readImageFileNames(const std::string& path,
+        std::vector<std::string>& filenames) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        std::cerr << "ERROR: No such file or directory: " << path << std::endl;
+        return false;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        struct dirent** list;
+        int size = scandir(path.c_str(), &list, filterHiddenFile, alphasort);
+        if (size == -1) {
+            std::cerr << "ERROR: Failed to scan directory: " << path << std::endl;
+            return false;
+        }
+        std::string dir = path;
+        if (dir[dir.size() - 1] != '/') {
+            dir += '/';
+        }
+        filenames.reserve(size);
+        for (int i = 0; i < size; i++) {
+            filenames.push_back(dir + list[i]->d_name);
+            free(list[i]);
+        }
+        free(list);
+        return true;
+    }
+
+    std::ifstream ifs(path.c_str());
+    if (!ifs.is_open()) {
+        std::cerr << "ERROR: Failed to open file: " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        filenames.push_back(line);
+    }
+    return true;
+}
+
+/**
+ * 推定結果をCSV形式で1行書き込みます。
+ *
+ * @param[in] fp 出力先
+ * @param[in] key 先頭の列に書き込む値（画像ファイル名や時刻）
+ * @param[in] result 推定結果
+ */
+static void writePoseResult(FILE* fp, const std::string& key, const PoseResult& result) {
+    if (result.rvec.empty() || result.tvec.empty()) {
+        fprintf(fp, "%s,%s,,,,,,\n", key.c_str(), result.status);
+        return;
+    }
+    const double* r = result.rvec.ptr<double>();
+    const double* t = result.tvec.ptr<double>();
+    fprintf(fp, "%s,%s,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n", key.c_str(), result.status,
+            r[0], r[1], r[2], t[0], t[1], t[2]);
+}
+
+/**
+ * 複数の画像について物体座標空間におけるカメラ位置を推定し、結果をファイルに書き込みます。
+ * カメラパラメータは一度だけ読み込み、推定は kBatchChunkSize 枚ずつ並列に実行します。
+ *
+ * @param[in] imageListName 画像が置いてあるディレクトリ名、または画像ファイル名の一覧が書かれたファイル名
+ * @param[in] cameraParamsFileName カメラの内部パラメータが書かれたファイル名
+ * @param[in] outputFileName 推定結果を書き込むファイル名
+ * @return 結果をすべて書き込めた場合はtrue、読み込みや書き込みに失敗した場合はfalse。
+ *         チェスボードが見つからなかった画像はファイルの status 列と件数の表示だけで知らせる
+ */
+static bool estimateCameraPositions(const std::string& imageListName,
+        const std::string& cameraParamsFileName,
+        const std::string& outputFileName) {
+    std::vector<std::string> filenames;
+    if (!readImageFileNames(imageListName, filenames)) {
+        std::cerr << "ERROR: Failed to read image file names\n";
+        return false;
+    }
+
+    cv::Mat intrinsic, distortion;
+    if (!readCameraParameters(cameraParamsFileName, intrinsic, distortion)) {
+        std::cerr << "ERROR: Failed to read camera parameters\n";
+        return false;
+    }
+
+    std::vector<cv::Point3f> objectPoints;
+    readObjectPointsOnChessboard(objectPoints);
+
+    FILE* fp = fopen(outputFileName.c_str(), "w");
+    if (fp == NULL) {
+        std::cerr << "ERROR: Failed to open file: " << outputFileName << std::endl;
+        return false;
+    }
+    fprintf(fp, "# image,status,rx,ry,rz,tx,ty,tz\n");
+
+    std::size_t numSucceeded = 0;
+    int64 startTick = cv::getTickCount();
+    for (std::size_t offset = 0; offset < filenames.size(); offset += kBatchChunkSize) {
+        std::size_t n = std::min(kBatchChunkSize, filenames.size() - offset);
+        std::vector<PoseResult> results(n);
+        cv::parallel_for_(cv::Range(0, (int) n),
+                BatchEstimator(filenames, offset, objectPoints, intrinsic, distortion, results));
+
+        // 並列に処理した結果を入力順に書き出す
+        for (std::size_t i = 0; i < n; i++) {
+            writePoseResult(fp, filenames[offset + i], results[i]);
+            if (!results[i].rvec.empty()) {
+                numSucceeded++;
+            }
+        }
+        fflush(fp);
+        std::cerr << offset + n << "/" << filenames.size() << "\r";
+    }
+    double elapsed = (cv::getTickCount() - startTick) / cv::getTickFrequency();
+    bool written = !ferror(fp);
+    if (fclose(fp) != 0 || !written) {
+        std::cerr << "ERROR: Failed to write file: " << outputFileName << std::endl;
+        return false;
+    }
+
+    std::cout << "Estimated " << numSucceeded << "/" << filenames.size() << " images"
+            << " in " << elapsed << " [s]" << std::endl;
+    std::cout << "Write the camera positions to " << outputFileName << std::endl;
+    return true;
+}
+
+/**
+ * チェスボードの交点を追跡する状態です。
+ */
+struct ChessboardTracker {
+    bool tracking;                    // 前フレームの交点を追跡中かどうか
+    cv::Mat prevGrayImage;            // 前フレームのグレースケール画像
+    std::vector<cv::Point2f> corners; // 前フレームのチェスボードの交点位置
+    cv::Mat rvec;                     // 前フレームのカメラの回転ベクトル
+    cv::Mat tvec;                     // 前フレームのカメラの並進ベクトル
+
+    ChessboardTracker() : tracking(false) {
+    }
+};
+
+/**
+ * グレースケール画像からチェスボードの内側交点位置を検出します。
+ *
+ * @param[in] grayImage グレースケール画像
+ * @param[out] corners チェスボードの交点位置
+ * @return 検出できた場合はtrue、そうでなければfalse
+ */
+static bool detectChessboardCorners(const cv::Mat& grayImage, std::vector<cv::Point2f>& corners) {
+    cv::Size patternSize(kChessPatternColumns, kChessPatternRows);
+    bool found = cv::findChessboardCorners(grayImage, patternSize, corners,
+            CV_CALIB_CB_ADAPTIVE_THRESH | CV_CALIB_CB_NORMALIZE_IMAGE | CV_CALIB_CB_FAST_CHECK);
+    if (!found) {
+        return false;
+    }
+    cv::cornerSubPix(grayImage,
+            corners,
+            cv::Size(3, 3),
+            cv::Size(-1, -1),
+            cv::TermCriteria(CV_TERMCRIT_ITER | CV_TERMCRIT_EPS, 20, 0.03));
+    return true;
+}
+
+/**
+ * 前フレームの交点位置の周辺領域だけを対象に、ピラミッドLucas-Kanade法で交点を追跡します。
+ *
+ * @param[in] prevGrayImage 前フレームのグレースケール画像
+ * @param[in] grayImage 現フレームのグレースケール画像
+ * @param[in,out] corners 前フレームの交点位置、追跡後の交点位置
+ * @return すべての交点を追跡できた場合はtrue、そうでなければfalse
+ */
+static bool trackChessboardCorners(const cv::Mat& prevGrayImage, const cv::Mat& grayImage,
+        std::vector<cv::Point2f>& corners) {
+    // 交点を囲む矩形に余白を付けた領域を探索領域とする
+    cv::Rect bounds = cv::boundingRect(corners);
+    int margin = kTrackingMargin + std::max(bounds.width, bounds.height) / 4;
+    cv::Rect roi(bounds.x - margin, bounds.y - margin,
+            bounds.width + 2 * margin, bounds.height + 2 * margin);
+    roi = roi & cv::Rect(0, 0, grayImage.cols, grayImage.rows);
+    if (roi.area() == 0) {
+        return false;
+    }
+
+    cv::Point2f offset(roi.x, roi.y);
+    std::vector<cv::Point2f> prevPoints(corners.size());
+    for (std::size_t i = 0; i < corners.size(); i++) {
+        prevPoints[i] = corners[i] - offset;
+    }
+    std::vector<cv::Point2f> nextPoints;
+    std::vector<uchar> status;
+    std::vector<float> error;
+    cv::Mat prevRoiImage = prevGrayImage(roi);
+    cv::Mat roiImage = grayImage(roi);
+    cv::calcOpticalFlowPyrLK(prevRoiImage, roiImage, prevPoints, nextPoints, status, error,
+            cv::Size(15, 15), 2);
+    for (std::size_t i = 0; i < nextPoints.size(); i++) {
+        const cv::Point2f& p = nextPoints[i];
+        if (!status[i] || p.x < 0 || p.y < 0 || p.x >= roi.width || p.y >= roi.height) {
+            return false;
+        }
+    }
+
+    // 追跡結果は少ない反復回数でサブピクセル精度に補正する
+    cv::cornerSubPix(roiImage,
+            nextPoints,
+            cv::Size(3, 3),
+            cv::Size(-1, -1),
+            cv::TermCriteria(CV_TERMCRIT_ITER | CV_TERMCRIT_EPS, 5, 0.03));
+    for (std::size_t i = 0; i < nextPoints.size(); i++) {
+        corners[i] = nextPoints[i] + offset;
+    }
+    return true;
+}
+
+/**
+ * 再投影誤差の二乗平均平方根を計算します。
+ */
+static double calculateReprojectionError(const std::vector<cv::Point3f>& objectPoints,
+        const std::vector<cv::Point2f>& imagePoints,
+        const cv::Mat& intrinsic, const cv::Mat& distortion,
+        const cv::Mat& rvec, const cv::Mat& tvec) {
+    std::vector<cv::Point2f> reprojectedPoints;
+    cv::projectPoints(objectPoints, rvec, tvec, intrinsic, distortion, reprojectedPoints);
+    double sum = 0.0;
+    for (std::size_t i = 0; i < imagePoints.size(); i++) {
+        cv::Point2f d = imagePoints[i] - reprojectedPoints[i];
+        sum += d.x * d.x + d.y * d.y;
+    }
+    return std::sqrt(sum / imagePoints.size());
+}
+
+/**
+ * 1フレーム分のカメラ位置を推定します。
+ * 追跡中は前フレームの交点を追跡し、前フレームの姿勢を初期値としてsolvePnPを解きます。
+ * 追跡に失敗した場合、または再投影誤差が大きい場合はチェスボードを検出し直します。
+ *
+ * @param[in,out] tracker 追跡の状態
+ * @param[in] grayImage 現フレームのグレースケール画像
+ * @param[in] objectPoints 物体上の点
+ * @param[in] intrinsic カメラの内部パラメータ行列
+ * @param[in] distortion 歪み係数ベクトル
+ * @return 推定結果
+ */
+static PoseResult updateChessboardTracker(ChessboardTracker& tracker, const cv::Mat& grayImage,
+        const std::vector<cv::Point3f>& objectPoints,
+        const cv::Mat& intrinsic, const cv::Mat& distortion) {
+    PoseResult result;
+    if (tracker.tracking
+            && trackChessboardCorners(tracker.prevGrayImage, grayImage, tracker.corners)) {
+        cv::solvePnP(objectPoints, tracker.corners, intrinsic, distortion,
+                tracker.rvec, tracker.tvec, true);
+        double error = calculateReprojectionError(objectPoints, tracker.corners,
+                intrinsic, distortion, tracker.rvec, tracker.tvec);
+        tracker.tracking = error <= kMaxReprojectionError;
+        result.status = "tracked";
+    } else {
+        tracker.tracking = false;
+    }
+
+    if (!tracker.tracking) {
+        if (!detectChessboardCorners(grayImage, tracker.corners)) {
+            tracker.prevGrayImage.release();
+            result.status = "lost";
+            return result;
+        }
+        cv::solvePnP(objectPoints, tracker.corners, intrinsic, distortion, tracker.rvec, tracker.tvec);
+        tracker.tracking = true;
+        result.status = "detected";
+    }
+
+    grayImage.copyTo(tracker.prevGrayImage);
+    result.rvec = tracker.rvec;
+    result.tvec = tracker.tvec;
+    return result;
+}
+
+/**
+ * 動画またはカメラの各フレームについて、チェスボードを追跡しながらカメラ位置を推定します。
+ *
+ * @param[in] source 動画ファイル名、またはカメラ番号
+ * @param[in] cameraParamsFileName カメラの内部パラメータが書かれたファイル名
+ * @param[in] outputFileName 推定結果を書き込むファイル名
+ * @return 推定を開始できた場合はtrue、そうでなければfalse
+ */
+static bool trackCameraPosition(const std::string& source,
+        const std::string& cameraParamsFileName,
+        const std::string& outputFileName) {
+    cv::VideoCapture capture;
+    bool isCamera = source.find_first_not_of("0123456789") == std::string::npos;
+    if (isCamera ? !capture.open(atoi(source.c_str())) : !capture.open(source)) {
+        std::cerr << "ERROR: Failed to open video: " << source << std::endl;
+        return false;
+    }
+
+    cv::Mat intrinsic, distortion;
+    if (!readCameraParameters(cameraParamsFileName, intrinsic, distortion)) {
+        std::cerr << "ERROR: Failed to read camera parameters\n";
+        return false;
+    }
+
+    std::vector<cv::Point3f> objectPoints;
+    readObjectPointsOnChessboard(objectPoints);
+
+    FILE* fp = fopen(outputFileName.c_str(), "w");
+    if (fp == NULL) {
+        std::cerr << "ERROR: Failed to open file: " << outputFileName << std::endl;
+        return false;
+    }
+    fprintf(fp, "# time_ms,status,rx,ry,rz,tx,ty,tz\n");
+
+    const std::string windowName = "Chessboard Tracking";
+    cv::namedWindow(windowName, cv::WINDOW_AUTOSIZE);
+    cv::Size patternSize(kChessPatternColumns, kChessPatternRows);
+
+    ChessboardTracker tracker;
+    int numDetected = 0, numTracked = 0, numLost = 0;
+    int64 detectionTicks = 0, trackingTicks = 0;
+    int64 startTick = cv::getTickCount();
+    cv::Mat frame, grayImage;
+    while (capture.read(frame)) {
+        double time = isCamera
+                ? (cv::getTickCount() - startTick) * 1000.0 / cv::getTickFrequency()
+                : capture.get(CV_CAP_PROP_POS_MSEC);
+
+        int64 tick = cv::getTickCount();
+        cv::cvtColor(frame, grayImage, CV_BGR2GRAY);
+        PoseResult result = updateChessboardTracker(tracker, grayImage, objectPoints,
+                intrinsic, distortion);
+        tick = cv::getTickCount() - tick;
+        if (result.status == std::string("tracked")) {
+            numTracked++;
+            trackingTicks += tick;
+        } else if (result.status == std::string("detected")) {
+            numDetected++;
+            detectionTicks += tick;
+        } else {
+            numLost++;
+        }
+
+        char key[32];
+        snprintf(key, sizeof(key), "%.3f", time);
+        writePoseResult(fp, key, result);
+
+        if (tracker.tracking) {
+            cv::drawChessboardCorners(frame, patternSize, tracker.corners, true);
+        }
+        cv::imshow(windowName, frame);
+        if (cv::waitKey(1) == 'q') {
+            break;
+        }
+    }
+    if (fclose(fp) != 0) {
+        std::cerr << "ERROR: Failed to write file: " << outputFileName << std::endl;
+        return false;
+    }
+
+    double msPerTick = 1000.0 / cv::getTickFrequency();
+    std::cout << "detected: " << numDetected << " frames, "
+            << (numDetected ? detectionTicks * msPerTick / numDetected : 0.0) << " [ms/frame]\n";
+    std::cout << "tracked:  " << numTracked << " frames, "
+            << (numTracked ? trackingTicks * msPerTick / numTracked : 0.0) << " [ms/frame]\n";
+    std::cout << "lost:     " << numLost << " frames\n";
+    std::cout << "Write the camera positions to " << outputFileName << std::endl;
+    return true;
+}
+
+static void printUsage(const char* program) {
+    std::cerr << "usage: "
+            << program
+            << " <image file> <camera parameters file>\n"
+            << "       "
+            << program
+            << " -b <image directory | image list file> <camera parameters file> [output file]\n"
+            << "       "
+            << program
+            << " -t <video file | camera number> <camera parameters file> [output file]"
+            << std::endl;
+}
+
 int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "-b") {
+        if (argc <= 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        const std::string imageListName(argv[2]);
+        const std::string cameraParamsFileName(argv[3]);
+        const std::string outputFileName(argc > 4 ? argv[4] : "camera_positions.csv");
+        if (!estimateCameraPositions(imageListName, cameraParamsFileName, outputFileName)) {
+            std::cerr << "ERROR: Failed to estimate camera positions" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "-t") {
+        if (argc <= 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        const std::string source(argv[2]);
+        const std::string cameraParamsFileName(argv[3]);
+        const std::string outputFileName(argc > 4 ? argv[4] : "camera_trajectory.csv");
+        if (!trackCameraPosition(source, cameraParamsFileName, outputFileName)) {
+            std::cerr << "ERROR: Failed to track camera position" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
     if (argc <= 2) {
-        std::cerr << "usage: "
-                << argv[0]
-                << " <image file> <camera parameters file>"
-                << std::endl;
+        printUsage(argv[0]);
         return 1;
     }
     const std::string imageFileName(argv[1]);
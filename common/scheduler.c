@@ -0,0 +1,240 @@
+#define _POSIX_C_SOURCE 199309L
+#define GL_GLEXT_PROTOTYPES
+
+#include "scheduler.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined __APPLE__ && defined __MACH__
+ #include <GLUT/glut.h>
+ #include <OpenGL/OpenGL.h>
+ #define glGetQueryObjectui64v glGetQueryObjectui64vEXT
+#else
+ #include <GL/glut.h>
+ #include <GL/glx.h>
+#endif // __APPLE__ && __MACH__
+
+#ifndef GL_TIME_ELAPSED
+ #define GL_TIME_ELAPSED 0x88BF
+#endif // GL_TIME_ELAPSED
+
+// 結果を待たずに続けて使う計測用クエリの数
+enum { kNumQueries = 4 };
+
+static const double kMaxInterval = 250.0; // これより間が空いたフレームは続けて描画したとみなさない [ms]
+
+static bool s_dirty;
+static bool s_inFrame;
+static double s_frameStart;
+static double s_lastSwap = -1.0;
+
+static unsigned int s_contentPeriod;
+static SchedulerUpdate s_contentUpdate;
+static int s_contentGeneration; // 設定し直す前のタイマーを止めるための番号
+
+static GLuint s_queries[kNumQueries];
+static bool s_queryPending[kNumQueries];
+static long s_queryFrame[kNumQueries]; // 計測したフレームの番号
+static int s_queryIndex;
+static bool s_queryActive; // このフレームで計測している
+
+static SchedulerStatistics s_statistics;
+
+static double getTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0; // [ms]
+}
+
+static bool isSupported(int major, int minor)
+{
+    const char* version = (const char*) glGetString(GL_VERSION);
+    int glMajor = 0, glMinor = 0;
+    if (version == NULL || sscanf(version, "%d.%d", &glMajor, &glMinor) != 2) {
+        return false;
+    }
+    return glMajor > major || (glMajor == major && glMinor >= minor);
+}
+
+// 空白で区切られた拡張機能の一覧に name があるか。他の名前の一部に一致しても数えない
+static bool containsExtension(const char* extensions, const char* name)
+{
+    size_t length = strlen(name);
+    for (const char* p = extensions; p != NULL && (p = strstr(p, name)) != NULL; p += length) {
+        if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool hasExtension(const char* name)
+{
+    return containsExtension((const char*) glGetString(GL_EXTENSIONS), name);
+}
+
+// バッファを交換する垂直同期の間隔を設定する。設定できた間隔を返す
+static int setSwapInterval(int interval)
+{
+#if defined __APPLE__ && defined __MACH__
+    GLint value = interval;
+    return CGLSetParameter(CGLGetCurrentContext(), kCGLCPSwapInterval, &value) == kCGLNoError ? interval : 0;
+#else
+    // GLVNDでは拡張機能がなくても glXGetProcAddressARB が関数を返すので、先に拡張機能の一覧を確かめる
+    Display* display = glXGetCurrentDisplay();
+    if (display == NULL) {
+        return 0;
+    }
+    const char* extensions = glXQueryExtensionsString(display, DefaultScreen(display));
+    typedef int (*SwapIntervalFunction)(unsigned int interval);
+    const char* names[][2] = {
+        { "GLX_MESA_swap_control", "glXSwapIntervalMESA" },
+        { "GLX_SGI_swap_control", "glXSwapIntervalSGI" },
+    };
+    for (int i = 0; i < 2; i++) {
+        if (!containsExtension(extensions, names[i][0])) {
+            continue;
+        }
+        SwapIntervalFunction swapInterval =
+                (SwapIntervalFunction) glXGetProcAddressARB((const GLubyte*) names[i][1]);
+        if (swapInterval != NULL && swapInterval(interval) == 0) {
+            return interval;
+        }
+    }
+    return 0;
+#endif // __APPLE__ && __MACH__
+}
+
+// 結果が出ているクエリだけを集計する。結果を待つとGPUと同期してしまう
+static void collectQueries(void)
+{
+    for (int i = 0; i < kNumQueries; i++) {
+        if (!s_queryPending[i]) {
+            continue;
+        }
+        GLuint available = 0;
+        glGetQueryObjectuiv(s_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            continue;
+        }
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(s_queries[i], GL_QUERY_RESULT, &elapsed);
+        double time = elapsed / 1000000.0; // [ms]
+        s_statistics.gpuFrames++;
+        s_statistics.gpuTime += time;
+        s_statistics.maxGpuTime = fmax(s_statistics.maxGpuTime, time);
+        if (s_queryFrame[i] > s_statistics.lastGpuFrame) {
+            s_statistics.lastGpuFrame = s_queryFrame[i];
+            s_statistics.lastGpuTime = time;
+        }
+        s_queryPending[i] = false;
+    }
+}
+
+void scheduler_initialize(bool vsync)
+{
+    memset(&s_statistics, 0, sizeof(s_statistics));
+    s_statistics.lastGpuFrame = -1;
+    s_statistics.swapInterval = setSwapInterval(vsync ? 1 : 0);
+    s_statistics.timerQuery = isSupported(3, 3)
+            || hasExtension("GL_ARB_timer_query") || hasExtension("GL_EXT_timer_query");
+    if (s_statistics.timerQuery) {
+        glGenQueries(kNumQueries, s_queries);
+    }
+}
+
+void scheduler_finalize(void)
+{
+    if (s_statistics.timerQuery) {
+        glDeleteQueries(kNumQueries, s_queries);
+        memset(s_queryPending, 0, sizeof(s_queryPending));
+    }
+    s_contentGeneration++;
+}
+
+void scheduler_invalidate(void)
+{
+    if (!s_dirty) {
+        s_dirty = true;
+        glutPostRedisplay();
+    }
+}
+
+static void contentTimer(int generation)
+{
+    if (generation != s_contentGeneration) {
+        return;
+    }
+    if (s_contentUpdate()) {
+        scheduler_invalidate();
+    }
+    glutTimerFunc(s_contentPeriod, contentTimer, generation);
+}
+
+void scheduler_setContentTimer(unsigned int period, SchedulerUpdate update)
+{
+    s_contentPeriod = period;
+    s_contentUpdate = update;
+    s_contentGeneration++;
+    if (update != NULL) {
+        glutTimerFunc(period, contentTimer, s_contentGeneration);
+    }
+}
+
+void scheduler_beginFrame(void)
+{
+    // 描画中に要求された再描画は次のフレームで行う
+    s_dirty = false;
+    s_inFrame = true;
+    s_frameStart = getTime();
+
+    s_queryActive = false;
+    if (s_statistics.timerQuery) {
+        collectQueries();
+        if (!s_queryPending[s_queryIndex]) {
+            glBeginQuery(GL_TIME_ELAPSED, s_queries[s_queryIndex]);
+            s_queryFrame[s_queryIndex] = (long) s_statistics.frames;
+            s_queryActive = true;
+        }
+    }
+}
+
+void scheduler_endFrame(void)
+{
+    if (!s_inFrame) {
+        return;
+    }
+    s_inFrame = false;
+    if (s_queryActive) {
+        glEndQuery(GL_TIME_ELAPSED);
+        s_queryPending[s_queryIndex] = true;
+        s_queryIndex = (s_queryIndex + 1) % kNumQueries;
+    }
+
+    double cpuTime = getTime() - s_frameStart;
+    s_statistics.frames++;
+    s_statistics.cpuTime += cpuTime;
+    s_statistics.maxCpuTime = fmax(s_statistics.maxCpuTime, cpuTime);
+
+    glutSwapBuffers(); // ダブルバッファリングのためのバッファの交換。垂直同期が有効なら待たされる
+
+    double now = getTime();
+    double interval = now - s_lastSwap;
+    if (s_lastSwap >= 0.0 && interval <= kMaxInterval) {
+        s_statistics.intervals++;
+        s_statistics.intervalTime += interval;
+        s_statistics.intervalSquareTime += interval * interval;
+        s_statistics.maxInterval = fmax(s_statistics.maxInterval, interval);
+    }
+    s_lastSwap = now;
+}
+
+const SchedulerStatistics* scheduler_getStatistics(void)
+{
+    if (s_statistics.timerQuery) {
+        collectQueries();
+    }
+    return &s_statistics;
+}
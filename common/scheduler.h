@@ -0,0 +1,35 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+
+typedef struct
+{
+    unsigned long frames;
+    double cpuTime, maxCpuTime; // 描画の開始からバッファの交換までの時間 [ms]
+    unsigned long gpuFrames;    // GPU時間を計測できたフレーム数
+    double gpuTime, maxGpuTime; // [ms]
+    unsigned long intervals;    // 続けて描画したフレームの間隔の数
+    double intervalTime, intervalSquareTime, maxInterval; // [ms]
+    long lastGpuFrame;          // GPU時間を受け取った最新のフレームの番号 (0から)。まだなければ-1
+    double lastGpuTime;         // そのフレームのGPU時間 [ms]
+    bool timerQuery;            // GPU時間を計測できるか
+    int swapInterval;           // 垂直同期の間隔。設定できなかった場合は0
+} SchedulerStatistics;
+
+// 新しい内容があれば反映してtrueを返す
+typedef bool (*SchedulerUpdate)(void);
+
+// OpenGLのコンテキストを作成してから呼び出す。垂直同期を切り替え、GPU時間の計測を準備する
+void scheduler_initialize(bool vsync);
+void scheduler_finalize(void);
+// 再描画を要求する。続けて何度呼び出しても描画は1回にまとめられる
+void scheduler_invalidate(void);
+// 表示とは別に period [ms] ごとに update を呼び出し、新しい内容があれば再描画を要求する
+void scheduler_setContentTimer(unsigned int period, SchedulerUpdate update);
+// 描画の開始と終了に呼び出す。終了ではバッファを交換する
+void scheduler_beginFrame(void);
+void scheduler_endFrame(void);
+const SchedulerStatistics* scheduler_getStatistics(void);
+
+#endif /* SCHEDULER_H */
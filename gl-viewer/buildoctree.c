@@ -0,0 +1,744 @@
+#define _DEFAULT_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "logger.h"
+#include "octree.h"
+#include "ply.h"
+
+enum
+{
+    kCountLevel = 7,             // 点の数を数える格子の深さ (128 分割)
+    kMaxChunkPoints = 1 << 22,   // まとめてメモリ上で八分木を作る点の数の上限
+    kMaxNodePoints = 1 << 15,    // 葉の点の数の上限
+    kMaxLevel = 24,
+    kChunkBufferPoints = 4096,
+    kGridCells = OCTREE_GRID_SIZE * OCTREE_GRID_SIZE * OCTREE_GRID_SIZE,
+};
+
+typedef struct
+{
+    uint64_t offset;
+    uint32_t numPoints;
+    int children[8]; // BuildNode の番号。なければ -1
+} BuildNode;
+
+// 根に近く点が多すぎる節点。入力を流しながら間引いた点を集め、残りを子へ渡す
+typedef struct
+{
+    int node;
+    double min[3], size; // 根の最小の角からの範囲
+    uint8_t* occupied;   // 間引く格子の埋まっているセル
+    OctreePoint* points;
+    size_t numPoints, capacity;
+} UpperNode;
+
+// メモリ上でまとめて八分木を作る範囲。点はいったん一時ファイルに書き出す
+typedef struct
+{
+    int node;
+    int level;
+    double min[3], size;
+    char path[PATH_MAX];
+    OctreePoint* buffer;
+    size_t numBuffered;
+    size_t numPoints;
+} Chunk;
+
+typedef struct
+{
+    const uint8_t* data;
+    size_t stride;
+    size_t count;
+    size_t offsets[6]; // x, y, z, red, green, blue
+    PlyType types[6];
+    bool hasColors;
+} Input;
+
+static Input s_input;
+static double s_min[3], s_size; // 根の立方体
+static double s_max[3];         // 点の範囲の最大の角
+static size_t s_numPoints;      // 座標が有効な点の数
+
+static uint64_t* s_counts[kCountLevel + 1];
+static int32_t* s_cells[kCountLevel + 1]; // 0以上は UpperNode、-2以下は Chunk の番号、-1は点がない
+
+static BuildNode* s_nodes;
+static int s_numNodes, s_nodeCapacity;
+static UpperNode* s_uppers;
+static int s_numUppers;
+static Chunk* s_chunks;
+static int s_numChunks;
+
+static FILE* s_output;
+static uint64_t s_outputOffset;
+static uint8_t s_occupied[kGridCells / 8];
+
+static double getTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0; // [s]
+}
+
+static bool openInput(const char* filename, const uint8_t** mapped, size_t* size)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        LOG_ERROR("Failed to open file: %s", filename);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        LOG_ERROR("Empty file: %s", filename);
+        close(fd);
+        return false;
+    }
+    *size = st.st_size;
+    void* data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        LOG_ERROR("Failed to map file: %s", filename);
+        return false;
+    }
+    madvise(data, *size, MADV_SEQUENTIAL);
+    *mapped = data;
+
+    PlyElement elements[PLY_MAX_ELEMENTS];
+    int numElements;
+    const uint8_t* p = ply_parseHeader(data, *size, elements, &numElements);
+    if (p == NULL) {
+        LOG_ERROR("Unsupported PLY header: %s", filename);
+        return false;
+    }
+    static const char* names[6] = { "x", "y", "z", "red", "green", "blue" };
+    for (int e = 0; e < numElements; e++) {
+        size_t fixedSize = ply_getFixedSize(&elements[e]);
+        if (fixedSize == 0) {
+            break; // list を含む要素より後ろは読み飛ばせない
+        }
+        if (strcmp(elements[e].name, "vertex") != 0) {
+            p += fixedSize * elements[e].count;
+            continue;
+        }
+        bool found[6];
+        for (int k = 0; k < 6; k++) {
+            found[k] = ply_findProperty(&elements[e], names[k], &s_input.offsets[k], &s_input.types[k]);
+        }
+        if (!found[0] || !found[1] || !found[2]) {
+            break;
+        }
+        if ((size_t) ((const uint8_t*) data + *size - p) / fixedSize < elements[e].count) {
+            LOG_ERROR("PLY data is truncated: %s", filename);
+            return false;
+        }
+        s_input.data = p;
+        s_input.stride = fixedSize;
+        s_input.count = elements[e].count;
+        s_input.hasColors = found[3] && found[4] && found[5];
+        return true;
+    }
+    LOG_ERROR("No vertex positions in PLY file: %s", filename);
+    return false;
+}
+
+static uint8_t toColor(const uint8_t* p, PlyType type)
+{
+    double value = ply_readValue(p, type);
+    if (type == PlyType_FLOAT32 || type == PlyType_FLOAT64) {
+        value *= 255.0; // 浮動小数点数の色は 0 から 1 の範囲
+    }
+    return (uint8_t) fmax(fmin(value, 255.0), 0.0);
+}
+
+// 座標が有限の値でなければfalseを返す。そのような点は読み飛ばす
+static bool readPosition(size_t index, double position[3])
+{
+    const uint8_t* p = s_input.data + index * s_input.stride;
+    for (int k = 0; k < 3; k++) {
+        position[k] = ply_readValue(p + s_input.offsets[k], s_input.types[k]);
+    }
+    return isfinite(position[0]) && isfinite(position[1]) && isfinite(position[2]);
+}
+
+// 点を読み、根の最小の角からの座標に直す。元の座標も position に返す
+static bool readPoint(size_t index, double position[3], OctreePoint* point)
+{
+    const uint8_t* p = s_input.data + index * s_input.stride;
+    if (!readPosition(index, position)) {
+        return false;
+    }
+    point->x = (float) (position[0] - s_min[0]);
+    point->y = (float) (position[1] - s_min[1]);
+    point->z = (float) (position[2] - s_min[2]);
+    if (s_input.hasColors) {
+        point->r = toColor(p + s_input.offsets[3], s_input.types[3]);
+        point->g = toColor(p + s_input.offsets[4], s_input.types[4]);
+        point->b = toColor(p + s_input.offsets[5], s_input.types[5]);
+    } else {
+        point->r = point->g = point->b = 255;
+    }
+    point->a = 255;
+    return true;
+}
+
+static int clampCell(double value, int n)
+{
+    int cell = (int) value;
+    return (cell < 0) ? 0 : (cell >= n ? n - 1 : cell);
+}
+
+static size_t getCellIndex(int level, int x, int y, int z)
+{
+    size_t n = (size_t) 1 << level;
+    return ((size_t) z * n + y) * n + x;
+}
+
+// 点の数を数える格子でのセルの位置を求める。
+// 数える時と分ける時でセルがずれないように、どちらも元の座標から倍精度で計算する
+static void getCountCell(const double position[3], int cell[3])
+{
+    int n = 1 << kCountLevel;
+    double scale = n / s_size;
+    for (int k = 0; k < 3; k++) {
+        cell[k] = clampCell((position[k] - s_min[k]) * scale, n);
+    }
+}
+
+// 範囲 (min, size) の間引く格子での点のセルの番号を返す
+static size_t getGridIndex(const OctreePoint* point, const double min[3], double size)
+{
+    double scale = OCTREE_GRID_SIZE / size;
+    int x = clampCell((point->x - min[0]) * scale, OCTREE_GRID_SIZE);
+    int y = clampCell((point->y - min[1]) * scale, OCTREE_GRID_SIZE);
+    int z = clampCell((point->z - min[2]) * scale, OCTREE_GRID_SIZE);
+    return ((size_t) z * OCTREE_GRID_SIZE + y) * OCTREE_GRID_SIZE + x;
+}
+
+// 格子のセルが空いていれば埋めてtrueを返す
+static bool occupy(uint8_t* occupied, size_t index)
+{
+    uint8_t bit = 1 << (index & 7);
+    if (occupied[index >> 3] & bit) {
+        return false;
+    }
+    occupied[index >> 3] |= bit;
+    return true;
+}
+
+// メモリが足りなければ続けられないので終了する
+static void* reallocate(void* p, size_t size)
+{
+    p = realloc(p, size);
+    if (p == NULL) {
+        LOG_ERROR("Failed to allocate %zu bytes", size);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void* allocate(size_t size)
+{
+    return reallocate(NULL, size);
+}
+
+static int addNode(void)
+{
+    if (s_numNodes >= s_nodeCapacity) {
+        s_nodeCapacity = (s_nodeCapacity > 0) ? s_nodeCapacity * 2 : 1024;
+        s_nodes = reallocate(s_nodes, sizeof(BuildNode) * s_nodeCapacity);
+    }
+    BuildNode* node = &s_nodes[s_numNodes];
+    memset(node, 0, sizeof(*node));
+    for (int i = 0; i < 8; i++) {
+        node->children[i] = -1;
+    }
+    return s_numNodes++;
+}
+
+// 範囲を追加して番号を返す。s_chunks を確保し直すので、以前のポインタは使えなくなる
+static int addChunk(int node, int level, const double min[3], double size, const char* output)
+{
+    s_chunks = reallocate(s_chunks, sizeof(Chunk) * (s_numChunks + 1));
+    Chunk* chunk = &s_chunks[s_numChunks];
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->node = node;
+    chunk->level = level;
+    memcpy(chunk->min, min, sizeof(chunk->min));
+    chunk->size = size;
+    snprintf(chunk->path, sizeof(chunk->path), "%s.%d.tmp", output, s_numChunks);
+    chunk->buffer = allocate(sizeof(OctreePoint) * kChunkBufferPoints);
+    return s_numChunks++;
+}
+
+// 範囲とその中の点の数から、根に近い節点と、まとめて処理する範囲を決める
+static int classify(int level, int x, int y, int z, const char* output)
+{
+    size_t index = getCellIndex(level, x, y, z);
+    uint64_t count = s_counts[level][index];
+    if (count == 0) {
+        return -1;
+    }
+    int node = addNode();
+    double size = s_size / (1 << level);
+    double min[3] = { x * size, y * size, z * size };
+    // 数える格子より細かく分けられない範囲が kMaxChunkPoints を超えた場合は splitChunk で分ける
+    if (count <= kMaxChunkPoints || level == kCountLevel) {
+        s_cells[level][index] = -2 - addChunk(node, level, min, size, output);
+        return node;
+    }
+
+    s_uppers = reallocate(s_uppers, sizeof(UpperNode) * (s_numUppers + 1));
+    UpperNode* upper = &s_uppers[s_numUppers];
+    memset(upper, 0, sizeof(*upper));
+    upper->node = node;
+    memcpy(upper->min, min, sizeof(min));
+    upper->size = size;
+    upper->occupied = allocate(kGridCells / 8);
+    memset(upper->occupied, 0, kGridCells / 8);
+    s_cells[level][index] = s_numUppers++;
+    for (int i = 0; i < 8; i++) {
+        int child = classify(level + 1, x * 2 + (i & 1), y * 2 + ((i >> 1) & 1), z * 2 + ((i >> 2) & 1), output);
+        s_nodes[node].children[i] = child;
+    }
+    return node;
+}
+
+static bool flushChunk(Chunk* chunk)
+{
+    if (chunk->numBuffered == 0) {
+        return true;
+    }
+    // 範囲の数だけファイルを開いたままにしないように、書き込むたびに開き直す
+    FILE* fp = fopen(chunk->path, "ab");
+    bool result = fp != NULL
+            && fwrite(chunk->buffer, sizeof(OctreePoint), chunk->numBuffered, fp) == chunk->numBuffered;
+    if (fp != NULL) {
+        result = fclose(fp) == 0 && result;
+    }
+    if (!result) {
+        LOG_ERROR("Failed to write temporary file: %s", chunk->path);
+    }
+    chunk->numBuffered = 0;
+    return result;
+}
+
+static bool addToUpper(UpperNode* upper, const OctreePoint* point)
+{
+    if (!occupy(upper->occupied, getGridIndex(point, upper->min, upper->size))) {
+        return false;
+    }
+    if (upper->numPoints >= upper->capacity) {
+        upper->capacity = (upper->capacity > 0) ? upper->capacity * 2 : 4096;
+        upper->points = reallocate(upper->points, sizeof(OctreePoint) * upper->capacity);
+    }
+    upper->points[upper->numPoints++] = *point;
+    return true;
+}
+
+static int getOctant(const OctreePoint* p, const double min[3], double half)
+{
+    return (p->x >= min[0] + half) | (p->y >= min[1] + half) << 1 | (p->z >= min[2] + half) << 2;
+}
+
+static bool addToChunk(int index, const OctreePoint* point)
+{
+    Chunk* chunk = &s_chunks[index];
+    chunk->buffer[chunk->numBuffered++] = *point;
+    chunk->numPoints++;
+    return chunk->numBuffered < kChunkBufferPoints || flushChunk(chunk);
+}
+
+// 根から順に間引く格子の空いている節点に入れ、どこにも入らなければ範囲の一時ファイルへ送る
+static bool distribute(void)
+{
+    for (size_t i = 0; i < s_input.count; i++) {
+        double position[3];
+        OctreePoint point;
+        if (!readPoint(i, position, &point)) {
+            continue;
+        }
+        int cell[3];
+        getCountCell(position, cell);
+        for (int level = 0; level <= kCountLevel; level++) {
+            int shift = kCountLevel - level;
+            int32_t owner = s_cells[level][getCellIndex(level, cell[0] >> shift, cell[1] >> shift, cell[2] >> shift)];
+            if (owner == -1) {
+                LOG_ERROR("Point %zu is outside of the counted cells", i); // 数えた時と入力が変わった
+                return false;
+            }
+            if (owner >= 0) {
+                if (addToUpper(&s_uppers[owner], &point)) {
+                    break;
+                }
+                continue;
+            }
+            if (!addToChunk(-2 - owner, &point)) {
+                return false;
+            }
+            break;
+        }
+    }
+    for (int i = 0; i < s_numChunks; i++) {
+        if (!flushChunk(&s_chunks[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool writePoints(int node, const OctreePoint* points, size_t n)
+{
+    s_nodes[node].offset = s_outputOffset;
+    s_nodes[node].numPoints = n;
+    if (fwrite(points, sizeof(OctreePoint), n, s_output) != n) {
+        LOG_ERROR("Failed to write points");
+        return false;
+    }
+    s_outputOffset += sizeof(OctreePoint) * n;
+    return true;
+}
+
+// 間引く格子の各セルで最初の点を節点に残し、残りを8つの子に分けて同じことを繰り返す
+static bool buildSubtree(int node, OctreePoint* points, size_t n, int level, const double min[3], double size,
+        OctreePoint* scratch)
+{
+    if (n <= kMaxNodePoints || level >= kMaxLevel) {
+        return writePoints(node, points, n);
+    }
+    memset(s_occupied, 0, sizeof(s_occupied));
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (occupy(s_occupied, getGridIndex(&points[i], min, size))) {
+            OctreePoint point = points[i];
+            points[i] = points[kept];
+            points[kept++] = point;
+        }
+    }
+    if (!writePoints(node, points, kept)) {
+        return false;
+    }
+
+    OctreePoint* rest = points + kept;
+    size_t m = n - kept;
+    double half = size * 0.5;
+    size_t counts[8] = { 0 }, starts[8];
+    for (size_t i = 0; i < m; i++) {
+        const OctreePoint* p = &rest[i];
+        counts[getOctant(p, min, half)]++;
+    }
+    starts[0] = 0;
+    for (int i = 1; i < 8; i++) {
+        starts[i] = starts[i - 1] + counts[i - 1];
+    }
+    size_t positions[8];
+    memcpy(positions, starts, sizeof(starts));
+    for (size_t i = 0; i < m; i++) {
+        const OctreePoint* p = &rest[i];
+        scratch[positions[getOctant(p, min, half)]++] = *p;
+    }
+    memcpy(rest, scratch, sizeof(OctreePoint) * m);
+
+    for (int i = 0; i < 8; i++) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        int child = addNode();
+        s_nodes[node].children[i] = child;
+        double childMin[3] = { min[0] + (i & 1) * half, min[1] + ((i >> 1) & 1) * half, min[2] + ((i >> 2) & 1) * half };
+        if (!buildSubtree(child, rest + starts[i], counts[i], level + 1, childMin, half, scratch)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 点が多すぎてメモリに読み込めない範囲は、一時ファイルを読みながら buildSubtree と同じように
+// 間引いた点を節点に残し、残りを8つの子の範囲の一時ファイルに分ける。子の範囲は後で build が処理する
+static bool splitChunk(int index, const char* output)
+{
+    Chunk chunk = s_chunks[index]; // addChunk で s_chunks が動くので写しを使う
+    FILE* fp = fopen(chunk.path, "rb");
+    if (fp == NULL) {
+        LOG_ERROR("Failed to read temporary file: %s", chunk.path);
+        return false;
+    }
+    // これ以上分けられない葉は、そのまま出力へ写す
+    bool leaf = chunk.level >= kMaxLevel;
+    if (leaf) {
+        s_nodes[chunk.node].offset = s_outputOffset;
+        s_nodes[chunk.node].numPoints = chunk.numPoints;
+    }
+    OctreePoint* block = allocate(sizeof(OctreePoint) * kChunkBufferPoints);
+    OctreePoint* kept = NULL;
+    size_t numKept = 0, capacity = 0, numRead = 0, n;
+    int children[8];
+    for (int i = 0; i < 8; i++) {
+        children[i] = -1;
+    }
+    double half = chunk.size * 0.5;
+    memset(s_occupied, 0, sizeof(s_occupied));
+    bool result = true;
+    while (result && (n = fread(block, sizeof(OctreePoint), kChunkBufferPoints, fp)) > 0) {
+        numRead += n;
+        if (leaf) {
+            result = fwrite(block, sizeof(OctreePoint), n, s_output) == n;
+            s_outputOffset += sizeof(OctreePoint) * n;
+            continue;
+        }
+        for (size_t i = 0; i < n && result; i++) {
+            const OctreePoint* p = &block[i];
+            if (occupy(s_occupied, getGridIndex(p, chunk.min, chunk.size))) {
+                if (numKept >= capacity) {
+                    capacity = (capacity > 0) ? capacity * 2 : 4096;
+                    kept = reallocate(kept, sizeof(OctreePoint) * capacity);
+                }
+                kept[numKept++] = *p;
+                continue;
+            }
+            int octant = getOctant(p, chunk.min, half);
+            if (children[octant] < 0) {
+                int child = addNode();
+                s_nodes[chunk.node].children[octant] = child;
+                double childMin[3] = { chunk.min[0] + (octant & 1) * half, chunk.min[1] + ((octant >> 1) & 1) * half,
+                        chunk.min[2] + ((octant >> 2) & 1) * half };
+                children[octant] = addChunk(child, chunk.level + 1, childMin, half, output);
+            }
+            result = addToChunk(children[octant], p);
+        }
+    }
+    result = result && !ferror(fp) && numRead == chunk.numPoints;
+    fclose(fp);
+    remove(chunk.path);
+    if (!result) {
+        LOG_ERROR("Failed to split temporary file: %s", chunk.path);
+    }
+    for (int i = 0; i < 8 && result; i++) {
+        if (children[i] >= 0) {
+            result = flushChunk(&s_chunks[children[i]]);
+        }
+    }
+    result = result && (leaf || writePoints(chunk.node, kept, numKept));
+    free(block);
+    free(kept);
+    return result;
+}
+
+static bool buildChunk(int index, const char* output)
+{
+    if (s_chunks[index].numPoints > kMaxChunkPoints) {
+        return splitChunk(index, output);
+    }
+    Chunk* chunk = &s_chunks[index];
+    if (chunk->numPoints == 0) {
+        return writePoints(chunk->node, NULL, 0); // 点がすべて根に近い節点に入り、一時ファイルがない
+    }
+    OctreePoint* points = allocate(sizeof(OctreePoint) * chunk->numPoints);
+    OctreePoint* scratch = allocate(sizeof(OctreePoint) * chunk->numPoints);
+    FILE* fp = fopen(chunk->path, "rb");
+    bool result = fp != NULL && fread(points, sizeof(OctreePoint), chunk->numPoints, fp) == chunk->numPoints;
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    remove(chunk->path);
+    if (!result) {
+        LOG_ERROR("Failed to read temporary file: %s", chunk->path);
+    } else {
+        result = buildSubtree(chunk->node, points, chunk->numPoints, chunk->level, chunk->min, chunk->size, scratch);
+    }
+    free(points);
+    free(scratch);
+    return result;
+}
+
+// 幅優先の順に節点の表を書き込む
+static bool writeNodes(void)
+{
+    int* order = allocate(sizeof(int) * s_numNodes);
+    int head = 0, tail = 0;
+    order[tail++] = 0;
+    bool result = true;
+    while (head < tail && result) {
+        const BuildNode* node = &s_nodes[order[head++]];
+        OctreeNode record = { .offset = node->offset, .numPoints = node->numPoints, .firstChild = tail };
+        for (int i = 0; i < 8; i++) {
+            if (node->children[i] >= 0) {
+                record.childMask |= 1 << i;
+                order[tail++] = node->children[i];
+            }
+        }
+        result = fwrite(&record, sizeof(record), 1, s_output) == 1;
+    }
+    free(order);
+    if (!result) {
+        LOG_ERROR("Failed to write nodes");
+    }
+    return result;
+}
+
+static bool build(const char* output)
+{
+    // 1回目で範囲を求める
+    s_min[0] = s_min[1] = s_min[2] = INFINITY;
+    s_max[0] = s_max[1] = s_max[2] = -INFINITY;
+    s_numPoints = 0;
+    for (size_t i = 0; i < s_input.count; i++) {
+        double p[3];
+        if (!readPosition(i, p)) {
+            continue;
+        }
+        s_numPoints++;
+        for (int k = 0; k < 3; k++) {
+            s_min[k] = fmin(s_min[k], p[k]);
+            s_max[k] = fmax(s_max[k], p[k]);
+        }
+    }
+    if (s_numPoints == 0) {
+        LOG_ERROR("No valid points");
+        return false;
+    }
+    if (s_numPoints < s_input.count) {
+        LOG_WARN("Skipped %zu points with invalid coordinates", s_input.count - s_numPoints);
+    }
+    s_size = fmax(fmax(s_max[0] - s_min[0], s_max[1] - s_min[1]), s_max[2] - s_min[2]);
+    s_size = (s_size > 0.0) ? s_size * 1.0001 : 1.0;
+
+    // 2回目で細かい格子ごとの点の数を数え、上の階層へ足し合わせる
+    for (int level = 0; level <= kCountLevel; level++) {
+        size_t cells = (size_t) 1 << (3 * level);
+        s_counts[level] = allocate(sizeof(uint64_t) * cells);
+        memset(s_counts[level], 0, sizeof(uint64_t) * cells);
+        s_cells[level] = allocate(sizeof(int32_t) * cells);
+        memset(s_cells[level], 0xff, sizeof(int32_t) * cells);
+    }
+    for (size_t i = 0; i < s_input.count; i++) {
+        double p[3];
+        if (!readPosition(i, p)) {
+            continue;
+        }
+        int cell[3];
+        getCountCell(p, cell);
+        s_counts[kCountLevel][getCellIndex(kCountLevel, cell[0], cell[1], cell[2])]++;
+    }
+    for (int level = kCountLevel; level > 0; level--) {
+        int size = 1 << level;
+        for (int z = 0; z < size; z++) {
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    s_counts[level - 1][getCellIndex(level - 1, x / 2, y / 2, z / 2)]
+                            += s_counts[level][getCellIndex(level, x, y, z)];
+                }
+            }
+        }
+    }
+    classify(0, 0, 0, 0, output);
+
+    // 3回目で根に近い節点に間引いて入れ、残りを範囲ごとの一時ファイルに分ける
+    if (!distribute()) {
+        return false;
+    }
+
+    s_output = fopen(output, "wb");
+    if (s_output == NULL) {
+        LOG_ERROR("Failed to open output file: %s", output);
+        return false;
+    }
+    OctreeHeader header;
+    memset(&header, 0, sizeof(header));
+    bool result = fwrite(&header, sizeof(header), 1, s_output) == 1;
+    s_outputOffset = sizeof(header);
+    for (int i = 0; i < s_numUppers && result; i++) {
+        result = writePoints(s_uppers[i].node, s_uppers[i].points, s_uppers[i].numPoints);
+    }
+    // 分けた範囲は末尾に追加されるので、s_numChunks が増えても最後まで処理する
+    for (int i = 0; i < s_numChunks && result; i++) {
+        result = buildChunk(i, output);
+    }
+
+    memcpy(header.magic, OCTREE_MAGIC, sizeof(header.magic));
+    header.version = OCTREE_VERSION;
+    header.numNodes = s_numNodes;
+    header.numPoints = s_numPoints;
+    header.nodeOffset = s_outputOffset;
+    memcpy(header.min, s_min, sizeof(header.min));
+    header.size = s_size;
+    memcpy(header.max, s_max, sizeof(header.max));
+    result = result && writeNodes();
+    result = result && fseek(s_output, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, s_output) == 1;
+    result = (fclose(s_output) == 0) && result;
+    if (!result) {
+        LOG_ERROR("Failed to write output file: %s", output);
+    }
+    return result;
+}
+
+static void cleanUp(void)
+{
+    for (int i = 0; i < s_numChunks; i++) {
+        remove(s_chunks[i].path); // 途中で失敗した場合に残る一時ファイル
+        free(s_chunks[i].buffer);
+    }
+    for (int i = 0; i < s_numUppers; i++) {
+        free(s_uppers[i].occupied);
+        free(s_uppers[i].points);
+    }
+    for (int level = 0; level <= kCountLevel; level++) {
+        free(s_counts[level]);
+        free(s_cells[level]);
+    }
+    free(s_chunks);
+    free(s_uppers);
+    free(s_nodes);
+}
+
+int main(int argc, char** argv)
+{
+    const char* output = NULL;
+    const char* input = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (input == NULL && argv[i][0] != '-') {
+            input = argv[i];
+        } else {
+            input = NULL;
+            break;
+        }
+    }
+    if (input == NULL) {
+        fprintf(stderr, "usage: %s [-o <output.oct>] <input.ply>\n", argv[0]);
+        return 1;
+    }
+    char path[PATH_MAX];
+    if (output == NULL) {
+        const char* dot = strrchr(input, '.');
+        int length = (dot != NULL && strchr(dot, '/') == NULL) ? (int) (dot - input) : (int) strlen(input);
+        snprintf(path, sizeof(path), "%.*s.oct", length, input);
+        output = path;
+    }
+
+    double start = getTime();
+    const uint8_t* mapped;
+    size_t size;
+    if (!openInput(input, &mapped, &size)) {
+        return 1;
+    }
+    bool result = build(output);
+    munmap((void*) mapped, size);
+    if (result) {
+        printf("Built %d nodes from %zu points in %.1f s: %s\n", s_numNodes, s_numPoints, getTime() - start, output);
+    }
+    cleanUp();
+    return result ? 0 : 1;
+}
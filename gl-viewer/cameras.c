@@ -0,0 +1,684 @@
+#define _POSIX_C_SOURCE 200809L
+#define GL_GLEXT_PROTOTYPES
+
+#include "cameras.h"
+#include <ctype.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined __APPLE__ && defined __MACH__
+ #include <GLUT/glut.h>
+ #define glDrawArraysInstanced glDrawArraysInstancedARB
+ #define glVertexAttribDivisor glVertexAttribDivisorARB
+#else
+ #include <GL/glut.h>
+#endif // __APPLE__ && __MACH__
+#include "logger.h"
+#include "renderer.h"
+
+enum
+{
+    kPositionLocation = 0,
+    kRowLocation = 1,   // 3つの行で3つの番号を使う
+    kColorLocation = 4,
+};
+
+enum
+{
+    kNumFrustumVertices = 22, // 頂点から4本、画像の枠の4本、上を示す三角形の3本の線分
+    kPoseLogHeaderSize = 32,
+    kPoseLogRecordSize = 64,
+    kCancelInterval = 4096,   // 読み込みをやめるか確かめる姿勢の間隔
+};
+
+static const float kCamerasRadius = 100.0f;
+static const char kPoseLogMagic[8] = { 'P', 'O', 'S', 'E', 'L', 'O', 'G', '1' };
+
+// 視錐台の頂点をカメラ座標系から世界座標系へ移し、姿勢ごとに色を付ける
+static const char* kVertexShader =
+    "#version 120\n"
+    "attribute vec3 position;\n" // カメラ座標系。奥行き1の面に画像の枠がある
+    "attribute vec4 row0;\n"     // カメラ座標系から世界座標系への変換の行
+    "attribute vec4 row1;\n"
+    "attribute vec4 row2;\n"
+    "attribute vec4 color;\n"
+    "uniform float depth;\n"
+    "varying vec4 frontColor;\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 p = vec4(position * depth, 1.0);\n"
+    "    vec4 world = vec4(dot(row0, p), dot(row1, p), dot(row2, p), 1.0);\n"
+    "    frontColor = color;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * world;\n"
+    "}\n";
+
+static const char* kFragmentShader =
+    "#version 120\n"
+    "varying vec4 frontColor;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_FragColor = frontColor;\n"
+    "}\n";
+
+typedef struct
+{
+    double fx, fy, cx, cy;
+    double width, height; // 画像の大きさ [px]
+} Intrinsics;
+
+// 世界座標系からカメラ座標系への変換 (OpenCVの rvec, tvec と同じ向き)
+typedef struct
+{
+    double rotation[4]; // 単位四元数 (w, x, y, z)
+    double translation[3];
+} Pose;
+
+typedef struct
+{
+    Pose* poses;
+    size_t count, capacity;
+} PoseList;
+
+// 1つのカメラの描画に使うインスタンスごとの属性
+typedef struct
+{
+    GLfloat rows[3][4]; // 位置は範囲の中心からの相対位置
+    GLubyte color[4];
+} Instance;
+
+static GLuint s_program;
+static GLint s_depthLocation;
+static GLuint s_frustumBuffer, s_instanceBuffer;
+static size_t s_numCameras;
+
+// 読み込むスレッドが作成し、読み込みを終えたら描画するスレッドに渡す
+static pthread_t s_thread;
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool s_running, s_loaded; // s_mutex で守る
+static char* s_cameraFile;
+static char** s_poseFiles;
+static int s_numPoseFiles;
+static GLfloat s_frustum[kNumFrustumVertices][3];
+static Instance* s_instances;
+static size_t s_numInstances, s_numSkipped;
+static float s_radius, s_depth;
+
+static bool isCancelled(void)
+{
+    pthread_mutex_lock(&s_mutex);
+    bool cancelled = !s_running;
+    pthread_mutex_unlock(&s_mutex);
+    return cancelled;
+}
+
+static char* copyString(const char* s)
+{
+    char* copy = malloc(strlen(s) + 1);
+    if (copy != NULL) {
+        strcpy(copy, s);
+    }
+    return copy;
+}
+
+// ファイル全体を読み込み、末尾にNUL文字を付ける
+static char* readText(const char* filename)
+{
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        LOG_ERROR("Failed to open file: %s", filename);
+        return NULL;
+    }
+    char* text = NULL;
+    long size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0) {
+        text = malloc(size + 1);
+    }
+    if (text != NULL && fread(text, 1, size, fp) == (size_t) size) {
+        text[size] = '\0';
+    } else {
+        LOG_ERROR("Failed to read file: %s", filename);
+        free(text);
+        text = NULL;
+    }
+    fclose(fp);
+    return text;
+}
+
+// cv::FileStorage で書き出したXMLから要素を探し、内容の先頭と終わりを返す
+static const char* findElement(const char* text, const char* name, const char** end)
+{
+    size_t length = strlen(name);
+    for (const char* p = strchr(text, '<'); p != NULL; p = strchr(p + 1, '<')) {
+        if (strncmp(p + 1, name, length) != 0
+                || (p[1 + length] != '>' && !isspace((unsigned char) p[1 + length]))) {
+            continue;
+        }
+        const char* content = strchr(p, '>');
+        if (content == NULL) {
+            return NULL;
+        }
+        content++;
+        for (const char* q = strstr(content, "</"); q != NULL; q = strstr(q + 2, "</")) {
+            if (strncmp(q + 2, name, length) == 0 && q[2 + length] == '>') {
+                *end = q;
+                return content;
+            }
+        }
+        return NULL;
+    }
+    return NULL;
+}
+
+// 要素の値を n 個読み込む。行列は data の子要素に、ベクトルやスカラーは要素の内容に値を持つ
+static bool readValues(const char* text, const char* name, double* values, int n)
+{
+    const char* end;
+    const char* p = findElement(text, name, &end);
+    if (p == NULL) {
+        return false;
+    }
+    const char* dataEnd;
+    const char* data = findElement(p, "data", &dataEnd);
+    if (data != NULL && dataEnd < end) {
+        p = data;
+        end = dataEnd;
+    }
+    for (int i = 0; i < n; i++) {
+        char* next;
+        values[i] = strtod(p, &next);
+        if (next == p || next > end) {
+            return false;
+        }
+        p = next;
+    }
+    return true;
+}
+
+static bool readIntrinsics(const char* filename, Intrinsics* intrinsics)
+{
+    char* text = readText(filename);
+    if (text == NULL) {
+        return false;
+    }
+    double k[9];
+    bool result = readValues(text, "intrinsic", k, 9) && k[0] > 0.0 && k[4] > 0.0;
+    if (result) {
+        intrinsics->fx = k[0];
+        intrinsics->cx = k[2];
+        intrinsics->fy = k[4];
+        intrinsics->cy = k[5];
+        // 画像の大きさを持たない古いファイルでは、主点が画像の中心にあるとみなす
+        if (!readValues(text, "image_width", &intrinsics->width, 1)
+                || !readValues(text, "image_height", &intrinsics->height, 1)) {
+            intrinsics->width = 2.0 * k[2];
+            intrinsics->height = 2.0 * k[5];
+        }
+    } else {
+        LOG_ERROR("Failed to read intrinsic matrix: %s", filename);
+    }
+    free(text);
+    return result;
+}
+
+static bool addPose(PoseList* list, const double rotation[4], const double translation[3])
+{
+    if (list->count == list->capacity) {
+        size_t capacity = (list->capacity == 0) ? 1024 : list->capacity * 2;
+        Pose* poses = realloc(list->poses, sizeof(Pose) * capacity);
+        if (poses == NULL) {
+            LOG_ERROR("Failed to allocate poses");
+            return false;
+        }
+        list->poses = poses;
+        list->capacity = capacity;
+    }
+    Pose* pose = &list->poses[list->count++];
+    memcpy(pose->rotation, rotation, sizeof(pose->rotation));
+    memcpy(pose->translation, translation, sizeof(pose->translation));
+    return true;
+}
+
+// pose-log の makePoseRecord と同じく、回転ベクトルを四元数にする
+static void toQuaternion(const double rvec[3], double q[4])
+{
+    double theta = sqrt(rvec[0] * rvec[0] + rvec[1] * rvec[1] + rvec[2] * rvec[2]);
+    double s = (theta < 1e-12) ? 0.5 : sin(theta * 0.5) / theta;
+    q[0] = cos(theta * 0.5);
+    q[1] = rvec[0] * s;
+    q[2] = rvec[1] * s;
+    q[3] = rvec[2] * s;
+}
+
+static bool readPoseXml(const char* filename, PoseList* list)
+{
+    char* text = readText(filename);
+    if (text == NULL) {
+        return false;
+    }
+    double rvec[3], tvec[3], rotation[4];
+    bool result = readValues(text, "rotation", rvec, 3) && readValues(text, "translation", tvec, 3);
+    if (result) {
+        toQuaternion(rvec, rotation);
+        result = addPose(list, rotation, tvec);
+    } else {
+        LOG_ERROR("Failed to read camera position: %s", filename);
+    }
+    free(text);
+    return result;
+}
+
+// 姿勢が求まっている行の状態。camera-position_chessboard の一括推定は ok を、追跡は detected か tracked を書く
+static bool hasPose(const char* status)
+{
+    static const char* names[] = { "ok,", "detected,", "tracked," };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strncmp(status, names[i], strlen(names[i])) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// image,status,rx,ry,rz,tx,ty,tz または time_ms,status,... の行を読み込む
+static bool readPoseCsv(FILE* fp, PoseList* list)
+{
+    char* line = NULL;
+    size_t capacity = 0;
+    bool result = true;
+    for (size_t row = 0; getline(&line, &capacity, fp) != -1 && result; row++) {
+        if (row % kCancelInterval == 0 && isCancelled()) {
+            result = false;
+            break;
+        }
+        const char* p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+            continue;
+        }
+        char* status = strchr(line, ',');
+        char* values = (status != NULL) ? strchr(status + 1, ',') : NULL;
+        if (values != NULL && strncmp(status + 1, "status,", 7) == 0) {
+            continue; // '#' のない見出しの行
+        }
+        double v[6], rotation[4];
+        if (values == NULL || !hasPose(status + 1)
+                || sscanf(values + 1, "%lf,%lf,%lf,%lf,%lf,%lf", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 6) {
+            s_numSkipped++; // 推定に失敗した画像や見失ったフレーム
+            continue;
+        }
+        toQuaternion(v, rotation);
+        result = addPose(list, rotation, v + 3);
+    }
+    free(line);
+    return result;
+}
+
+static bool readPoseLog(FILE* fp, const char* filename, PoseList* list)
+{
+    uint8_t header[kPoseLogHeaderSize];
+    uint32_t recordSize;
+    if (fread(header, sizeof(header), 1, fp) != 1) {
+        LOG_ERROR("Failed to read pose log header: %s", filename);
+        return false;
+    }
+    memcpy(&recordSize, header + sizeof(kPoseLogMagic), sizeof(recordSize));
+    if (recordSize < kPoseLogRecordSize) {
+        LOG_ERROR("Unsupported pose log record size: %u", recordSize);
+        return false;
+    }
+    uint8_t* record = malloc(recordSize);
+    if (record == NULL) {
+        return false;
+    }
+    bool result = true;
+    for (size_t i = 0; fread(record, recordSize, 1, fp) == 1 && result; i++) {
+        if (i % kCancelInterval == 0 && isCancelled()) {
+            result = false;
+            break;
+        }
+        double values[8]; // time, rotation[4], translation[3]
+        memcpy(values, record, sizeof(values));
+        result = addPose(list, values + 1, values + 5);
+    }
+    free(record);
+    return result;
+}
+
+// 先頭の内容から形式を判別して姿勢を読み込む
+static bool readPoses(const char* filename, PoseList* list)
+{
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        LOG_ERROR("Failed to open file: %s", filename);
+        return false;
+    }
+    char magic[sizeof(kPoseLogMagic)] = { 0 };
+    size_t n = fread(magic, 1, sizeof(magic), fp);
+    bool result;
+    if (n == sizeof(magic) && memcmp(magic, kPoseLogMagic, sizeof(magic)) == 0) {
+        result = fseek(fp, 0, SEEK_SET) == 0 && readPoseLog(fp, filename, list);
+    } else if (n > 0 && magic[0] == '<') {
+        fclose(fp);
+        return readPoseXml(filename, list);
+    } else {
+        result = fseek(fp, 0, SEEK_SET) == 0 && readPoseCsv(fp, list);
+    }
+    fclose(fp);
+    return result;
+}
+
+// 奥行き1の面に画像の枠がくるように視錐台の線分を作る。画像の上は -y 側にある
+static void createFrustum(const Intrinsics* intrinsics)
+{
+    double u[4] = { 0.0, intrinsics->width, intrinsics->width, 0.0 };
+    double v[4] = { 0.0, 0.0, intrinsics->height, intrinsics->height };
+    GLfloat corners[4][3];
+    for (int i = 0; i < 4; i++) {
+        corners[i][0] = (GLfloat) ((u[i] - intrinsics->cx) / intrinsics->fx);
+        corners[i][1] = (GLfloat) ((v[i] - intrinsics->cy) / intrinsics->fy);
+        corners[i][2] = 1.0f;
+    }
+    GLfloat (*p)[3] = s_frustum;
+    for (int i = 0; i < 4; i++) {
+        memset(*p++, 0, sizeof(*p));
+        memcpy(*p++, corners[i], sizeof(*p));
+        memcpy(*p++, corners[i], sizeof(*p));
+        memcpy(*p++, corners[(i + 1) % 4], sizeof(*p));
+    }
+    double top = -0.2 * intrinsics->height;
+    double triangle[3][2] = {
+        { 0.25 * intrinsics->width, 0.0 },
+        { 0.5 * intrinsics->width, top },
+        { 0.75 * intrinsics->width, 0.0 },
+    };
+    for (int i = 0; i < 3; i++) {
+        for (int k = 0; k < 2; k++) {
+            const double* t = triangle[(i + k) % 3];
+            (*p)[0] = (GLfloat) ((t[0] - intrinsics->cx) / intrinsics->fx);
+            (*p)[1] = (GLfloat) ((t[1] - intrinsics->cy) / intrinsics->fy);
+            (*p)[2] = 1.0f;
+            p++;
+        }
+    }
+}
+
+// 単位四元数を回転行列にする
+static void toMatrix(const double q[4], double r[3][3])
+{
+    double norm = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    double w = q[0] / norm, x = q[1] / norm, y = q[2] / norm, z = q[3] / norm;
+    r[0][0] = 1.0 - 2.0 * (y * y + z * z);
+    r[0][1] = 2.0 * (x * y - w * z);
+    r[0][2] = 2.0 * (x * z + w * y);
+    r[1][0] = 2.0 * (x * y + w * z);
+    r[1][1] = 1.0 - 2.0 * (x * x + z * z);
+    r[1][2] = 2.0 * (y * z - w * x);
+    r[2][0] = 2.0 * (x * z - w * y);
+    r[2][1] = 2.0 * (y * z + w * x);
+    r[2][2] = 1.0 - 2.0 * (x * x + y * y);
+}
+
+static int compareDoubles(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// 視錐台の奥行きを、読み込んだ順に隣り合うカメラの間隔の中央値にする。軌跡でも並べたカメラでも重なりにくい
+static float getFrustumDepth(double (*centers)[3], size_t n, float radius)
+{
+    if (n < 2 || radius <= 0.0f) {
+        return 1.0f;
+    }
+    double* distances = malloc(sizeof(double) * (n - 1));
+    if (distances == NULL) {
+        return radius * 0.05f;
+    }
+    for (size_t i = 0; i + 1 < n; i++) {
+        double dx = centers[i + 1][0] - centers[i][0];
+        double dy = centers[i + 1][1] - centers[i][1];
+        double dz = centers[i + 1][2] - centers[i][2];
+        distances[i] = sqrt(dx * dx + dy * dy + dz * dz);
+    }
+    qsort(distances, n - 1, sizeof(double), compareDoubles);
+    float median = (float) distances[(n - 1) / 2];
+    free(distances);
+    return fmaxf(fminf(median, radius * 0.1f), radius * 0.005f);
+}
+
+// 姿勢からカメラ座標系から世界座標系への変換を求め、範囲の中心からの相対位置にする
+static bool createInstances(const PoseList* list)
+{
+    size_t n = list->count;
+    double (*centers)[3] = malloc(sizeof(double[3]) * n);
+    double (*rotations)[3][3] = malloc(sizeof(double[3][3]) * n);
+    s_instances = malloc(sizeof(Instance) * n);
+    if (centers == NULL || rotations == NULL || s_instances == NULL) {
+        LOG_ERROR("Failed to allocate %zu cameras", n);
+        free(centers);
+        free(rotations);
+        free(s_instances);
+        s_instances = NULL;
+        return false;
+    }
+    double min[3] = { INFINITY, INFINITY, INFINITY }, max[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (size_t i = 0; i < n; i++) {
+        const Pose* pose = &list->poses[i];
+        toMatrix(pose->rotation, rotations[i]);
+        for (int k = 0; k < 3; k++) {
+            // カメラの位置は -R^T t
+            const double* t = pose->translation;
+            centers[i][k] = -(rotations[i][0][k] * t[0] + rotations[i][1][k] * t[1] + rotations[i][2][k] * t[2]);
+            min[k] = fmin(min[k], centers[i][k]);
+            max[k] = fmax(max[k], centers[i][k]);
+        }
+    }
+    double center[3], diagonal = 0.0;
+    for (int k = 0; k < 3; k++) {
+        center[k] = (min[k] + max[k]) * 0.5;
+        diagonal += (max[k] - min[k]) * (max[k] - min[k]);
+    }
+    float radius = (float) (sqrt(diagonal) * 0.5);
+    s_depth = getFrustumDepth(centers, n, radius);
+
+    // 視錐台がはみ出さないように、いちばん遠い頂点の分だけ半径を広げる
+    float extent = 0.0f;
+    for (int i = 0; i < kNumFrustumVertices; i++) {
+        const GLfloat* v = s_frustum[i];
+        extent = fmaxf(extent, sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]));
+    }
+    s_radius = fmaxf(radius + s_depth * extent, FLT_MIN);
+
+    for (size_t i = 0; i < n; i++) {
+        Instance* instance = &s_instances[i];
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                instance->rows[r][c] = (GLfloat) rotations[i][c][r]; // R^T
+            }
+            instance->rows[r][3] = (GLfloat) (centers[i][r] - center[r]);
+        }
+        // 読み込んだ順に青から赤へ変える
+        double t = (n > 1) ? (double) i / (n - 1) : 0.0;
+        instance->color[0] = (GLubyte) (255.0 * t);
+        instance->color[1] = 96;
+        instance->color[2] = (GLubyte) (255.0 * (1.0 - t));
+        instance->color[3] = 255;
+    }
+    s_numInstances = n;
+    free(centers);
+    free(rotations);
+    return true;
+}
+
+static void* loadCameras(void* arg)
+{
+    Intrinsics intrinsics;
+    PoseList list = { NULL, 0, 0 };
+    bool result = readIntrinsics(s_cameraFile, &intrinsics);
+    if (result) {
+        createFrustum(&intrinsics);
+    }
+    for (int i = 0; i < s_numPoseFiles && result && !isCancelled(); i++) {
+        // 読めないファイルがあっても残りのカメラは描画する
+        if (!readPoses(s_poseFiles[i], &list) && isCancelled()) {
+            result = false;
+        }
+    }
+    if (result && list.count > 0) {
+        createInstances(&list);
+    }
+    free(list.poses);
+
+    pthread_mutex_lock(&s_mutex);
+    s_loaded = true;
+    pthread_mutex_unlock(&s_mutex);
+    return NULL;
+}
+
+static bool isInstancingSupported(void)
+{
+    int major = 0, minor = 0;
+    const char* version = (const char*) glGetString(GL_VERSION);
+    if (version != NULL && sscanf(version, "%d.%d", &major, &minor) == 2 && (major > 3 || (major == 3 && minor >= 3))) {
+        return true;
+    }
+    const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+    return extensions != NULL && strstr(extensions, "GL_ARB_draw_instanced") != NULL
+            && strstr(extensions, "GL_ARB_instanced_arrays") != NULL;
+}
+
+bool cameras_open(const char* cameraFile, const char* const* poseFiles, int numPoseFiles)
+{
+    if (!isInstancingSupported()) {
+        LOG_ERROR("Instanced rendering is not supported: OpenGL %s", (const char*) glGetString(GL_VERSION));
+        return false;
+    }
+    static const char* const attributes[] = {
+        [kPositionLocation] = "position",
+        [kRowLocation] = "row0",
+        [kRowLocation + 1] = "row1",
+        [kRowLocation + 2] = "row2",
+        [kColorLocation] = "color",
+    };
+    s_program = renderer_createProgram(kVertexShader, kFragmentShader, attributes, 5);
+    if (s_program == 0) {
+        return false;
+    }
+    s_depthLocation = glGetUniformLocation(s_program, "depth");
+
+    s_cameraFile = copyString(cameraFile);
+    s_poseFiles = calloc(numPoseFiles, sizeof(char*));
+    bool result = s_cameraFile != NULL && s_poseFiles != NULL;
+    for (int i = 0; i < numPoseFiles && result; i++) {
+        s_poseFiles[i] = copyString(poseFiles[i]);
+        result = s_poseFiles[i] != NULL;
+        s_numPoseFiles++;
+    }
+    s_running = true;
+    if (!result || pthread_create(&s_thread, NULL, loadCameras, NULL) != 0) {
+        LOG_ERROR("Failed to create loader thread");
+        s_running = false;
+        cameras_close();
+        return false;
+    }
+    return true;
+}
+
+void cameras_close(void)
+{
+    if (s_running) {
+        pthread_mutex_lock(&s_mutex);
+        s_running = false;
+        pthread_mutex_unlock(&s_mutex);
+        pthread_join(s_thread, NULL);
+    }
+    glDeleteBuffers(1, &s_frustumBuffer);
+    glDeleteBuffers(1, &s_instanceBuffer);
+    glDeleteProgram(s_program);
+    s_frustumBuffer = s_instanceBuffer = s_program = 0;
+    for (int i = 0; i < s_numPoseFiles; i++) {
+        free(s_poseFiles[i]);
+    }
+    free(s_poseFiles);
+    free(s_cameraFile);
+    free(s_instances);
+    s_poseFiles = NULL;
+    s_cameraFile = NULL;
+    s_instances = NULL;
+    s_numPoseFiles = 0;
+    s_numCameras = s_numInstances = s_numSkipped = 0;
+    s_loaded = false;
+}
+
+bool cameras_update(void)
+{
+    pthread_mutex_lock(&s_mutex);
+    bool loaded = s_loaded && s_running;
+    pthread_mutex_unlock(&s_mutex);
+    if (!loaded) {
+        return false;
+    }
+    pthread_join(s_thread, NULL);
+    s_running = false;
+
+    if (s_numInstances > 0) {
+        glGenBuffers(1, &s_frustumBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, s_frustumBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(s_frustum), s_frustum, GL_STATIC_DRAW);
+        glGenBuffers(1, &s_instanceBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, s_instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Instance) * s_numInstances, s_instances, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    s_numCameras = s_numInstances;
+    free(s_instances);
+    s_instances = NULL;
+    LOG_INFO("Loaded %zu cameras (%zu skipped), frustum depth %g", s_numCameras, s_numSkipped, s_depth);
+    return true;
+}
+
+size_t cameras_draw(void)
+{
+    if (s_program == 0 || s_numCameras == 0) {
+        return 0;
+    }
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    float scale = kCamerasRadius / s_radius;
+    glScalef(scale, scale, scale);
+
+    glUseProgram(s_program);
+    glUniform1f(s_depthLocation, s_depth);
+
+    glBindBuffer(GL_ARRAY_BUFFER, s_frustumBuffer);
+    glEnableVertexAttribArray(kPositionLocation);
+    glVertexAttribPointer(kPositionLocation, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid*) 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, s_instanceBuffer);
+    for (int r = 0; r < 3; r++) {
+        glEnableVertexAttribArray(kRowLocation + r);
+        glVertexAttribPointer(kRowLocation + r, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                (const GLvoid*) (offsetof(Instance, rows) + sizeof(GLfloat[4]) * r));
+        glVertexAttribDivisor(kRowLocation + r, 1);
+    }
+    glEnableVertexAttribArray(kColorLocation);
+    glVertexAttribPointer(kColorLocation, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance),
+            (const GLvoid*) offsetof(Instance, color));
+    glVertexAttribDivisor(kColorLocation, 1);
+
+    glDrawArraysInstanced(GL_LINES, 0, kNumFrustumVertices, (GLsizei) s_numCameras);
+
+    // ほかの描画に影響しないように、インスタンスごとの属性を元に戻す
+    for (int location = kRowLocation; location <= kColorLocation; location++) {
+        glVertexAttribDivisor(location, 0);
+        glDisableVertexAttribArray(location);
+    }
+    glDisableVertexAttribArray(kPositionLocation);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glUseProgram(0);
+    glPopMatrix();
+    return s_numCameras;
+}
@@ -0,0 +1,20 @@
+#ifndef CAMERAS_H
+#define CAMERAS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// カメラの内部パラメータと姿勢のファイルを読み込むスレッドを開始する。OpenGLのコンテキストを作成してから呼び出す。
+// 内部パラメータは camera-calibration の camera.xml、姿勢は次のいずれかの形式で、形式は内容から判別する
+//   camera-position の camera_position.xml など、rotation と translation を持つXML
+//   camera-position_chessboard の -b で書き出すCSV（status が ok の行だけを使う）
+//   pose-log の姿勢ログ
+bool cameras_open(const char* cameraFile, const char* const* poseFiles, int numPoseFiles);
+void cameras_close(void);
+// 読み込みを終えていれば姿勢をVBOに転送してtrueを返す。scheduler_setContentTimer に渡して再描画を要求する
+bool cameras_update(void);
+// すべてのカメラの視錐台を1回の呼び出しでインスタンス描画する。
+// カメラの位置は外接球が原点を中心とする半径100に収まるように拡大縮小する。描画したカメラの数を返す
+size_t cameras_draw(void);
+
+#endif /* CAMERAS_H */
@@ -0,0 +1,20 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "logger.h"
+
+// gl-viewer -l で書き込んだバイナリ形式のログをテキストで出力する
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <log.bin>\n", argv[0]);
+        return 1;
+    }
+    FILE* fp = fopen(argv[1], "rb");
+    if (fp == NULL) {
+        LOG_ERROR("Failed to open file: %s", argv[1]);
+        return 1;
+    }
+    bool result = logger_decode(fp, stdout);
+    fclose(fp);
+    return result ? 0 : 1;
+}
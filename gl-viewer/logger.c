@@ -1,50 +1,963 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include "logger.h"
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+// 各スレッドのリングのバイト数（2の累乗）
+enum { kRingSize = 1 << 18 };
+// 1件の記録の最大のバイト数。超える文字列の引数は切り詰める
+enum { kMaxRecordSize = 1024 };
+// 背景スレッドがまとめて書き出すバイト数
+enum { kBatchSize = 1 << 14 };
+// バイナリ形式の場所の文字列の最大のバイト数
+enum { kMaxStringLength = 1 << 16 };
+// バイナリ形式のエントリの種類
+enum { kEntrySite = 1, kEntryRecord = 2 };
+// 書き出すものがないときの待ち時間。続けて空なら倍にしていく [ns]
+static const long kMinWait = 1000000L;
+static const long kMaxWait = 32000000L;
+
+// 出力する時刻は秒までなので、Linuxでは読むのが速い粗い時計で足りる
+#ifdef CLOCK_REALTIME_COARSE
+static const clockid_t kClock = CLOCK_REALTIME_COARSE;
+#else
+static const clockid_t kClock = CLOCK_REALTIME;
+#endif
+
+typedef enum
+{
+    ArgType_NONE,    // %%
+    ArgType_INT,
+    ArgType_UINT,
+    ArgType_DOUBLE,
+    ArgType_CHAR,
+    ArgType_STRING,
+    ArgType_POINTER,
+    ArgType_COUNT,   // %n は書き込まずに読み飛ばす
+} ArgType;
+
+typedef enum
+{
+    Length_NONE,
+    Length_HH,
+    Length_H,
+    Length_L,
+    Length_LL,
+    Length_J,
+    Length_Z,
+    Length_T,
+    Length_LONG_DOUBLE,
+} Length;
+
+// リングに書き込む記録。書式の引数が8バイト単位で続く
+typedef struct
+{
+    uint32_t size;      // 引数を含むバイト数。0ならリングの末尾までの詰め物
+    uint32_t argSize;   // 引数のバイト数
+    int64_t time;       // kClock [ns]
+    FILE* fp;
+    const LogSite* site;
+} Record;
+
+// バイナリ形式で番号を割り当てた場所
+typedef struct
+{
+    const LogSite* site;
+    uint32_t id;
+} SiteEntry;
+
+typedef union
+{
+    int64_t i;
+    uint64_t u;
+    double d;
+    const void* p;
+} Arg;
+
+// 1つのスレッドだけが書き込み、背景スレッドだけが読み出すリング
+typedef struct Ring
+{
+    uint64_t head;         // 背景スレッドが読み終えた位置
+    char padding1[56];     // head と tail を別のキャッシュラインに置く
+    uint64_t tail;         // スレッドが書き終えた位置
+    uint64_t dropped;      // あふれて捨てた記録の数
+    int closed;            // スレッドが終了した
+    char padding2[36];
+    struct Ring* next;
+    unsigned char data[kRingSize];
+} Ring;
+
 static LogLevel s_logLevel = LogLevel_INFO;
 
+static int s_running;
+static pthread_t s_thread;
+static pthread_key_t s_ringKey;
+static pthread_once_t s_keyOnce = PTHREAD_ONCE_INIT;
+static Ring* s_rings;            // 書き込んだことのあるスレッドのリング。終了したスレッドのものだけを解放する
+static uint64_t s_lost;          // リングを確保できずに捨てた記録の数
+static uint64_t s_releasedDrops; // 解放したリングで捨てた記録の数
+static uint64_t s_reportedDrops;
+static time_t s_reportedSecond;
+
+static __thread Ring* s_threadRing;
+
+// 背景スレッドだけが使う
+static time_t s_cachedSecond = -1;
+static char s_cachedTime[20];
+static char s_batch[kBatchSize];
+static size_t s_batchLength;
+static FILE* s_batchFile;
+static FILE* s_binaryFile;
+static SiteEntry* s_siteTable;   // 場所のアドレスで引くハッシュ表
+static size_t s_siteCapacity;
+static uint32_t s_numSites;
+
+static const char* getLevelString(int level)
+{
+    switch (level) {
+        case LogLevel_DEBUG:
+            return "DEBUG";
+        case LogLevel_INFO:
+            return "INFO ";
+        case LogLevel_WARN:
+            return "WARN ";
+        case LogLevel_ERROR:
+            return "ERROR ";
+        default:
+            assert(0 && "Unknown LogLevel");
+            return NULL;
+    }
+}
+
+static const char* getFileName(const char* file)
+{
+#ifdef _WIN32
+    const char* separator = strrchr(file, '\\');
+    return (separator != NULL) ? separator + 1 : file;
+#else
+    return file;
+#endif
+}
+
 void logger_setLevel(LogLevel level)
 {
     s_logLevel = level;
 }
 
-void logger_log(LogLevel level, FILE* fp, const char* file, int line, const char* func, const char* fmt, ...)
+// fmt の '%' から始まる変換指定を読み、その次の位置を返す。扱えない変換指定ならNULLを返す
+static const char* parseSpec(const char* p, ArgType* type, Length* length, int* numStars)
 {
-    time_t now;
-    char timestr[20];
-    const char* levelstr;
-    va_list arg;
-
-    if (s_logLevel > level) {
-        return;
+    *numStars = 0;
+    p++;
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+        p++;
     }
-
-    now = time(NULL);
-    strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", localtime(&now));
-    switch (level) {
-        case LogLevel_DEBUG:
-            levelstr = "DEBUG";
+    if (*p == '*') {
+        (*numStars)++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            (*numStars)++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    *length = Length_NONE;
+    switch (*p) {
+        case 'h':
+            p++;
+            *length = (*p == 'h') ? Length_HH : Length_H;
+            p += (*length == Length_HH);
             break;
-        case LogLevel_INFO:
-            levelstr = "INFO ";
+        case 'l':
+            p++;
+            *length = (*p == 'l') ? Length_LL : Length_L;
+            p += (*length == Length_LL);
             break;
-        case LogLevel_WARN:
-            levelstr = "WARN ";
+        case 'j':
+            *length = Length_J;
+            p++;
             break;
-        case LogLevel_ERROR:
-            levelstr = "ERROR ";
+        case 'z':
+            *length = Length_Z;
+            p++;
+            break;
+        case 't':
+            *length = Length_T;
+            p++;
+            break;
+        case 'L':
+            *length = Length_LONG_DOUBLE;
+            p++;
+            break;
+    }
+    switch (*p) {
+        case '%':
+            *type = ArgType_NONE;
+            break;
+        case 'd': case 'i':
+            *type = ArgType_INT;
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            *type = ArgType_UINT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            *type = ArgType_DOUBLE;
+            break;
+        case 'c':
+            *type = ArgType_CHAR;
+            break;
+        case 's':
+            *type = ArgType_STRING;
+            break;
+        case 'p':
+            *type = ArgType_POINTER;
+            break;
+        case 'n':
+            *type = ArgType_COUNT;
             break;
         default:
-            assert(0 && "Unknown LogLevel");
-            return;
+            return NULL;
+    }
+    return p + 1;
+}
+
+static int64_t readInt(Length length, va_list* args)
+{
+    switch (length) {
+        case Length_HH:
+            return (signed char) va_arg(*args, int);
+        case Length_H:
+            return (short) va_arg(*args, int);
+        case Length_L:
+            return va_arg(*args, long);
+        case Length_LL:
+            return va_arg(*args, long long);
+        case Length_J:
+            return va_arg(*args, intmax_t);
+        case Length_Z:
+            return (int64_t) va_arg(*args, size_t);
+        case Length_T:
+            return va_arg(*args, ptrdiff_t);
+        default:
+            return va_arg(*args, int);
     }
-    fprintf(fp, "%s %s %s:%d:%s: ", timestr, levelstr, file, line, func);
+}
 
-    va_start(arg, fmt);
-    vfprintf(fp, fmt, arg);
-    va_end(arg);
+static uint64_t readUint(Length length, va_list* args)
+{
+    switch (length) {
+        case Length_HH:
+            return (unsigned char) va_arg(*args, unsigned int);
+        case Length_H:
+            return (unsigned short) va_arg(*args, unsigned int);
+        case Length_L:
+            return va_arg(*args, unsigned long);
+        case Length_LL:
+            return va_arg(*args, unsigned long long);
+        case Length_J:
+            return va_arg(*args, uintmax_t);
+        case Length_Z:
+            return va_arg(*args, size_t);
+        case Length_T:
+            return (uint64_t) va_arg(*args, ptrdiff_t);
+        default:
+            return va_arg(*args, unsigned int);
+    }
+}
 
+// 書式に従って引数を8バイト単位で buffer に写し、書き込んだバイト数を返す。
+// 文字列は長さに続けて中身を写すので、呼び出し元のバッファがなくなっても書式化できる。
+// 収まらなかった引数は切り詰めて truncated をtrueにする
+static size_t encodeArgs(unsigned char* buffer, size_t capacity, const char* fmt, va_list* args, bool* truncated)
+{
+    size_t size = 0;
+    for (const char* p = strchr(fmt, '%'); p != NULL; p = strchr(p, '%')) {
+        ArgType type;
+        Length length;
+        int numStars;
+        p = parseSpec(p, &type, &length, &numStars);
+        if (p == NULL) {
+            break;
+        }
+        for (int i = 0; i < numStars; i++) {
+            Arg arg = { .i = va_arg(*args, int) };
+            if (size + sizeof(Arg) > capacity) {
+                *truncated = true;
+                return size;
+            }
+            memcpy(buffer + size, &arg, sizeof(Arg));
+            size += sizeof(Arg);
+        }
+        Arg arg = { .u = 0 };
+        switch (type) {
+            case ArgType_NONE:
+                continue;
+            case ArgType_INT:
+                arg.i = readInt(length, args);
+                break;
+            case ArgType_UINT:
+                arg.u = readUint(length, args);
+                break;
+            case ArgType_DOUBLE:
+                arg.d = (length == Length_LONG_DOUBLE) ? (double) va_arg(*args, long double) : va_arg(*args, double);
+                break;
+            case ArgType_CHAR:
+                arg.i = va_arg(*args, int);
+                break;
+            case ArgType_POINTER:
+                arg.p = va_arg(*args, void*);
+                break;
+            case ArgType_COUNT:
+                va_arg(*args, void*);
+                continue;
+            case ArgType_STRING: {
+                const char* str = va_arg(*args, const char*);
+                if (str == NULL) {
+                    str = "(null)";
+                }
+                if (size + sizeof(Arg) + 1 > capacity) {
+                    *truncated = true;
+                    return size;
+                }
+                size_t len = strlen(str);
+                if (len > capacity - size - sizeof(Arg) - 1) {
+                    len = capacity - size - sizeof(Arg) - 1;
+                    *truncated = true;
+                }
+                arg.u = len;
+                memcpy(buffer + size, &arg, sizeof(Arg));
+                memcpy(buffer + size + sizeof(Arg), str, len);
+                buffer[size + sizeof(Arg) + len] = '\0';
+                size += sizeof(Arg) + ((len + 1 + sizeof(Arg) - 1) & ~(sizeof(Arg) - 1));
+                continue;
+            }
+        }
+        if (size + sizeof(Arg) > capacity) {
+            *truncated = true;
+            return size;
+        }
+        memcpy(buffer + size, &arg, sizeof(Arg));
+        size += sizeof(Arg);
+    }
+    return size;
+}
+
+static void releaseRing(void* value)
+{
+    Ring* ring = value;
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
+
+static void createRingKey(void)
+{
+    pthread_key_create(&s_ringKey, releaseRing);
+}
+
+static Ring* getThreadRing(void)
+{
+    if (s_threadRing != NULL) {
+        return s_threadRing;
+    }
+    Ring* ring = malloc(sizeof(Ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->head = ring->tail = 0;
+    ring->dropped = 0;
+    ring->closed = 0;
+    ring->next = __atomic_load_n(&s_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&s_rings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    pthread_setspecific(s_ringKey, ring);
+    s_threadRing = ring;
+    return ring;
+}
+
+// 時刻と引数だけをリングに直接書き込み、書式化と出力は背景スレッドに任せる。あふれたら待たずに捨てる
+static void pushRecord(const LogSite* site, FILE* fp, va_list* args)
+{
+    Ring* ring = getThreadRing();
+    if (ring == NULL) {
+        __atomic_fetch_add(&s_lost, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    uint64_t tail = ring->tail;
+    size_t space = kRingSize - (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+    size_t offset = tail & (kRingSize - 1);
+    size_t skip = 0;
+    if (kRingSize - offset < kMaxRecordSize) {
+        // 記録がリングの末尾をまたがないように先頭に戻る
+        skip = kRingSize - offset;
+        space = (space > skip) ? space - skip : 0;
+    }
+    size_t capacity = (space < kMaxRecordSize) ? space : kMaxRecordSize;
+    if (capacity < sizeof(Record)) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    Record* record = (Record*) (ring->data + (offset + skip) % kRingSize);
+    bool truncated = false;
+    record->argSize = encodeArgs((unsigned char*) record + sizeof(Record), capacity - sizeof(Record),
+            site->fmt, args, &truncated);
+    if (truncated && capacity < kMaxRecordSize) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(kClock, &ts);
+    record->size = sizeof(Record) + record->argSize;
+    record->time = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    record->fp = fp;
+    record->site = site;
+    if (skip > 0) {
+        uint32_t padding = 0;
+        memcpy(ring->data + offset, &padding, sizeof(padding));
+    }
+    __atomic_store_n(&ring->tail, tail + skip + record->size, __ATOMIC_RELEASE);
+}
+
+static void logSync(const LogSite* site, FILE* fp, va_list* args)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+    char timestr[20];
+    strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", localtime_r(&now, &tm));
+    fprintf(fp, "%s %s %s:%d:%s: ", timestr, getLevelString(site->level), getFileName(site->file),
+            site->line, site->func);
+    vfprintf(fp, site->fmt, *args);
     fprintf(fp, "\n");
 }
+
+void logger_log(const LogSite* site, FILE* fp, ...)
+{
+    va_list args;
+
+    if (s_logLevel > site->level) {
+        return;
+    }
+
+    va_start(args, fp);
+    if (__atomic_load_n(&s_running, __ATOMIC_ACQUIRE)) {
+        pushRecord(site, fp, &args);
+    } else {
+        logSync(site, fp, &args);
+    }
+    va_end(args);
+}
+
+static void flushBatch(void)
+{
+    if (s_batchLength > 0) {
+        fwrite(s_batch, 1, s_batchLength, s_batchFile);
+        fflush(s_batchFile);
+        s_batchLength = 0;
+    }
+}
+
+static void appendBatch(FILE* fp, const void* data, size_t size)
+{
+    if (fp != s_batchFile || s_batchLength + size > kBatchSize) {
+        flushBatch();
+        s_batchFile = fp;
+    }
+    if (size > kBatchSize) {
+        fwrite(data, 1, size, fp);
+        return;
+    }
+    memcpy(s_batch + s_batchLength, data, size);
+    s_batchLength += size;
+}
+
+// snprintf の結果を長さ len の文字列 out の後ろに足す。切り詰めても末尾を超えない
+static void appendf(char* out, size_t capacity, size_t* len, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out + *len, capacity - *len, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        *len += ((size_t) n < capacity - *len) ? (size_t) n : capacity - *len - 1;
+    }
+}
+
+static const char* getTimeString(int64_t time)
+{
+    time_t second = (time_t) (time / 1000000000);
+    if (second != s_cachedSecond) {
+        struct tm tm;
+        strftime(s_cachedTime, sizeof(s_cachedTime), "%Y-%m-%d %H:%M:%S", localtime_r(&second, &tm));
+        s_cachedSecond = second;
+    }
+    return s_cachedTime;
+}
+
+// 変換指定を1つずつ snprintf に渡して、記録した引数から元の呼び出しと同じ文字列を作る
+static void formatMessage(char* out, size_t capacity, size_t* len, const char* fmt,
+        const unsigned char* args, size_t argSize)
+{
+    const unsigned char* end = args + argSize;
+    const char* p = fmt;
+    while (*p != '\0') {
+        const char* percent = strchr(p, '%');
+        if (percent == NULL) {
+            appendf(out, capacity, len, "%s", p);
+            return;
+        }
+        appendf(out, capacity, len, "%.*s", (int) (percent - p), p);
+        ArgType type;
+        Length length;
+        int numStars;
+        const char* next = parseSpec(percent, &type, &length, &numStars);
+        if (next == NULL) {
+            appendf(out, capacity, len, "%s", percent);
+            return;
+        }
+        size_t needed = sizeof(Arg) * (numStars + (type != ArgType_NONE && type != ArgType_COUNT));
+        if (args + needed > end) {
+            appendf(out, capacity, len, "...");
+            return;
+        }
+        // 長さ修飾子を除き、* を引数の値に置き換えた変換指定を作る
+        char spec[64];
+        size_t specLength = 0;
+        for (const char* q = percent; q < next - 1 && specLength < sizeof(spec) - 24; q++) {
+            if (*q == '*') {
+                Arg star;
+                memcpy(&star, args, sizeof(Arg));
+                args += sizeof(Arg);
+                if (q[-1] == '.' && star.i < 0) {
+                    specLength--; // 負の精度は指定しなかったことになる
+                } else {
+                    specLength += sprintf(spec + specLength, "%d", (int) star.i);
+                }
+            } else if (strchr("hljztL", *q) == NULL) {
+                spec[specLength++] = *q;
+            }
+        }
+        if (type == ArgType_INT || type == ArgType_UINT) {
+            spec[specLength++] = 'l';
+            spec[specLength++] = 'l';
+        }
+        spec[specLength++] = next[-1];
+        spec[specLength] = '\0';
+
+        Arg arg = { .u = 0 };
+        if (type != ArgType_NONE && type != ArgType_COUNT) {
+            memcpy(&arg, args, sizeof(Arg));
+            args += sizeof(Arg);
+        }
+        switch (type) {
+            case ArgType_NONE:
+                appendf(out, capacity, len, "%%");
+                break;
+            case ArgType_INT:
+                appendf(out, capacity, len, spec, (long long) arg.i);
+                break;
+            case ArgType_UINT:
+                appendf(out, capacity, len, spec, (unsigned long long) arg.u);
+                break;
+            case ArgType_DOUBLE:
+                appendf(out, capacity, len, spec, arg.d);
+                break;
+            case ArgType_CHAR:
+                appendf(out, capacity, len, spec, (int) arg.i);
+                break;
+            case ArgType_POINTER:
+                appendf(out, capacity, len, spec, arg.p);
+                break;
+            case ArgType_STRING:
+                // ファイルから読んだ記録は壊れているかもしれない
+                if (arg.u >= (size_t) (end - args) || args[arg.u] != '\0') {
+                    appendf(out, capacity, len, "...");
+                    return;
+                }
+                appendf(out, capacity, len, spec, (const char*) args);
+                args += (arg.u + 1 + sizeof(Arg) - 1) & ~(sizeof(Arg) - 1);
+                break;
+            case ArgType_COUNT:
+                break;
+        }
+        p = next;
+    }
+}
+
+// 1行を書式化して line に書き込み、改行を含む長さを返す
+static size_t formatLine(char* line, size_t capacity, const LogSite* site, int64_t time,
+        const unsigned char* args, size_t argSize)
+{
+    size_t len = 0;
+    appendf(line, capacity - 1, &len, "%s %s %s:%d:%s: ", getTimeString(time), getLevelString(site->level),
+            getFileName(site->file), site->line, site->func);
+    formatMessage(line, capacity - 1, &len, site->fmt, args, argSize);
+    line[len++] = '\n';
+    return len;
+}
+
+// 場所の番号を返す。初めての場所なら番号を割り当てて added をtrueにする。表を広げられなければ負の値を返す
+static int64_t getSiteId(const LogSite* site, bool* added)
+{
+    *added = false;
+    if ((s_numSites + 1) * 2 > s_siteCapacity) {
+        size_t capacity = (s_siteCapacity == 0) ? 256 : s_siteCapacity * 2;
+        SiteEntry* table = calloc(capacity, sizeof(SiteEntry));
+        if (table == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < s_siteCapacity; i++) {
+            if (s_siteTable[i].site != NULL) {
+                size_t j = ((uintptr_t) s_siteTable[i].site >> 3) & (capacity - 1);
+                while (table[j].site != NULL) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                table[j] = s_siteTable[i];
+            }
+        }
+        free(s_siteTable);
+        s_siteTable = table;
+        s_siteCapacity = capacity;
+    }
+    size_t i = ((uintptr_t) site >> 3) & (s_siteCapacity - 1);
+    while (s_siteTable[i].site != NULL && s_siteTable[i].site != site) {
+        i = (i + 1) & (s_siteCapacity - 1);
+    }
+    if (s_siteTable[i].site == NULL) {
+        s_siteTable[i].site = site;
+        s_siteTable[i].id = s_numSites++;
+        *added = true;
+    }
+    return s_siteTable[i].id;
+}
+
+static void writeString(const char* str)
+{
+    uint32_t length = (uint32_t) strlen(str);
+    appendBatch(s_binaryFile, &length, sizeof(length));
+    appendBatch(s_binaryFile, str, length);
+}
+
+// 書式化せずに、場所の番号と引数をそのまま書き込む
+static void writeBinary(const LogSite* site, int64_t time, const unsigned char* args, uint32_t argSize)
+{
+    bool added;
+    int64_t id = getSiteId(site, &added);
+    if (id < 0) {
+        __atomic_fetch_add(&s_lost, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    uint32_t siteId = (uint32_t) id;
+    if (added) {
+        uint8_t type = kEntrySite;
+        int32_t level = site->level, line = site->line;
+        appendBatch(s_binaryFile, &type, sizeof(type));
+        appendBatch(s_binaryFile, &siteId, sizeof(siteId));
+        appendBatch(s_binaryFile, &level, sizeof(level));
+        appendBatch(s_binaryFile, &line, sizeof(line));
+        writeString(getFileName(site->file));
+        writeString(site->func);
+        writeString(site->fmt);
+    }
+    uint8_t type = kEntryRecord;
+    appendBatch(s_binaryFile, &type, sizeof(type));
+    appendBatch(s_binaryFile, &siteId, sizeof(siteId));
+    appendBatch(s_binaryFile, &time, sizeof(time));
+    appendBatch(s_binaryFile, &argSize, sizeof(argSize));
+    appendBatch(s_binaryFile, args, argSize);
+}
+
+static void writeEntry(const LogSite* site, FILE* fp, int64_t time, const unsigned char* args, uint32_t argSize)
+{
+    if (s_binaryFile != NULL) {
+        writeBinary(site, time, args, argSize);
+        return;
+    }
+    char line[kMaxRecordSize * 2];
+    size_t len = formatLine(line, sizeof(line), site, time, args, argSize);
+    appendBatch(fp, line, len);
+}
+
+// 読み出せる記録の先頭を返す。詰め物は読み飛ばす
+static const Record* peekRecord(Ring* ring)
+{
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    while (ring->head != tail) {
+        const Record* record = (const Record*) (ring->data + (ring->head & (kRingSize - 1)));
+        if (record->size != 0) {
+            return record;
+        }
+        __atomic_store_n(&ring->head, (ring->head | (kRingSize - 1)) + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// すべてのリングの記録を時刻の順に書き出し、書き出した数を返す
+static size_t drain(void)
+{
+    size_t count = 0;
+    for (;;) {
+        Ring* oldest = NULL;
+        const Record* record = NULL;
+        for (Ring* ring = __atomic_load_n(&s_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+            const Record* candidate = peekRecord(ring);
+            if (candidate != NULL && (record == NULL || candidate->time < record->time)) {
+                oldest = ring;
+                record = candidate;
+            }
+        }
+        if (record == NULL) {
+            break;
+        }
+        writeEntry(record->site, record->fp, record->time, (const unsigned char*) record + sizeof(Record),
+                record->argSize);
+        __atomic_store_n(&oldest->head, oldest->head + record->size, __ATOMIC_RELEASE);
+        count++;
+    }
+    flushBatch();
+    return count;
+}
+
+// 終了したスレッドのリングを、読み終えてから解放する
+static void releaseClosedRings(void)
+{
+    Ring** link = &s_rings;
+    Ring* ring = __atomic_load_n(link, __ATOMIC_ACQUIRE);
+    while (ring != NULL) {
+        if (!__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)
+                || ring->head != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+            link = &ring->next;
+            ring = ring->next;
+            continue;
+        }
+        Ring* next = ring->next;
+        if (link == &s_rings) {
+            // 先頭には他のスレッドが追加しているかもしれない
+            Ring* expected = ring;
+            if (!__atomic_compare_exchange_n(&s_rings, &expected, next, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                for (link = &s_rings; *link != ring; link = &(*link)->next) {
+                }
+                *link = next;
+            }
+        } else {
+            *link = next;
+        }
+        s_releasedDrops += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        free(ring);
+        ring = next;
+    }
+}
+
+// 捨てた記録の数を1秒に1回まとめて出力する
+static void reportDrops(bool force)
+{
+    struct timespec ts;
+    clock_gettime(kClock, &ts);
+    if (!force && ts.tv_sec == s_reportedSecond) {
+        return;
+    }
+    uint64_t drops = s_releasedDrops + __atomic_load_n(&s_lost, __ATOMIC_RELAXED);
+    for (Ring* ring = __atomic_load_n(&s_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        drops += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    }
+    if (drops > s_reportedDrops) {
+        static const LogSite site = { LogLevel_WARN, __FILE__, __LINE__, __func__, "Dropped %llu log messages" };
+        Arg arg = { .u = drops - s_reportedDrops };
+        writeEntry(&site, stderr, (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec, (const unsigned char*) &arg,
+                sizeof(arg));
+        flushBatch();
+        s_reportedDrops = drops;
+        s_reportedSecond = ts.tv_sec;
+    }
+}
+
+static void* consume(void* arg)
+{
+    long wait = kMinWait;
+    for (;;) {
+        bool running = __atomic_load_n(&s_running, __ATOMIC_ACQUIRE);
+        size_t count = drain();
+        reportDrops(!running);
+        releaseClosedRings();
+        if (!running) {
+            break;
+        }
+        wait = (count > 0) ? kMinWait : (wait * 2 < kMaxWait ? wait * 2 : kMaxWait);
+        struct timespec ts = { 0, wait };
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+static bool openBinaryFile(const char* filename)
+{
+    s_binaryFile = fopen(filename, "wb");
+    if (s_binaryFile == NULL) {
+        LOG_ERROR("Failed to open file: %s", filename);
+        return false;
+    }
+    uint32_t version = LOGGER_VERSION;
+    if (fwrite(LOGGER_MAGIC, 1, 8, s_binaryFile) != 8 || fwrite(&version, sizeof(version), 1, s_binaryFile) != 1) {
+        LOG_ERROR("Failed to write file: %s", filename);
+        fclose(s_binaryFile);
+        s_binaryFile = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool logger_startAsync(const char* binaryFile)
+{
+    if (__atomic_load_n(&s_running, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+    if (binaryFile != NULL && !openBinaryFile(binaryFile)) {
+        return false;
+    }
+    pthread_once(&s_keyOnce, createRingKey);
+    __atomic_store_n(&s_running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&s_thread, NULL, consume, NULL) != 0) {
+        __atomic_store_n(&s_running, 0, __ATOMIC_RELEASE);
+        if (s_binaryFile != NULL) {
+            fclose(s_binaryFile);
+            s_binaryFile = NULL;
+        }
+        return false;
+    }
+    return true;
+}
+
+void logger_stopAsync(void)
+{
+    if (!__atomic_load_n(&s_running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    __atomic_store_n(&s_running, 0, __ATOMIC_RELEASE);
+    pthread_join(s_thread, NULL);
+    // 残っているのはまだ終了していないスレッドのリング。書き込まれるかもしれないので解放せず、次に開始したときに読み出す。
+    // 捨てた記録の数もリングに残るので、数え直さない
+    if (s_binaryFile != NULL) {
+        if (fclose(s_binaryFile) != 0) {
+            LOG_ERROR("Failed to write log file");
+        }
+        s_binaryFile = NULL;
+    }
+    free(s_siteTable);
+    s_siteTable = NULL;
+    s_siteCapacity = 0;
+    s_numSites = 0;
+    s_batchFile = NULL;
+}
+
+static char* readString(FILE* in)
+{
+    uint32_t length;
+    if (fread(&length, sizeof(length), 1, in) != 1 || length > kMaxStringLength) {
+        return NULL;
+    }
+    char* str = malloc(length + 1);
+    if (str == NULL || fread(str, 1, length, in) != length) {
+        free(str);
+        return NULL;
+    }
+    str[length] = '\0';
+    return str;
+}
+
+static void releaseSites(LogSite* sites, size_t numSites)
+{
+    for (size_t i = 0; i < numSites; i++) {
+        free((char*) sites[i].file);
+        free((char*) sites[i].func);
+        free((char*) sites[i].fmt);
+    }
+    free(sites);
+}
+
+bool logger_decode(FILE* in, FILE* out)
+{
+    char magic[8];
+    uint32_t version;
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, LOGGER_MAGIC, sizeof(magic)) != 0
+            || fread(&version, sizeof(version), 1, in) != 1 || version != LOGGER_VERSION) {
+        LOG_ERROR("Not a binary log file");
+        return false;
+    }
+    LogSite* sites = NULL;
+    size_t numSites = 0, siteCapacity = 0;
+    Arg args[kMaxRecordSize / sizeof(Arg)];
+    char line[kMaxRecordSize * 2];
+    bool result = true;
+    uint8_t type;
+    while (result && fread(&type, sizeof(type), 1, in) == 1) {
+        uint32_t id;
+        if (fread(&id, sizeof(id), 1, in) != 1) {
+            result = false;
+        } else if (type == kEntrySite) {
+            int32_t level, lineNumber;
+            if (id != numSites || fread(&level, sizeof(level), 1, in) != 1
+                    || fread(&lineNumber, sizeof(lineNumber), 1, in) != 1
+                    || level < LogLevel_DEBUG || level > LogLevel_ERROR) {
+                result = false;
+                continue;
+            }
+            if (numSites == siteCapacity) {
+                size_t capacity = (siteCapacity == 0) ? 256 : siteCapacity * 2;
+                LogSite* grown = realloc(sites, sizeof(LogSite) * capacity);
+                if (grown == NULL) {
+                    LOG_ERROR("Failed to allocate log sites");
+                    releaseSites(sites, numSites);
+                    return false;
+                }
+                sites = grown;
+                siteCapacity = capacity;
+            }
+            LogSite* site = &sites[numSites];
+            site->level = level;
+            site->line = lineNumber;
+            site->file = readString(in);
+            site->func = readString(in);
+            site->fmt = readString(in);
+            numSites++;
+            result = site->file != NULL && site->func != NULL && site->fmt != NULL;
+        } else if (type == kEntryRecord) {
+            int64_t time;
+            uint32_t argSize;
+            if (fread(&time, sizeof(time), 1, in) != 1 || fread(&argSize, sizeof(argSize), 1, in) != 1
+                    || id >= numSites || argSize > sizeof(args) || fread(args, 1, argSize, in) != argSize) {
+                result = false;
+                continue;
+            }
+            size_t len = formatLine(line, sizeof(line), &sites[id], time, (const unsigned char*) args, argSize);
+            if (fwrite(line, 1, len, out) != len) {
+                LOG_ERROR("Failed to write decoded log");
+                releaseSites(sites, numSites);
+                return false;
+            }
+        } else {
+            result = false;
+        }
+    }
+    if (!result && feof(in)) {
+        // 書き込みの途中で終了したファイルは、読めたところまでを出力する
+        LOG_WARN("Log file ends in the middle of an entry");
+        result = true;
+    } else if (!result) {
+        LOG_ERROR("Invalid binary log file");
+    }
+    releaseSites(sites, numSites);
+    return result;
+}
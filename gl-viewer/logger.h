@@ -1,21 +1,13 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <stdbool.h>
 #include <stdio.h>
 
 #ifdef _WIN32
- #include <string.h>
- #define __FILENAME__ (strrchr(__FILE__, '\\') ? strrchr(__FILE__, '\\') + 1 : __FILE__)
  #define __func__ __FUNCTION__
-#else
- #define __FILENAME__ __FILE__
 #endif
 
-#define LOG_DEBUG(fmt, ...) logger_log(LogLevel_DEBUG, stderr, __FILENAME__, __LINE__, __func__, fmt, ## __VA_ARGS__)
-#define LOG_INFO(fmt, ...)  logger_log(LogLevel_INFO , stderr, __FILENAME__, __LINE__, __func__, fmt, ## __VA_ARGS__)
-#define LOG_WARN(fmt, ...)  logger_log(LogLevel_WARN , stderr, __FILENAME__, __LINE__, __func__, fmt, ## __VA_ARGS__)
-#define LOG_ERROR(fmt, ...) logger_log(LogLevel_ERROR, stderr, __FILENAME__, __LINE__, __func__, fmt, ## __VA_ARGS__)
-
 typedef enum
 {
     LogLevel_DEBUG,
@@ -24,7 +16,52 @@ typedef enum
     LogLevel_ERROR,
 } LogLevel;
 
+// これより低いレベルの LOG_* は引数ごとコンパイルで取り除く。例: -DLOGGER_MIN_LEVEL=LogLevel_INFO
+#ifndef LOGGER_MIN_LEVEL
+ #define LOGGER_MIN_LEVEL LogLevel_DEBUG
+#endif
+
+// LOG_* を書いた場所ごとに1つ作る。バイナリ形式ではこのアドレスを書式の番号に置き換える
+typedef struct
+{
+    LogLevel level;
+    const char* file;
+    int line;
+    const char* func;
+    const char* fmt;
+} LogSite;
+
+#define LOGGER_LOG(level, fmt, ...) \
+    do { \
+        if ((level) >= LOGGER_MIN_LEVEL) { \
+            static const LogSite logSite = { level, __FILE__, __LINE__, __func__, fmt }; \
+            logger_log(&logSite, stderr, ## __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(fmt, ...) LOGGER_LOG(LogLevel_DEBUG, fmt, ## __VA_ARGS__)
+#define LOG_INFO(fmt, ...)  LOGGER_LOG(LogLevel_INFO , fmt, ## __VA_ARGS__)
+#define LOG_WARN(fmt, ...)  LOGGER_LOG(LogLevel_WARN , fmt, ## __VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOGGER_LOG(LogLevel_ERROR, fmt, ## __VA_ARGS__)
+
+// バイナリ形式のログ（ネイティブのバイト順）
+//   ヘッダ:   char magic[8] "GLLOGBIN", uint32_t version
+//   場所:     uint8_t 1, uint32_t id, int32_t level, int32_t line, 文字列 file, func, fmt
+//   記録:     uint8_t 2, uint32_t id, int64_t time [ns], uint32_t argSize, 引数 argSize バイト
+// 場所は0からの番号の順に、その場所の最初の記録の前に置く。文字列は uint32_t の長さに続く中身。
+// 引数は * の幅と精度を含む変換指定ごとに8バイトで、%s は長さに続けて NUL を含む中身を8バイト単位に詰める
+#define LOGGER_MAGIC "GLLOGBIN"
+#define LOGGER_VERSION 1
+
 void logger_setLevel(LogLevel level);
-void logger_log(LogLevel level, FILE* fp, const char* file, int line, const char* func, const char* fmt, ...);
+// 書式化と出力を背景スレッドで行う。呼び出したスレッドは時刻と引数をスレッドごとのリングに書き込むだけで、
+// リングがあふれたら待たずに捨てて、捨てた数を背景スレッドが WARN で出力する。
+// binaryFile がNULLでなければ、書式化せずにバイナリ形式でそのファイルに書き込む
+bool logger_startAsync(const char* binaryFile);
+// 残っている記録をすべて出力して背景スレッドを終了する。他のスレッドは動いていてもよい
+void logger_stopAsync(void);
+void logger_log(const LogSite* site, FILE* fp, ...);
+// バイナリ形式のログを読み、テキストの形式で out に書き出す
+bool logger_decode(FILE* in, FILE* out);
 
 #endif /* LOGGER_H */
@@ -1,12 +1,24 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #if defined __APPLE__ && defined __MACH__
  #include <GLUT/glut.h>
 #else
  #include <GL/glut.h>
 #endif // __APPLE__ && __MACH__
+#include "cameras.h"
 #include "logger.h"
+#include "mesh.h"
+#include "offscreen.h"
+#include "pointcloud.h"
+#include "renderer.h"
+#include "scheduler.h"
 
 #define PERSPECTIVE_ENABLED 1
 
@@ -21,23 +33,6 @@ typedef struct
     double ux, uy, uz; // 上方向ベクトル
 } Viewpoint;
 
-typedef struct
-{
-    GLfloat position[4];  // ライトの位置
-    GLfloat ambient[4];   // 環境光
-    GLfloat diffuse[4];   // 拡散光（照明のカラー）
-    GLfloat specular[4];  // 鏡面光
-    GLfloat direction[3]; // スポットの方向
-} Light;
-
-typedef struct
-{
-    GLfloat ambient[4];   // 材質の環境光
-    GLfloat diffuse[4];   // 材質の拡散光
-    GLfloat specular[4];  // 材質の鏡面光
-    GLfloat shininess[1]; // 鏡面係数
-} Material;
-
 typedef struct
 {
     bool pressed;
@@ -63,6 +58,39 @@ static Material s_material = {
     .shininess = { 30.0f },
 };
 static MouseButton s_leftButton, s_rightButton;
+static Mesh s_mesh;
+static bool s_hasMesh;
+static double s_trianglesPerSecond; // GPU時間の出ている最新のフレームから見積もった描画速度
+static bool s_hasPointCloud;
+static double s_pointsPerSecond;
+static bool s_hasCameras;
+
+static const double kInteractiveFrameTime = 1.0 / 30.0; // 操作中の1フレームの描画時間の目安 [s]
+static const double kIdleFrameTime = 0.25; // 操作していないときの1フレームの描画時間の目安 [s]
+static const size_t kMinPoints = 100000;    // 1フレームで描画する点の数の下限
+static const size_t kMaxPoints = 1 << 24;   // 1フレームで描画する点の数の上限
+static const unsigned int kPollInterval = 50; // 読み込みを終えた点群の節点やカメラを確かめる間隔 [ms]
+// GPU時間の結果を待つ間、フレームごとに描画した数を覚えておくフレーム数
+enum { kFrameHistory = 8 };
+static double s_framePrimitives[kFrameHistory]; // フレームの番号ごとに描画した三角形、点またはカメラの数
+
+// 速度計測
+enum { kBenchmarkFrames = 100 };
+static bool s_benchmark;
+static int s_benchmarkFrame;
+static double s_benchmarkStart;
+static double s_benchmarkPrimitives; // 計測を始めてから描画した三角形、点またはカメラの数
+
+// ウィンドウを開かずに描画する
+enum { kMaxLoadPasses = 1000 }; // 点群の節点を読み込み終えるまで描画し直す回数の上限
+static bool s_headless;
+
+static double getTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0; // [s]
+}
 
 static void setViewpoint(const Viewpoint* v)
 {
@@ -152,12 +180,105 @@ static void drawAxes(int len)
     glEnd();
 }
 
-static void idle(void)
+// 視点を回しながら描画し続け、描画した三角形の数を計測する
+static void benchmark(void)
 {
-    glutPostRedisplay();
+    const char* primitive = s_hasCameras ? "cameras" : (s_hasPointCloud ? "points" : "triangles");
+    if (s_benchmarkFrame == 0) {
+        glFinish(); // 最初のフレームは転送などを含むので計測しない
+        s_benchmarkStart = getTime();
+        s_benchmarkPrimitives = 0.0;
+    } else if (s_benchmarkFrame == kBenchmarkFrames) {
+        glFinish();
+        double elapsed = getTime() - s_benchmarkStart;
+        LOG_INFO("%d frames in %.3f s: %.1f fps, %.3f M%s/s", kBenchmarkFrames, elapsed,
+                kBenchmarkFrames / elapsed, s_benchmarkPrimitives / elapsed / 1000000.0, primitive);
+        exit(EXIT_SUCCESS);
+    }
+    s_benchmarkFrame++;
+    rotate(&s_viewpoint, 2.0 * M_PI / kBenchmarkFrames, 0.0);
+    scheduler_invalidate();
 }
 
-static void display(void)
+// 描画中のフレームの番号 (0から)
+static long getFrameNumber(void)
+{
+    if (s_headless) {
+        size_t count;
+        offscreen_getFrames(&count);
+        return (long) count;
+    }
+    return (long) scheduler_getStatistics()->frames;
+}
+
+// GPU時間の結果が出ている最新のフレームについて、描画した数をGPU時間で割った描画速度を返す。
+// 結果を待たないので数フレーム前の値になる。見積もれなければ負の値を返す
+static double estimateRate(double minPrimitives)
+{
+    long frame = -1;
+    double gpuTime = 0.0;
+    if (s_headless) {
+        size_t count;
+        const OffscreenFrame* frames = offscreen_getFrames(&count);
+        for (size_t i = count; i > 0 && i + kFrameHistory > count; i--) {
+            if (frames[i - 1].gpuTime >= 0.0) {
+                frame = (long) i - 1;
+                gpuTime = frames[i - 1].gpuTime;
+                break;
+            }
+        }
+    } else {
+        const SchedulerStatistics* stats = scheduler_getStatistics();
+        frame = stats->lastGpuFrame;
+        gpuTime = stats->lastGpuTime;
+    }
+    if (frame < 0 || frame + kFrameHistory <= getFrameNumber() || gpuTime <= 0.0) {
+        return -1.0;
+    }
+    double primitives = s_framePrimitives[frame % kFrameHistory];
+    return (primitives >= minPrimitives) ? primitives / (gpuTime / 1000.0) : -1.0;
+}
+
+static void recordPrimitives(double primitives)
+{
+    s_framePrimitives[getFrameNumber() % kFrameHistory] = primitives;
+    s_benchmarkPrimitives += primitives;
+}
+
+// 操作中は描画速度に見合った粗い詳細度で描画し、操作を終えたら元のメッシュで描画し直す
+static void drawMesh(void)
+{
+    double rate = estimateRate(1.0);
+    if (rate > 0.0) {
+        s_trianglesPerSecond = rate;
+    }
+    bool interacting = s_leftButton.pressed || s_rightButton.pressed;
+    int level = 0;
+    if (interacting && !s_benchmark && s_trianglesPerSecond > 0.0) {
+        level = mesh_selectLevel(&s_mesh, (size_t) (s_trianglesPerSecond * kInteractiveFrameTime));
+    }
+    renderer_drawMesh(&s_mesh, level, &s_light0, &s_material);
+    recordPrimitives(s_mesh.levels[level].numTriangles);
+}
+
+// 描画速度から1フレームの時間に収まる点の数を決めて描画する。操作を終えたら時間をかけて細かく描画し直す
+static void drawPointCloud(void)
+{
+    double rate = estimateRate(kMinPoints); // 点が少ないと転送などの時間が目立つので見積もらない
+    if (rate > 0.0) {
+        s_pointsPerSecond = rate;
+    }
+    bool interacting = s_leftButton.pressed || s_rightButton.pressed;
+    size_t maxPoints = 1000000;
+    if (s_pointsPerSecond > 0.0) {
+        double points = s_pointsPerSecond * (interacting || s_benchmark ? kInteractiveFrameTime : kIdleFrameTime);
+        maxPoints = (size_t) fmax(fmin(points, kMaxPoints), kMinPoints);
+    }
+    size_t numPoints = pointcloud_draw(maxPoints);
+    recordPrimitives(numPoints);
+}
+
+static void drawScene(void)
 {
     glMatrixMode(GL_MODELVIEW); // 現在の行列をモデルビュー変換行列に変更する
     glLoadIdentity(); // 変換行列を単位行列に初期化する
@@ -169,9 +290,25 @@ static void display(void)
     setMaterial(&s_material);
 
     drawAxes(100);
-    glutSolidTeapot(50);
+    if (s_hasCameras) {
+        s_benchmarkPrimitives += cameras_draw();
+    } else if (s_hasPointCloud) {
+        drawPointCloud();
+    } else if (s_hasMesh) {
+        drawMesh();
+    } else {
+        glutSolidTeapot(50);
+    }
+}
 
-    glutSwapBuffers(); // ダブルバッファリングのためのバッファの交換
+static void display(void)
+{
+    scheduler_beginFrame();
+    drawScene();
+    scheduler_endFrame();
+    if (s_benchmark) {
+        benchmark();
+    }
 }
 
 static void reshape(int width, int height)
@@ -179,6 +316,7 @@ static void reshape(int width, int height)
     LOG_DEBUG("width=%4d, height=%4d", width, height);
 
     setUpView(width, height);
+    scheduler_invalidate();
 }
 
 static void keyboard(unsigned char key, int x, int y)
@@ -201,6 +339,9 @@ static void mouse(int button, int state, int x, int y)
 {
     LOG_DEBUG("button=%d, state=%d, x=%d, y=%d", button, state, x, y);
 
+    if (state == GLUT_UP && (s_hasMesh || s_hasPointCloud)) {
+        scheduler_invalidate(); // 操作中の粗い詳細度から元に戻す
+    }
     s_leftButton.pressed = false;
     s_rightButton.pressed = false;
 
@@ -240,6 +381,8 @@ static void motion(int x, int y)
         s_rightButton.x = x;
         s_rightButton.y = y;
     }
+    // 視点が変わったときだけ描画し直す
+    scheduler_invalidate();
 }
 
 static void init(void)
@@ -254,19 +397,379 @@ static void init(void)
     glEnable(GL_LIGHT0); // ライト0を有効にする
 }
 
+static void onExit(void)
+{
+    const SchedulerStatistics* stats = scheduler_getStatistics();
+    if (stats->frames > 0) {
+        LOG_INFO("frames=%lu, vsync=%d, cpu=%.3f ms (max %.3f ms)", stats->frames, stats->swapInterval,
+                stats->cpuTime / stats->frames, stats->maxCpuTime);
+    }
+    if (stats->gpuFrames > 0) {
+        LOG_INFO("gpu=%.3f ms (max %.3f ms)", stats->gpuTime / stats->gpuFrames, stats->maxGpuTime);
+    }
+    if (stats->intervals > 0) {
+        double mean = stats->intervalTime / stats->intervals;
+        double variance = stats->intervalSquareTime / stats->intervals - mean * mean;
+        LOG_INFO("interval=%.3f ms, jitter=%.3f ms (max %.3f ms)",
+                mean, sqrt(fmax(variance, 0.0)), stats->maxInterval);
+    }
+    if (s_hasMesh) {
+        mesh_release(&s_mesh);
+        renderer_finalize();
+    }
+    if (s_hasPointCloud) {
+        const PointCloudStatistics* cloud = pointcloud_getStatistics();
+        LOG_INFO("nodes=%zu/%zu, points=%zu/%zu, loaded=%zu, evicted=%zu", cloud->residentNodes, cloud->numNodes,
+                cloud->residentPoints, cloud->numPoints, cloud->loadedNodes, cloud->evictedNodes);
+        pointcloud_close();
+    }
+    if (s_hasCameras) {
+        cameras_close();
+    }
+    scheduler_finalize();
+    if (s_headless) {
+        offscreen_finalize();
+    }
+}
+
+static void usage(const char* program)
+{
+    fprintf(stderr, "usage: %s [-b] [-g <size>] [model.ply|model.obj|cloud.oct]\n", program);
+    fprintf(stderr, "       %s [-b] -c <camera.xml> [camera_position.xml|camera_positions.csv|poses.log ...]\n", program);
+    fprintf(stderr, "  -b         measure triangles per second and exit\n");
+    fprintf(stderr, "  -g <size>  draw a generated grid of size x size quads\n");
+    fprintf(stderr, "  -c <file>  draw a frustum per camera pose with the intrinsics in file\n");
+    fprintf(stderr, "  -H         render offscreen without a window and print per-frame timings\n");
+    fprintf(stderr, "  -o <file>  write offscreen frames to file, e.g. frame%%04d.ppm (implies -H)\n");
+    fprintf(stderr, "  -p <file>  offscreen camera path, one \"ex ey ez cx cy cz [ux uy uz]\" per line\n");
+    fprintf(stderr, "  -n <num>   number of offscreen turntable frames without -p (default %d)\n", kBenchmarkFrames);
+    fprintf(stderr, "  -s <WxH>   offscreen image size (default 512x512)\n");
+    fprintf(stderr, "  -l <file>  write the log in binary to file; read it with logdecode\n");
+}
+
+static bool hasExtension(const char* filename, const char* extension)
+{
+    size_t length = strlen(filename), extensionLength = strlen(extension);
+    return length >= extensionLength && strcmp(filename + length - extensionLength, extension) == 0;
+}
+
+// モデルを読み込む。指定がなければティーポットを描画する
+static bool loadModel(const char* filename, int gridSize)
+{
+    if (filename == NULL && gridSize == 0) {
+        return true;
+    }
+    if (filename != NULL && hasExtension(filename, ".oct")) {
+        // 点群の節点は読み込みを終えたものから描画する
+        s_hasPointCloud = pointcloud_open(filename);
+        if (s_hasPointCloud && !s_headless) {
+            scheduler_setContentTimer(kPollInterval, pointcloud_update);
+        }
+        return s_hasPointCloud;
+    }
+    if (!renderer_initialize()) {
+        return false;
+    }
+    double start = getTime();
+    s_hasMesh = (filename != NULL) ? mesh_load(&s_mesh, filename) : mesh_createGrid(&s_mesh, gridSize);
+    if (!s_hasMesh) {
+        renderer_finalize();
+        return false;
+    }
+    LOG_INFO("Model loaded in %.3f s", getTime() - start);
+    return true;
+}
+
+// 姿勢を読み込みながら描画を続ける。速度計測では読み込みを終えるまで待つ
+static bool loadCameras(const char* cameraFile, const char* const* poseFiles, int numPoseFiles)
+{
+    // 姿勢のファイルがなければ、camera.xml に書き込まれた最初の画像での姿勢を描画する
+    s_hasCameras = (numPoseFiles > 0) ? cameras_open(cameraFile, poseFiles, numPoseFiles)
+                                      : cameras_open(cameraFile, &cameraFile, 1);
+    if (!s_hasCameras) {
+        return false;
+    }
+    if (s_benchmark || s_headless) {
+        const struct timespec interval = { 0, kPollInterval * 1000000L };
+        while (!cameras_update()) {
+            nanosleep(&interval, NULL);
+        }
+    }
+    if (!s_headless) {
+        scheduler_setContentTimer(kPollInterval, cameras_update);
+    }
+    return true;
+}
+
+// 連番のファイル名を作るために、書式に整数の変換が1つだけあるか確かめる
+static bool isFramePattern(const char* pattern)
+{
+    int conversions = 0;
+    for (const char* p = strchr(pattern, '%'); p != NULL; p = strchr(p, '%')) {
+        p++;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        p += strspn(p, "0123456789");
+        if (*p != 'd') {
+            return false;
+        }
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+// 1行に1つの視点を "ex ey ez cx cy cz [ux uy uz]" の形式で読み込む。#から行末まではコメント
+static Viewpoint* readCameraPath(const char* filename, int* count)
+{
+    FILE* fp = fopen(filename, "r");
+    if (fp == NULL) {
+        LOG_ERROR("Failed to open file: %s", filename);
+        return NULL;
+    }
+    Viewpoint* path = NULL;
+    int capacity = 0;
+    *count = 0;
+    char* line = NULL;
+    size_t lineCapacity = 0;
+    for (int number = 1; getline(&line, &lineCapacity, fp) != -1; number++) {
+        line[strcspn(line, "#\n")] = '\0';
+        if (line[strspn(line, " \t\r")] == '\0') {
+            continue;
+        }
+        Viewpoint v = { .ux = 0.0, .uy = 1.0, .uz = 0.0 };
+        int n = sscanf(line, "%lf %lf %lf %lf %lf %lf %lf %lf %lf",
+                &v.ex, &v.ey, &v.ez, &v.cx, &v.cy, &v.cz, &v.ux, &v.uy, &v.uz);
+        if (n != 6 && n != 9) {
+            LOG_ERROR("Invalid viewpoint at %s:%d", filename, number);
+            free(line);
+            free(path);
+            fclose(fp);
+            return NULL;
+        }
+        if (*count == capacity) {
+            capacity = (capacity == 0) ? 64 : capacity * 2;
+            Viewpoint* p = realloc(path, sizeof(Viewpoint) * capacity);
+            if (p == NULL) {
+                free(line);
+                free(path);
+                fclose(fp);
+                return NULL;
+            }
+            path = p;
+        }
+        path[(*count)++] = v;
+    }
+    free(line);
+    fclose(fp);
+    if (*count == 0) {
+        LOG_ERROR("No viewpoints in %s", filename);
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+// 描画に使う点群の節点をすべて読み込むまで描画し直す。速度計測では読み込みを待たない
+static void waitForPointCloud(void)
+{
+    const struct timespec interval = { 0, 1000000L };
+    for (int pass = 0; pass < kMaxLoadPasses; pass++) {
+        drawScene();
+        if (!pointcloud_isLoading()) {
+            return;
+        }
+        while (pointcloud_isLoading() && !pointcloud_update()) {
+            nanosleep(&interval, NULL);
+        }
+    }
+    LOG_WARN("Point cloud is still loading after %d passes", kMaxLoadPasses);
+}
+
+static int compareDoubles(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// フレームごとの時間を標準出力にCSVで書き、まとめをログに出す
+static void reportFrames(double elapsed)
+{
+    size_t n;
+    const OffscreenFrame* frames = offscreen_getFrames(&n);
+    if (n == 0) {
+        return;
+    }
+    printf("frame,interval_ms,cpu_ms,gpu_ms,write_ms\n");
+    double* gpuTimes = malloc(sizeof(double) * n);
+    size_t numGpuTimes = 0;
+    for (size_t i = 0; i < n; i++) {
+        const OffscreenFrame* f = &frames[i];
+        printf("%zu,%.3f,%.3f,%.3f,%.3f\n", i, f->interval, f->cpuTime, f->gpuTime, f->writeTime);
+        if (gpuTimes != NULL && f->gpuTime >= 0.0) {
+            gpuTimes[numGpuTimes++] = f->gpuTime;
+        }
+    }
+    const char* primitive = s_hasCameras ? "cameras" : (s_hasPointCloud ? "points" : "triangles");
+    LOG_INFO("%zu frames in %.3f s: %.1f fps, %.3f M%s/s", n, elapsed, n / elapsed,
+            s_benchmarkPrimitives / elapsed / 1000000.0, primitive);
+    if (numGpuTimes > 0) {
+        qsort(gpuTimes, numGpuTimes, sizeof(double), compareDoubles);
+        LOG_INFO("gpu=%.3f ms (median), %.3f ms (95%%), %.3f ms (max)", gpuTimes[numGpuTimes / 2],
+                gpuTimes[(numGpuTimes * 95) / 100], gpuTimes[numGpuTimes - 1]);
+    }
+    free(gpuTimes);
+}
+
+// 視点の経路または視点を1周させる経路に沿って描画し、フレームごとの時間を計測する
+static bool renderOffscreen(const char* pattern, const char* pathFile, int numFrames)
+{
+    Viewpoint* path = NULL;
+    if (pathFile != NULL && (path = readCameraPath(pathFile, &numFrames)) == NULL) {
+        return false;
+    }
+    bool result = true;
+    double start = getTime();
+    for (int i = 0; i < numFrames && result; i++) {
+        if (path != NULL) {
+            s_viewpoint = path[i];
+        } else if (i > 0) {
+            rotate(&s_viewpoint, 2.0 * M_PI / numFrames, 0.0);
+        }
+        if (s_hasPointCloud && !s_benchmark) {
+            waitForPointCloud();
+        }
+        char filename[PATH_MAX];
+        if (pattern != NULL) {
+            snprintf(filename, sizeof(filename), pattern, i);
+        }
+        offscreen_beginFrame();
+        drawScene();
+        result = offscreen_endFrame(pattern != NULL ? filename : NULL);
+    }
+    result = offscreen_flush() && result;
+    reportFrames(getTime() - start);
+    free(path);
+    return result;
+}
+
 int main(int argc, char** argv)
 {
     logger_setLevel(LogLevel_DEBUG);
 
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
-    glutInitWindowPosition(100, 100);
-    glutInitWindowSize(512, 512);
-    glutCreateWindow(argv[0]);
+    // glutInit はウィンドウシステムに接続するので、ウィンドウを開かないときは呼び出さない
+    for (int i = 1; i < argc; i++) {
+        s_headless = s_headless || strcmp(argv[i], "-H") == 0 || strcmp(argv[i], "-o") == 0;
+    }
+    if (!s_headless) {
+        glutInit(&argc, argv);
+    }
+
+    const char* filename = NULL;
+    const char* cameraFile = NULL;
+    const char** poseFiles = calloc(argc, sizeof(char*));
+    int numPoseFiles = 0;
+    int gridSize = 0;
+    const char* pattern = NULL;
+    const char* pathFile = NULL;
+    int numFrames = kBenchmarkFrames;
+    int width = 512, height = 512;
+    const char* logFile = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0) {
+            s_benchmark = true;
+        } else if (strcmp(argv[i], "-H") == 0) {
+            // 先に調べてある
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            pattern = argv[++i];
+            if (!isFramePattern(pattern)) {
+                fprintf(stderr, "%s: output file needs one %%d for the frame number\n", argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            pathFile = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            numFrames = atoi(argv[++i]);
+            if (numFrames <= 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            gridSize = atoi(argv[++i]);
+            if (gridSize <= 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            cameraFile = argv[++i];
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            logFile = argv[++i];
+        } else if (argv[i][0] != '-') {
+            poseFiles[numPoseFiles++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (cameraFile == NULL) {
+        // カメラを描画しないときはモデルを1つだけ指定できる
+        if (numPoseFiles > 1 || (numPoseFiles == 1 && gridSize != 0)) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        filename = (numPoseFiles == 1) ? poseFiles[0] : NULL;
+    } else if (gridSize != 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    // イベントごとのログで描画を待たせない。終了時は onExit のログを出力してから止まる
+    if (logger_startAsync(logFile)) {
+        atexit(logger_stopAsync);
+    } else if (logFile != NULL) {
+        return EXIT_FAILURE;
+    }
+    // ウィンドウを開かないときはティーポットを描画できない
+    if ((s_benchmark || s_headless) && filename == NULL && gridSize == 0 && cameraFile == NULL) {
+        gridSize = 1000;
+    }
+
+    if (s_headless) {
+        if (!offscreen_initialize(width, height)) {
+            return EXIT_FAILURE;
+        }
+        setUpView(width, height);
+    } else {
+        glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
+        glutInitWindowPosition(100, 100);
+        glutInitWindowSize(512, 512);
+        glutCreateWindow(argv[0]);
+    }
 
     init();
+    if (!s_headless) {
+        scheduler_initialize(!s_benchmark); // 速度計測では垂直同期を待たない
+    }
+    bool loaded = (cameraFile != NULL) ? loadCameras(cameraFile, poseFiles, numPoseFiles)
+                                       : loadModel(filename, gridSize);
+    free(poseFiles);
+    if (!loaded) {
+        return EXIT_FAILURE;
+    }
+    if (s_benchmark) {
+        logger_setLevel(LogLevel_INFO); // 描画ごとのログを出さない
+    }
+    atexit(onExit);
+
+    if (s_headless) {
+        return renderOffscreen(pattern, pathFile, numFrames) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    glutIdleFunc(idle);
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
     glutKeyboardFunc(keyboard);
@@ -0,0 +1,847 @@
+#define _DEFAULT_SOURCE
+#define _FILE_OFFSET_BITS 64
+#define GL_GLEXT_PROTOTYPES
+
+#include "mesh.h"
+#include <fcntl.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "logger.h"
+#include "ply.h"
+
+enum
+{
+    kMinSimplifiedTriangles = 20000, // これより少なければ粗い詳細度を作らない
+    kMaxResolution = 256, // 最も細かい粗い詳細度での格子の分割数
+};
+
+// 頂点の位置と法線の読み出し元。PLYの場合はマップした領域を直接参照する
+typedef struct
+{
+    const uint8_t* data;
+    size_t stride;
+    size_t offsets[6]; // x, y, z, nx, ny, nz
+    PlyType types[6];
+    bool hasNormals;
+} VertexSource;
+
+// 開番地法のハッシュ表。キーの0は空きを表す
+typedef struct
+{
+    uint64_t* keys;
+    GLuint* values;
+    size_t capacity, count;
+} HashTable;
+
+// 頂点を格子ごとに最初の頂点へまとめ、縮退と重複を除いた三角形を集める
+typedef struct
+{
+    const VertexSource* vertices;
+    float min[3];
+    float scale; // 座標から格子の番号への倍率
+    int resolution;
+    HashTable cells;     // 格子 → 代表の頂点
+    HashTable triangles; // 三角形のハッシュ値 → 出力した三角形の番号
+    GLuint* indices;
+    size_t numTriangles, capacity;
+    bool failed;
+} Clustering;
+
+// 三角形の書き込み先。法線がない場合は面の法線を頂点ごとに足し合わせる。
+// clustering があれば、書き込む代わりに粗い詳細度の三角形を集める
+typedef struct
+{
+    GLuint* indices;
+    size_t count, capacity; // [三角形]
+    float* normals;
+    const VertexSource* vertices;
+    size_t numVertices;
+    Clustering* clustering;
+} TriangleSink;
+
+typedef void (*TriangleEmitter)(void* arg, TriangleSink* sink);
+
+typedef struct
+{
+    const char* data;
+    size_t size;
+} MappedFile;
+
+static bool mapFile(MappedFile* file, const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        LOG_ERROR("Failed to open file: %s", filename);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        LOG_ERROR("Empty file: %s", filename);
+        close(fd);
+        return false;
+    }
+    file->size = st.st_size;
+    void* data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        LOG_ERROR("Failed to map file: %s", filename);
+        return false;
+    }
+    madvise(data, file->size, MADV_SEQUENTIAL);
+    file->data = data;
+    return true;
+}
+
+static void unmapFile(MappedFile* file)
+{
+    munmap((void*) file->data, file->size);
+}
+
+// list の要素数や頂点の番号を読む。負や大きすぎる値を size_t に変換すると未定義になるので、SIZE_MAX を返して範囲外として扱う
+static size_t readIndex(const uint8_t* p, PlyType type)
+{
+    double value = ply_readValue(p, type);
+    return (value >= 0.0 && value < (double) SIZE_MAX) ? (size_t) value : SIZE_MAX;
+}
+
+// 要素を1つ読み飛ばす。indexProperty 番目の list を三角形に分割した数を triangles に足す。
+// 範囲を越える場合はNULLを返す
+static const uint8_t* skipRecord(const uint8_t* p, const uint8_t* end, const PlyElement* element,
+        int indexProperty, size_t* triangles)
+{
+    for (int i = 0; i < element->numProperties; i++) {
+        const PlyProperty* property = &element->properties[i];
+        if (property->countType == PlyType_NONE) {
+            p += ply_getTypeSize(property->type);
+            continue;
+        }
+        size_t countSize = ply_getTypeSize(property->countType);
+        if (p + countSize > end) {
+            return NULL;
+        }
+        size_t n = readIndex(p, property->countType);
+        size_t size = ply_getTypeSize(property->type);
+        if (n > (size_t) (end - p - countSize) / size) {
+            return NULL;
+        }
+        p += countSize + n * size;
+        if (triangles != NULL && i == indexProperty && n >= 3) {
+            *triangles += n - 2;
+        }
+    }
+    return (p <= end) ? p : NULL;
+}
+
+static void getPosition(const VertexSource* source, size_t index, float position[3])
+{
+    const uint8_t* p = source->data + index * source->stride;
+    for (int i = 0; i < 3; i++) {
+        position[i] = (float) ply_readValue(p + source->offsets[i], source->types[i]);
+    }
+}
+
+static void addClusteredTriangle(Clustering* clustering, GLuint a, GLuint b, GLuint c);
+
+static void emitTriangle(TriangleSink* sink, size_t a, size_t b, size_t c)
+{
+    if (sink->count >= sink->capacity) {
+        return;
+    }
+    // 範囲外の頂点を参照する三角形は縮退させる
+    if (a >= sink->numVertices || b >= sink->numVertices || c >= sink->numVertices) {
+        a = b = c = 0;
+    }
+    if (sink->clustering != NULL) {
+        sink->count++;
+        addClusteredTriangle(sink->clustering, a, b, c);
+        return;
+    }
+    GLuint* indices = &sink->indices[sink->count++ * 3];
+    indices[0] = a;
+    indices[1] = b;
+    indices[2] = c;
+
+    if (sink->normals != NULL) {
+        // 外積の大きさは面積に比例するので、大きい面ほど頂点の法線に強く効く
+        float p0[3], p1[3], p2[3];
+        getPosition(sink->vertices, a, p0);
+        getPosition(sink->vertices, b, p1);
+        getPosition(sink->vertices, c, p2);
+        float u[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        float v[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        float n[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+        size_t vertices[3] = { a, b, c };
+        for (int i = 0; i < 3; i++) {
+            float* normal = &sink->normals[vertices[i] * 3];
+            normal[0] += n[0];
+            normal[1] += n[1];
+            normal[2] += n[2];
+        }
+    }
+}
+
+static GLbyte packNormal(float value)
+{
+    return (GLbyte) lrintf(fmaxf(fminf(value, 1.0f), -1.0f) * 127.0f);
+}
+
+static uint64_t hash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static void releaseHashTable(HashTable* table)
+{
+    free(table->keys);
+    free(table->values);
+    memset(table, 0, sizeof(*table));
+}
+
+// 要素の数が容量の半分を越えないように広げる
+static bool reserveHashTable(HashTable* table)
+{
+    if ((table->count + 1) * 2 <= table->capacity) {
+        return true;
+    }
+    HashTable larger = { .capacity = (table->capacity > 0) ? table->capacity * 2 : 1024 };
+    larger.keys = calloc(larger.capacity, sizeof(uint64_t));
+    larger.values = malloc(sizeof(GLuint) * larger.capacity);
+    if (larger.keys == NULL || larger.values == NULL) {
+        releaseHashTable(&larger);
+        return false;
+    }
+    size_t mask = larger.capacity - 1;
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->keys[i] == 0) {
+            continue;
+        }
+        size_t k = hash(table->keys[i]) & mask;
+        while (larger.keys[k] != 0) {
+            k = (k + 1) & mask;
+        }
+        larger.keys[k] = table->keys[i];
+        larger.values[k] = table->values[i];
+    }
+    larger.count = table->count;
+    releaseHashTable(table);
+    *table = larger;
+    return true;
+}
+
+// 頂点の属する格子の代表の頂点を返す。格子に初めて入った頂点が代表になる
+static GLuint getRepresentative(Clustering* clustering, GLuint vertex)
+{
+    float p[3];
+    getPosition(clustering->vertices, vertex, p);
+    uint64_t key = 0;
+    for (int k = 0; k < 3; k++) {
+        int cell = (int) ((p[k] - clustering->min[k]) * clustering->scale);
+        cell = (cell < 0) ? 0 : (cell >= clustering->resolution ? clustering->resolution - 1 : cell);
+        key = key * clustering->resolution + cell;
+    }
+    key++;
+
+    HashTable* table = &clustering->cells;
+    if (!reserveHashTable(table)) {
+        clustering->failed = true;
+        return vertex;
+    }
+    size_t mask = table->capacity - 1;
+    size_t i = hash(key) & mask;
+    while (table->keys[i] != 0 && table->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    if (table->keys[i] == 0) {
+        table->keys[i] = key;
+        table->values[i] = vertex;
+        table->count++;
+    }
+    return table->values[i];
+}
+
+static void addClusteredTriangle(Clustering* clustering, GLuint a, GLuint b, GLuint c)
+{
+    if (clustering->failed) {
+        return;
+    }
+    a = getRepresentative(clustering, a);
+    b = getRepresentative(clustering, b);
+    c = getRepresentative(clustering, c);
+    if (a == b || b == c || c == a) {
+        return;
+    }
+    // 向きを保ったまま最小の番号が先頭になるように回して、同じ三角形を同じキーにする
+    GLuint triangle[3] = { a, b, c };
+    int first = (a < b) ? (a < c ? 0 : 2) : (b < c ? 1 : 2);
+    GLuint v[3] = { triangle[first], triangle[(first + 1) % 3], triangle[(first + 2) % 3] };
+    uint64_t key = hash(((uint64_t) v[0] << 32 | v[1]) ^ hash(v[2])) | 1;
+
+    HashTable* table = &clustering->triangles;
+    if (!reserveHashTable(table)) {
+        clustering->failed = true;
+        return;
+    }
+    size_t mask = table->capacity - 1;
+    size_t i = hash(key) & mask;
+    for (; table->keys[i] != 0; i = (i + 1) & mask) {
+        const GLuint* other = &clustering->indices[table->values[i] * 3];
+        if (table->keys[i] == key && other[0] == v[0] && other[1] == v[1] && other[2] == v[2]) {
+            return;
+        }
+    }
+    if (clustering->numTriangles >= clustering->capacity) {
+        size_t capacity = (clustering->capacity > 0) ? clustering->capacity * 2 : 4096;
+        GLuint* indices = realloc(clustering->indices, sizeof(GLuint) * 3 * capacity);
+        if (indices == NULL) {
+            clustering->failed = true;
+            return;
+        }
+        clustering->indices = indices;
+        clustering->capacity = capacity;
+    }
+    table->keys[i] = key;
+    table->values[i] = clustering->numTriangles;
+    table->count++;
+    memcpy(&clustering->indices[clustering->numTriangles++ * 3], v, sizeof(v));
+}
+
+// 分割数を半分ずつにしながら、三角形が半分以下に減る詳細度を作成する。
+// 最初の詳細度は元の三角形から、以降は1つ前の詳細度から作る
+static void simplify(Mesh* mesh, const VertexSource* source, const float min[3], float extent,
+        TriangleEmitter emit, void* arg)
+{
+    if (mesh->numTriangles < kMinSimplifiedTriangles) {
+        return;
+    }
+    Clustering levels[MESH_MAX_LEVELS - 1];
+    int numLevels = 0;
+    size_t total = 0;
+    for (int resolution = kMaxResolution; numLevels < MESH_MAX_LEVELS - 1 && resolution >= 16; resolution /= 2) {
+        Clustering* clustering = &levels[numLevels];
+        memset(clustering, 0, sizeof(*clustering));
+        clustering->vertices = source;
+        memcpy(clustering->min, min, sizeof(clustering->min));
+        clustering->scale = resolution / fmaxf(extent, FLT_MIN);
+        clustering->resolution = resolution;
+        if (numLevels == 0) {
+            TriangleSink sink = {
+                .capacity = mesh->numTriangles,
+                .vertices = source,
+                .numVertices = mesh->numVertices,
+                .clustering = clustering,
+            };
+            emit(arg, &sink);
+        } else {
+            const Clustering* previous = &levels[numLevels - 1];
+            for (size_t i = 0; i < previous->numTriangles; i++) {
+                const GLuint* v = &previous->indices[i * 3];
+                addClusteredTriangle(clustering, v[0], v[1], v[2]);
+            }
+        }
+        releaseHashTable(&clustering->cells);
+        releaseHashTable(&clustering->triangles);
+        size_t previousTriangles = (numLevels > 0) ? levels[numLevels - 1].numTriangles : mesh->numTriangles;
+        if (clustering->failed || clustering->numTriangles == 0) {
+            free(clustering->indices);
+            break;
+        }
+        if (clustering->numTriangles * 2 > previousTriangles) {
+            free(clustering->indices); // 減り方が少なければ次の分割数で試す
+            continue;
+        }
+        total += clustering->numTriangles;
+        numLevels++;
+        if (clustering->numTriangles < kMinSimplifiedTriangles) {
+            break;
+        }
+    }
+
+    if (numLevels > 0) {
+        glGenBuffers(1, &mesh->simplifiedBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->simplifiedBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * 3 * total, NULL, GL_STATIC_DRAW);
+    }
+    size_t offset = 0;
+    for (int i = 0; i < numLevels; i++) {
+        size_t size = sizeof(GLuint) * 3 * levels[i].numTriangles;
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, offset, size, levels[i].indices);
+        MeshLevel* level = &mesh->levels[mesh->numLevels++];
+        level->buffer = mesh->simplifiedBuffer;
+        level->offset = offset;
+        level->numTriangles = levels[i].numTriangles;
+        offset += size;
+        free(levels[i].indices);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// 索引を書き込んでから、頂点の位置と法線を書き込む
+static bool build(Mesh* mesh, const VertexSource* source, size_t numVertices, size_t numTriangles,
+        TriangleEmitter emit, void* arg)
+{
+    memset(mesh, 0, sizeof(*mesh));
+    if (numVertices == 0 || numTriangles == 0) {
+        LOG_ERROR("No triangles in mesh");
+        return false;
+    }
+    if (numVertices > UINT32_MAX) {
+        LOG_ERROR("Too many vertices: %zu", numVertices);
+        return false;
+    }
+    float* normals = NULL;
+    if (!source->hasNormals) {
+        normals = calloc(numVertices * 3, sizeof(float));
+        if (normals == NULL) {
+            LOG_ERROR("Failed to allocate normals: %zu vertices", numVertices);
+            return false;
+        }
+    }
+
+    glGenBuffers(1, &mesh->indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * 3 * numTriangles, NULL, GL_STATIC_DRAW);
+    TriangleSink sink = {
+        .indices = glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY),
+        .capacity = numTriangles,
+        .normals = normals,
+        .vertices = source,
+        .numVertices = numVertices,
+    };
+    if (sink.indices == NULL) {
+        LOG_ERROR("Failed to map index buffer: %zu triangles", numTriangles);
+        free(normals);
+        mesh_release(mesh);
+        return false;
+    }
+    emit(arg, &sink);
+    memset(&sink.indices[sink.count * 3], 0, sizeof(GLuint) * 3 * (numTriangles - sink.count));
+    bool result = glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER) == GL_TRUE;
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &mesh->vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(MeshVertex) * numVertices, NULL, GL_STATIC_DRAW);
+    MeshVertex* vertices = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+    float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    if (vertices != NULL) {
+        for (size_t i = 0; i < numVertices; i++) {
+            float p[3], n[3];
+            getPosition(source, i, p);
+            if (normals != NULL) {
+                memcpy(n, &normals[i * 3], sizeof(n));
+            } else {
+                const uint8_t* data = source->data + i * source->stride;
+                for (int k = 0; k < 3; k++) {
+                    n[k] = (float) ply_readValue(data + source->offsets[3 + k], source->types[3 + k]);
+                }
+            }
+            float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            float scale = (length > 0.0f) ? 1.0f / length : 0.0f;
+            MeshVertex* v = &vertices[i];
+            v->x = p[0];
+            v->y = p[1];
+            v->z = p[2];
+            v->nx = packNormal(n[0] * scale);
+            v->ny = packNormal(n[1] * scale);
+            v->nz = packNormal(n[2] * scale);
+            v->pad = 0;
+            for (int k = 0; k < 3; k++) {
+                min[k] = fminf(min[k], p[k]);
+                max[k] = fmaxf(max[k], p[k]);
+            }
+        }
+        result = glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE && result;
+    } else {
+        LOG_ERROR("Failed to map vertex buffer: %zu vertices", numVertices);
+        result = false;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    free(normals);
+    if (!result) {
+        mesh_release(mesh);
+        return false;
+    }
+
+    mesh->numVertices = numVertices;
+    mesh->numTriangles = numTriangles;
+    mesh->levels[0] = (MeshLevel) { mesh->indexBuffer, 0, numTriangles };
+    mesh->numLevels = 1;
+    float diagonal = 0.0f, extent = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        mesh->center[k] = (min[k] + max[k]) * 0.5f;
+        diagonal += (max[k] - min[k]) * (max[k] - min[k]);
+        extent = fmaxf(extent, max[k] - min[k]);
+    }
+    mesh->radius = fmaxf(sqrtf(diagonal) * 0.5f, FLT_MIN);
+    simplify(mesh, source, min, extent, emit, arg);
+    return true;
+}
+
+typedef struct
+{
+    const uint8_t* data;
+    const uint8_t* end;
+    const PlyElement* face;
+    int indexProperty; // 頂点の番号の list の位置
+} PlyFaces;
+
+static void emitPlyFaces(void* arg, TriangleSink* sink)
+{
+    const PlyFaces* faces = arg;
+    const uint8_t* p = faces->data;
+    for (size_t f = 0; f < faces->face->count; f++) {
+        for (int i = 0; i < faces->face->numProperties; i++) {
+            const PlyProperty* property = &faces->face->properties[i];
+            if (property->countType == PlyType_NONE) {
+                p += ply_getTypeSize(property->type);
+                continue;
+            }
+            size_t n = readIndex(p, property->countType); // skipRecord で範囲を確かめてある
+            p += ply_getTypeSize(property->countType);
+            size_t size = ply_getTypeSize(property->type);
+            if (i == faces->indexProperty) {
+                // 多角形は最初の頂点を中心に扇形に分割する
+                size_t first = readIndex(p, property->type);
+                for (size_t k = 1; k + 1 < n; k++) {
+                    emitTriangle(sink, first, readIndex(p + k * size, property->type),
+                            readIndex(p + (k + 1) * size, property->type));
+                }
+            }
+            p += n * size;
+        }
+    }
+}
+
+static bool setUpVertexSource(VertexSource* source, const PlyElement* vertex, const uint8_t* data)
+{
+    static const char* names[6] = { "x", "y", "z", "nx", "ny", "nz" };
+    bool found[6];
+    memset(source, 0, sizeof(*source));
+    for (int k = 0; k < 6; k++) {
+        found[k] = ply_findProperty(vertex, names[k], &source->offsets[k], &source->types[k]);
+    }
+    source->data = data;
+    source->stride = ply_getFixedSize(vertex);
+    source->hasNormals = found[3] && found[4] && found[5];
+    return found[0] && found[1] && found[2];
+}
+
+static bool loadPly(Mesh* mesh, const MappedFile* file)
+{
+    PlyElement elements[PLY_MAX_ELEMENTS];
+    int numElements;
+    const uint8_t* p = ply_parseHeader(file->data, file->size, elements, &numElements);
+    if (p == NULL) {
+        LOG_ERROR("Unsupported PLY header");
+        return false;
+    }
+    const uint8_t* end = (const uint8_t*) file->data + file->size;
+
+    VertexSource source;
+    PlyFaces faces = { .face = NULL, .indexProperty = -1 };
+    size_t numVertices = 0, numTriangles = 0;
+    bool hasVertices = false;
+    for (int e = 0; e < numElements; e++) {
+        const PlyElement* element = &elements[e];
+        size_t fixedSize = ply_getFixedSize(element);
+        bool isVertex = strcmp(element->name, "vertex") == 0;
+        bool isFace = strcmp(element->name, "face") == 0;
+        if (isVertex) {
+            if (fixedSize == 0 || !setUpVertexSource(&source, element, p)) {
+                LOG_ERROR("Unsupported PLY vertex element");
+                return false;
+            }
+            numVertices = element->count;
+            hasVertices = true;
+        }
+        if (isFace) {
+            faces.data = p;
+            faces.face = element;
+            // texcoord などほかの list もあるので、名前の合う list を優先する
+            for (int i = 0; i < element->numProperties; i++) {
+                const PlyProperty* property = &element->properties[i];
+                if (property->countType == PlyType_NONE) {
+                    continue;
+                }
+                if (strcmp(property->name, "vertex_indices") == 0 || strcmp(property->name, "vertex_index") == 0) {
+                    faces.indexProperty = i;
+                    break;
+                }
+                if (faces.indexProperty < 0) {
+                    faces.indexProperty = i;
+                }
+            }
+        }
+        // 大きさの決まった要素はまとめて読み飛ばし、list を含む要素は1つずつたどる
+        if (fixedSize > 0) {
+            if ((size_t) (end - p) / fixedSize < element->count) {
+                LOG_ERROR("PLY data is truncated: %s", element->name);
+                return false;
+            }
+            p += fixedSize * element->count;
+            continue;
+        }
+        for (size_t i = 0; i < element->count && p != NULL; i++) {
+            p = skipRecord(p, end, element, faces.indexProperty, isFace ? &numTriangles : NULL);
+        }
+        if (p == NULL) {
+            LOG_ERROR("PLY data is truncated: %s", element->name);
+            return false;
+        }
+        faces.end = isFace ? p : faces.end;
+    }
+    if (!hasVertices || faces.face == NULL || faces.indexProperty < 0) {
+        LOG_ERROR("PLY file has no vertices or faces");
+        return false;
+    }
+    return build(mesh, &source, numVertices, numTriangles, emitPlyFaces, &faces);
+}
+
+static const char* skipSpaces(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+static const char* findLineEnd(const char* p, const char* end)
+{
+    const char* newline = memchr(p, '\n', end - p);
+    return (newline != NULL) ? newline : end;
+}
+
+// 空白までの数値を読み取る。マップした領域は文字列の終端がないので、一度コピーしてから変換する
+static const char* parseFloat(const char* p, const char* end, float* value)
+{
+    char token[64];
+    size_t length = 0;
+    p = skipSpaces(p, end);
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && length + 1 < sizeof(token)) {
+        token[length++] = *p++;
+    }
+    token[length] = '\0';
+    *value = strtof(token, NULL);
+    return p;
+}
+
+// 面の頂点 "v/vt/vn" の v を読み取る。負の値は直前までの頂点からの相対位置
+static const char* parseFaceVertex(const char* p, const char* end, size_t numVertices, size_t* index, bool* valid)
+{
+    long value = 0;
+    bool negative = false;
+    if (p < end && *p == '-') {
+        negative = true;
+        p++;
+    }
+    *valid = p < end && '0' <= *p && *p <= '9';
+    while (p < end && '0' <= *p && *p <= '9') {
+        int digit = *p++ - '0';
+        if (value > (INT_MAX - digit) / 10) {
+            *valid = false; // 桁が多すぎる番号は使わず、残りの桁を読み飛ばす
+        } else {
+            value = value * 10 + digit;
+        }
+    }
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+        p++; // テクスチャ座標と法線の番号は使わない
+    }
+    *index = negative ? numVertices - value : (size_t) value - 1;
+    return p;
+}
+
+typedef struct
+{
+    const char* data;
+    const char* end;
+} ObjFaces;
+
+static void emitObjFaces(void* arg, TriangleSink* sink)
+{
+    const ObjFaces* faces = arg;
+    size_t numVertices = 0;
+    for (const char* p = faces->data; p < faces->end; ) {
+        const char* lineEnd = findLineEnd(p, faces->end);
+        p = skipSpaces(p, lineEnd);
+        if (lineEnd - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            numVertices++;
+        } else if (lineEnd - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            size_t first = 0, previous = 0;
+            int n = 0;
+            for (p = skipSpaces(p + 1, lineEnd); p < lineEnd; p = skipSpaces(p, lineEnd)) {
+                size_t index;
+                bool valid;
+                p = parseFaceVertex(p, lineEnd, numVertices, &index, &valid);
+                index = valid ? index : SIZE_MAX;
+                if (n == 0) {
+                    first = index;
+                } else if (n >= 2) {
+                    emitTriangle(sink, first, previous, index);
+                }
+                previous = index;
+                n++;
+            }
+        }
+        p = lineEnd + 1;
+    }
+}
+
+static bool loadObj(Mesh* mesh, const MappedFile* file)
+{
+    const char* data = file->data;
+    const char* end = data + file->size;
+
+    // 1回目で頂点と三角形の数を数える
+    size_t numVertices = 0, numTriangles = 0;
+    for (const char* p = data; p < end; ) {
+        const char* lineEnd = findLineEnd(p, end);
+        p = skipSpaces(p, lineEnd);
+        if (lineEnd - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            numVertices++;
+        } else if (lineEnd - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            int n = 0;
+            for (p = skipSpaces(p + 1, lineEnd); p < lineEnd; p = skipSpaces(p, lineEnd), n++) {
+                while (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r') {
+                    p++;
+                }
+            }
+            numTriangles += (n >= 3) ? n - 2 : 0;
+        }
+        p = lineEnd + 1;
+    }
+
+    // 2回目で頂点の位置を読み取る
+    float* positions = malloc(sizeof(float) * 3 * (numVertices > 0 ? numVertices : 1));
+    if (positions == NULL) {
+        LOG_ERROR("Failed to allocate vertices: %zu", numVertices);
+        return false;
+    }
+    size_t index = 0;
+    for (const char* p = data; p < end; ) {
+        const char* lineEnd = findLineEnd(p, end);
+        p = skipSpaces(p, lineEnd);
+        if (lineEnd - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            p++;
+            for (int k = 0; k < 3; k++) {
+                p = parseFloat(p, lineEnd, &positions[index * 3 + k]);
+            }
+            index++;
+        }
+        p = lineEnd + 1;
+    }
+
+    VertexSource source = {
+        .data = (const uint8_t*) positions,
+        .stride = sizeof(float) * 3,
+        .offsets = { 0, sizeof(float), sizeof(float) * 2 },
+        .types = { PlyType_FLOAT32, PlyType_FLOAT32, PlyType_FLOAT32 },
+        .hasNormals = false,
+    };
+    ObjFaces faces = { data, end };
+    bool result = build(mesh, &source, numVertices, numTriangles, emitObjFaces, &faces);
+    free(positions);
+    return result;
+}
+
+bool mesh_load(Mesh* mesh, const char* filename)
+{
+    MappedFile file;
+    if (!mapFile(&file, filename)) {
+        return false;
+    }
+    bool result;
+    if (file.size >= 4 && memcmp(file.data, "ply", 3) == 0 && (file.data[3] == '\n' || file.data[3] == '\r')) {
+        result = loadPly(mesh, &file);
+    } else {
+        result = loadObj(mesh, &file);
+    }
+    unmapFile(&file);
+    if (result) {
+        LOG_INFO("Loaded %s: %zu vertices, %zu triangles, %d levels", filename,
+                mesh->numVertices, mesh->numTriangles, mesh->numLevels);
+    }
+    return result;
+}
+
+typedef struct
+{
+    int size;
+} Grid;
+
+static void emitGrid(void* arg, TriangleSink* sink)
+{
+    int size = ((const Grid*) arg)->size;
+    for (int j = 0; j < size; j++) {
+        for (int i = 0; i < size; i++) {
+            size_t v = (size_t) j * (size + 1) + i;
+            emitTriangle(sink, v, v + size + 1, v + 1);
+            emitTriangle(sink, v + 1, v + size + 1, v + size + 2);
+        }
+    }
+}
+
+bool mesh_createGrid(Mesh* mesh, int size)
+{
+    const float extent = 200.0f;
+    size_t numVertices = (size_t) (size + 1) * (size + 1);
+    float* positions = malloc(sizeof(float) * 3 * numVertices);
+    if (size <= 0 || positions == NULL) {
+        LOG_ERROR("Failed to allocate grid: %d", size);
+        free(positions);
+        return false;
+    }
+    for (int j = 0; j <= size; j++) {
+        for (int i = 0; i <= size; i++) {
+            float* p = &positions[((size_t) j * (size + 1) + i) * 3];
+            p[0] = extent * ((float) i / size - 0.5f);
+            p[2] = extent * ((float) j / size - 0.5f);
+            p[1] = 10.0f * sinf(p[0] * 0.05f) * cosf(p[2] * 0.05f);
+        }
+    }
+    VertexSource source = {
+        .data = (const uint8_t*) positions,
+        .stride = sizeof(float) * 3,
+        .offsets = { 0, sizeof(float), sizeof(float) * 2 },
+        .types = { PlyType_FLOAT32, PlyType_FLOAT32, PlyType_FLOAT32 },
+        .hasNormals = false,
+    };
+    Grid grid = { size };
+    bool result = build(mesh, &source, numVertices, (size_t) size * size * 2, emitGrid, &grid);
+    free(positions);
+    return result;
+}
+
+void mesh_release(Mesh* mesh)
+{
+    if (mesh->vertexBuffer != 0) {
+        glDeleteBuffers(1, &mesh->vertexBuffer);
+    }
+    if (mesh->indexBuffer != 0) {
+        glDeleteBuffers(1, &mesh->indexBuffer);
+    }
+    if (mesh->simplifiedBuffer != 0) {
+        glDeleteBuffers(1, &mesh->simplifiedBuffer);
+    }
+    memset(mesh, 0, sizeof(*mesh));
+}
+
+int mesh_selectLevel(const Mesh* mesh, size_t maxTriangles)
+{
+    for (int i = 0; i < mesh->numLevels; i++) {
+        if (mesh->levels[i].numTriangles <= maxTriangles) {
+            return i;
+        }
+    }
+    return mesh->numLevels - 1;
+}
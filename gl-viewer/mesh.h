@@ -0,0 +1,52 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#if defined __APPLE__ && defined __MACH__
+ #include <GLUT/glut.h>
+#else
+ #include <GL/glut.h>
+#endif // __APPLE__ && __MACH__
+
+// VBOに格納する頂点。法線は符号付き8ビットに正規化して16バイトに収める
+typedef struct
+{
+    GLfloat x, y, z;
+    GLbyte nx, ny, nz, pad;
+} MeshVertex;
+
+#define MESH_MAX_LEVELS 4
+
+// 詳細度ごとの三角形の索引の範囲
+typedef struct
+{
+    GLuint buffer;
+    size_t offset; // [byte]
+    size_t numTriangles;
+} MeshLevel;
+
+typedef struct
+{
+    GLuint vertexBuffer;
+    GLuint indexBuffer;      // 三角形ごとに3つの GLuint
+    GLuint simplifiedBuffer; // 粗い詳細度の索引をまとめたもの
+    size_t numVertices;
+    size_t numTriangles;
+    MeshLevel levels[MESH_MAX_LEVELS]; // 0 は元のメッシュで、番号が大きいほど粗い
+    int numLevels;
+    float center[3]; // 外接球の中心
+    float radius;    // 外接球の半径
+} Mesh;
+
+// バイナリ（リトルエンディアン）のPLYまたはOBJをメモリマップして、VBOへ直接書き込む。
+// 多角形は三角形に分割し、法線がなければ面の法線から求める。
+// 操作中に描画するため、頂点を格子ごとにまとめた粗い詳細度も作成する。OpenGLのコンテキストを作成してから呼び出す
+bool mesh_load(Mesh* mesh, const char* filename);
+// 速度計測用に size x size の四角形を並べた起伏のある格子を作成する
+bool mesh_createGrid(Mesh* mesh, int size);
+void mesh_release(Mesh* mesh);
+// 三角形の数が maxTriangles 以下となる最も細かい詳細度を返す。なければ最も粗い詳細度を返す
+int mesh_selectLevel(const Mesh* mesh, size_t maxTriangles);
+
+#endif /* MESH_H */
@@ -0,0 +1,43 @@
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <stdint.h>
+
+// 点群の八分木のファイル形式。buildoctree で作成し、pointcloud で必要な節点だけを読み込む
+#define OCTREE_MAGIC "GLOCTREE"
+#define OCTREE_VERSION 1
+// 節点ごとに点を間引く格子の分割数。節点の点の間隔は辺の長さをこの値で割ったもの
+#define OCTREE_GRID_SIZE 64
+
+// ファイルの先頭に置く。続いて節点ごとの点、最後に節点の表を置く
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numNodes;
+    uint64_t numPoints;
+    uint64_t nodeOffset; // 節点の表の位置 [byte]
+    double min[3];       // 根の立方体の最小の角
+    double size;         // 根の立方体の辺の長さ
+    double max[3];       // 点の範囲の最大の角
+} OctreeHeader;
+
+// 節点の表は幅優先の順に並べ、兄弟を続けて置く。
+// 親の点は子の点と重ならず、根から順に足し合わせると細かくなる
+typedef struct
+{
+    uint64_t offset;     // 点の位置 [byte]
+    uint32_t numPoints;
+    uint32_t firstChild; // 最初の子の番号
+    uint8_t childMask;   // ビット i が立っていれば i 番目の子がある。i のビット0, 1, 2 が x, y, z の上半分を表す
+    uint8_t pad[7];
+} OctreeNode;
+
+// 根の最小の角からの位置で持ち、そのままVBOに転送する
+typedef struct
+{
+    float x, y, z;
+    uint8_t r, g, b, a;
+} OctreePoint;
+
+#endif /* OCTREE_H */
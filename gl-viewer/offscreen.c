@@ -0,0 +1,320 @@
+#define _POSIX_C_SOURCE 199309L
+#define GL_GLEXT_PROTOTYPES
+
+#include "offscreen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "logger.h"
+
+#if defined __APPLE__ && defined __MACH__
+
+bool offscreen_initialize(int width, int height)
+{
+    LOG_ERROR("Offscreen rendering requires EGL");
+    return false;
+}
+
+void offscreen_finalize(void)
+{
+}
+
+void offscreen_beginFrame(void)
+{
+}
+
+bool offscreen_endFrame(const char* filename)
+{
+    return false;
+}
+
+bool offscreen_flush(void)
+{
+    return true;
+}
+
+const OffscreenFrame* offscreen_getFrames(size_t* count)
+{
+    *count = 0;
+    return NULL;
+}
+
+#else
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+ #define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif // EGL_PLATFORM_SURFACELESS_MESA
+
+// 読み出しを待たずに続けて描画するフレームの数
+enum { kNumBuffers = 3 };
+
+typedef struct
+{
+    GLuint buffer;   // GL_PIXEL_PACK_BUFFER
+    GLuint query;    // GL_TIME_ELAPSED
+    bool pending;    // 読み出しを始めて、まだ結果を受け取っていない
+    size_t frame;    // s_frames の番号
+    char* filename;  // NULLなら書き込まない
+} Slot;
+
+static EGLDisplay s_display = EGL_NO_DISPLAY;
+static EGLSurface s_surface = EGL_NO_SURFACE;
+static EGLContext s_context = EGL_NO_CONTEXT;
+static int s_width, s_height;
+static Slot s_slots[kNumBuffers];
+static int s_slotIndex;
+static bool s_timerQuery;
+static bool s_failed; // 書き込みに失敗したフレームがある
+static double s_frameStart, s_lastEnd = -1.0;
+static OffscreenFrame* s_frames;
+static size_t s_numFrames, s_frameCapacity;
+
+static double getTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0; // [ms]
+}
+
+// Xサーバーがなくても使えるMesaのsurfacelessプラットフォームを優先する
+static EGLDisplay getDisplay(void)
+{
+    const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (extensions != NULL && strstr(extensions, "EGL_MESA_platform_surfaceless") != NULL) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+                (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay != NULL) {
+            EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL)) {
+                return display;
+            }
+        }
+    }
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL)) {
+        return display;
+    }
+    return EGL_NO_DISPLAY;
+}
+
+static bool isTimerQuerySupported(void)
+{
+    const char* version = (const char*) glGetString(GL_VERSION);
+    int major = 0, minor = 0;
+    if (version != NULL && sscanf(version, "%d.%d", &major, &minor) == 2 && (major > 3 || (major == 3 && minor >= 3))) {
+        return true;
+    }
+    const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+    return extensions != NULL && strstr(extensions, "GL_ARB_timer_query") != NULL;
+}
+
+bool offscreen_initialize(int width, int height)
+{
+    s_display = getDisplay();
+    if (s_display == EGL_NO_DISPLAY) {
+        LOG_ERROR("Failed to initialize EGL");
+        return false;
+    }
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE,
+    };
+    const EGLint surfaceAttributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(s_display, configAttributes, &config, 1, &numConfigs) || numConfigs == 0
+            || !eglBindAPI(EGL_OPENGL_API)
+            || (s_surface = eglCreatePbufferSurface(s_display, config, surfaceAttributes)) == EGL_NO_SURFACE
+            || (s_context = eglCreateContext(s_display, config, EGL_NO_CONTEXT, NULL)) == EGL_NO_CONTEXT
+            || !eglMakeCurrent(s_display, s_surface, s_surface, s_context)) {
+        LOG_ERROR("Failed to create EGL pbuffer context: 0x%x", eglGetError());
+        offscreen_finalize();
+        return false;
+    }
+    s_width = width;
+    s_height = height;
+    LOG_INFO("OpenGL %s (%s), %dx%d pbuffer", (const char*) glGetString(GL_VERSION),
+            (const char*) glGetString(GL_RENDERER), width, height);
+
+    s_timerQuery = isTimerQuerySupported();
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    for (int i = 0; i < kNumBuffers; i++) {
+        glGenBuffers(1, &s_slots[i].buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s_slots[i].buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) width * height * 3, NULL, GL_STREAM_READ);
+        if (s_timerQuery) {
+            glGenQueries(1, &s_slots[i].query);
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (s_timerQuery) {
+        // llvmpipe は描画を含む最初の計測だけ誤った時間を返すので、捨てる計測を1回しておく
+        GLuint64 elapsed;
+        glBeginQuery(GL_TIME_ELAPSED, s_slots[0].query);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glEndQuery(GL_TIME_ELAPSED);
+        glGetQueryObjectui64v(s_slots[0].query, GL_QUERY_RESULT, &elapsed);
+    }
+    return true;
+}
+
+void offscreen_finalize(void)
+{
+    if (s_context != EGL_NO_CONTEXT) {
+        for (int i = 0; i < kNumBuffers; i++) {
+            glDeleteBuffers(1, &s_slots[i].buffer);
+            if (s_timerQuery) {
+                glDeleteQueries(1, &s_slots[i].query);
+            }
+            free(s_slots[i].filename);
+        }
+        memset(s_slots, 0, sizeof(s_slots));
+        eglMakeCurrent(s_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(s_display, s_context);
+        s_context = EGL_NO_CONTEXT;
+    }
+    if (s_surface != EGL_NO_SURFACE) {
+        eglDestroySurface(s_display, s_surface);
+        s_surface = EGL_NO_SURFACE;
+    }
+    if (s_display != EGL_NO_DISPLAY) {
+        eglTerminate(s_display);
+        s_display = EGL_NO_DISPLAY;
+    }
+    free(s_frames);
+    s_frames = NULL;
+    s_numFrames = s_frameCapacity = 0;
+    s_slotIndex = 0;
+    s_lastEnd = -1.0;
+    s_failed = false;
+}
+
+// OpenGLの画像は下の行から並んでいるので、上の行から書き込む
+static bool writeImage(const char* filename, const GLubyte* pixels)
+{
+    FILE* fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        LOG_ERROR("Failed to open file: %s", filename);
+        return false;
+    }
+    size_t stride = (size_t) s_width * 3;
+    bool result = fprintf(fp, "P6\n%d %d\n255\n", s_width, s_height) > 0;
+    for (int y = s_height - 1; y >= 0 && result; y--) {
+        result = fwrite(pixels + stride * y, 1, stride, fp) == stride;
+    }
+    result = (fclose(fp) == 0) && result;
+    if (!result) {
+        LOG_ERROR("Failed to write file: %s", filename);
+    }
+    return result;
+}
+
+// リングを一周する間に終わっているはずの転送と計測の結果を受け取る
+static void complete(Slot* slot)
+{
+    OffscreenFrame* frame = &s_frames[slot->frame];
+    if (s_timerQuery) {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(slot->query, GL_QUERY_RESULT, &elapsed);
+        frame->gpuTime = elapsed / 1000000.0;
+    }
+    double start = getTime();
+    if (slot->filename != NULL) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+        const GLubyte* pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if (pixels == NULL || !writeImage(slot->filename, pixels)) {
+            s_failed = true;
+        }
+        if (pixels != NULL) {
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        free(slot->filename);
+        slot->filename = NULL;
+    }
+    frame->writeTime = getTime() - start;
+    slot->pending = false;
+}
+
+void offscreen_beginFrame(void)
+{
+    Slot* slot = &s_slots[s_slotIndex];
+    if (slot->pending) {
+        complete(slot);
+    }
+    s_frameStart = getTime();
+    if (s_timerQuery) {
+        glBeginQuery(GL_TIME_ELAPSED, slot->query);
+    }
+}
+
+bool offscreen_endFrame(const char* filename)
+{
+    if (s_numFrames == s_frameCapacity) {
+        size_t capacity = (s_frameCapacity == 0) ? 256 : s_frameCapacity * 2;
+        OffscreenFrame* frames = realloc(s_frames, sizeof(OffscreenFrame) * capacity);
+        if (frames == NULL) {
+            LOG_ERROR("Failed to allocate frame timings");
+            return false;
+        }
+        s_frames = frames;
+        s_frameCapacity = capacity;
+    }
+    Slot* slot = &s_slots[s_slotIndex];
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+    glReadPixels(0, 0, s_width, s_height, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid*) 0); // PBOへの転送は待たない
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (s_timerQuery) {
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+    glFlush();
+
+    double now = getTime();
+    OffscreenFrame* frame = &s_frames[s_numFrames];
+    frame->interval = (s_lastEnd >= 0.0) ? now - s_lastEnd : 0.0;
+    frame->cpuTime = now - s_frameStart;
+    frame->gpuTime = -1.0;
+    frame->writeTime = 0.0;
+    s_lastEnd = now;
+
+    slot->frame = s_numFrames++;
+    slot->filename = NULL;
+    if (filename != NULL) {
+        slot->filename = malloc(strlen(filename) + 1);
+        if (slot->filename == NULL) {
+            return false;
+        }
+        strcpy(slot->filename, filename);
+    }
+    slot->pending = true;
+    s_slotIndex = (s_slotIndex + 1) % kNumBuffers;
+    return !s_failed;
+}
+
+bool offscreen_flush(void)
+{
+    for (int i = 0; i < kNumBuffers; i++) {
+        Slot* slot = &s_slots[(s_slotIndex + i) % kNumBuffers];
+        if (slot->pending) {
+            complete(slot);
+        }
+    }
+    return !s_failed;
+}
+
+const OffscreenFrame* offscreen_getFrames(size_t* count)
+{
+    *count = s_numFrames;
+    return s_frames;
+}
+
+#endif // __APPLE__ && __MACH__
@@ -0,0 +1,27 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct
+{
+    double interval;  // 前のフレームの終わりからの時間 [ms]
+    double cpuTime;   // 描画の開始から読み出しの開始までの時間 [ms]
+    double gpuTime;   // GPUでの描画と読み出しの時間。計測できなければ負の値 [ms]
+    double writeTime; // PBOの対応付けからファイルの書き込みまでの時間 [ms]
+} OffscreenFrame;
+
+// ウィンドウを開かずにEGLのpbufferに描画するOpenGLのコンテキストを作成し、カレントにする
+bool offscreen_initialize(int width, int height);
+void offscreen_finalize(void);
+void offscreen_beginFrame(void);
+// 描画した画像をPBOのリングに読み出す。filename がNULLでなければ、
+// リングを一周して転送を終えたころにPPM形式で書き込む
+bool offscreen_endFrame(const char* filename);
+// 書き込みを待つフレームをすべて書き込む
+bool offscreen_flush(void);
+// 終えたフレームの計測結果を返す
+const OffscreenFrame* offscreen_getFrames(size_t* count);
+
+#endif /* OFFSCREEN_H */
@@ -0,0 +1,137 @@
+#include "ply.h"
+#include <stdio.h>
+#include "logger.h"
+
+enum { kMaxLineLength = 256 };
+
+static const char* kTypeNames[][2] = {
+    { "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+    { "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" },
+};
+
+static PlyType parseType(const char* name)
+{
+    for (int i = 0; i < (int) (sizeof(kTypeNames) / sizeof(kTypeNames[0])); i++) {
+        if (strcmp(name, kTypeNames[i][0]) == 0 || strcmp(name, kTypeNames[i][1]) == 0) {
+            return (PlyType) (PlyType_INT8 + i);
+        }
+    }
+    return PlyType_NONE;
+}
+
+// 改行までを line に取り出し、次の行の先頭を返す。行が長すぎる場合はNULLを返す
+static const char* readLine(const char* p, const char* end, char* line)
+{
+    size_t length = 0;
+    while (p < end && *p != '\n') {
+        if (length + 1 >= kMaxLineLength) {
+            return NULL;
+        }
+        if (*p != '\r') {
+            line[length++] = *p;
+        }
+        p++;
+    }
+    line[length] = '\0';
+    return (p < end) ? p + 1 : p;
+}
+
+static PlyProperty* addProperty(PlyElement* elements, int numElements)
+{
+    if (numElements == 0 || elements[numElements - 1].numProperties >= PLY_MAX_PROPERTIES) {
+        return NULL;
+    }
+    PlyElement* element = &elements[numElements - 1];
+    return &element->properties[element->numProperties++];
+}
+
+const uint8_t* ply_parseHeader(const char* data, size_t size, PlyElement* elements, int* numElements)
+{
+    const char* p = data;
+    const char* end = data + size;
+    char line[kMaxLineLength];
+    *numElements = 0;
+
+    p = readLine(p, end, line);
+    if (p == NULL || strcmp(line, "ply") != 0) {
+        return NULL;
+    }
+    while (p != NULL && p < end) {
+        p = readLine(p, end, line);
+        if (p == NULL) {
+            break;
+        }
+        char keyword[PLY_MAX_NAME_LENGTH], a[PLY_MAX_NAME_LENGTH], b[PLY_MAX_NAME_LENGTH], c[PLY_MAX_NAME_LENGTH];
+        unsigned long long count;
+        if (strcmp(line, "end_header") == 0) {
+            return (const uint8_t*) p;
+        } else if (sscanf(line, "format %31s", a) == 1) {
+            if (strcmp(a, "binary_little_endian") != 0) {
+                LOG_ERROR("Unsupported PLY format: %s", a);
+                return NULL;
+            }
+        } else if (sscanf(line, "element %31s %llu", a, &count) == 2) {
+            if (*numElements >= PLY_MAX_ELEMENTS) {
+                return NULL;
+            }
+            PlyElement* element = &elements[(*numElements)++];
+            memset(element, 0, sizeof(*element));
+            strcpy(element->name, a);
+            element->count = count;
+        } else if (sscanf(line, "property list %31s %31s %31s", a, b, c) == 3) {
+            PlyProperty* property = addProperty(elements, *numElements);
+            if (property == NULL) {
+                return NULL;
+            }
+            property->countType = parseType(a);
+            property->type = parseType(b);
+            strcpy(property->name, c);
+            if (property->countType == PlyType_NONE || property->type == PlyType_NONE) {
+                return NULL;
+            }
+        } else if (sscanf(line, "property %31s %31s", a, b) == 2) {
+            PlyProperty* property = addProperty(elements, *numElements);
+            if (property == NULL) {
+                return NULL;
+            }
+            property->countType = PlyType_NONE;
+            property->type = parseType(a);
+            strcpy(property->name, b);
+            if (property->type == PlyType_NONE) {
+                return NULL;
+            }
+        } else if (sscanf(line, "%31s", keyword) == 1
+                && strcmp(keyword, "comment") != 0 && strcmp(keyword, "obj_info") != 0) {
+            LOG_ERROR("Unknown PLY header line: %s", line);
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+size_t ply_getFixedSize(const PlyElement* element)
+{
+    size_t size = 0;
+    for (int i = 0; i < element->numProperties; i++) {
+        if (element->properties[i].countType != PlyType_NONE) {
+            return 0;
+        }
+        size += ply_getTypeSize(element->properties[i].type);
+    }
+    return size;
+}
+
+bool ply_findProperty(const PlyElement* element, const char* name, size_t* offset, PlyType* type)
+{
+    size_t position = 0;
+    for (int i = 0; i < element->numProperties; i++) {
+        const PlyProperty* property = &element->properties[i];
+        if (strcmp(property->name, name) == 0 && property->countType == PlyType_NONE) {
+            *offset = position;
+            *type = property->type;
+            return true;
+        }
+        position += ply_getTypeSize(property->type);
+    }
+    return false;
+}
@@ -0,0 +1,86 @@
+#ifndef PLY_H
+#define PLY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PLY_MAX_ELEMENTS 8
+#define PLY_MAX_PROPERTIES 32
+#define PLY_MAX_NAME_LENGTH 32
+
+typedef enum
+{
+    PlyType_NONE,
+    PlyType_INT8,
+    PlyType_UINT8,
+    PlyType_INT16,
+    PlyType_UINT16,
+    PlyType_INT32,
+    PlyType_UINT32,
+    PlyType_FLOAT32,
+    PlyType_FLOAT64,
+} PlyType;
+
+typedef struct
+{
+    char name[PLY_MAX_NAME_LENGTH];
+    PlyType type;      // 値の型。list の場合は要素の型
+    PlyType countType; // list の要素数の型。list でなければ PlyType_NONE
+} PlyProperty;
+
+typedef struct
+{
+    char name[PLY_MAX_NAME_LENGTH];
+    size_t count;
+    PlyProperty properties[PLY_MAX_PROPERTIES];
+    int numProperties;
+} PlyElement;
+
+// バイナリ（リトルエンディアン）のPLYのヘッダを読み取り、データの先頭の位置を返す。
+// 対応していない形式ならNULLを返す
+const uint8_t* ply_parseHeader(const char* data, size_t size, PlyElement* elements, int* numElements);
+// list を含まない要素の1つ分の大きさを返す。list を含む場合は0を返す
+size_t ply_getFixedSize(const PlyElement* element);
+// list を含まない要素の中での property の位置を返す。なければfalseを返す
+bool ply_findProperty(const PlyElement* element, const char* name, size_t* offset, PlyType* type);
+
+static inline size_t ply_getTypeSize(PlyType type)
+{
+    switch (type) {
+        case PlyType_INT8:
+        case PlyType_UINT8:
+            return 1;
+        case PlyType_INT16:
+        case PlyType_UINT16:
+            return 2;
+        case PlyType_INT32:
+        case PlyType_UINT32:
+        case PlyType_FLOAT32:
+            return 4;
+        case PlyType_FLOAT64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+// 頂点ごとに呼び出すのでインライン展開させる
+static inline double ply_readValue(const uint8_t* p, PlyType type)
+{
+    switch (type) {
+        case PlyType_INT8:    { int8_t v;   memcpy(&v, p, sizeof(v)); return v; }
+        case PlyType_UINT8:   { uint8_t v;  memcpy(&v, p, sizeof(v)); return v; }
+        case PlyType_INT16:   { int16_t v;  memcpy(&v, p, sizeof(v)); return v; }
+        case PlyType_UINT16:  { uint16_t v; memcpy(&v, p, sizeof(v)); return v; }
+        case PlyType_INT32:   { int32_t v;  memcpy(&v, p, sizeof(v)); return v; }
+        case PlyType_UINT32:  { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+        case PlyType_FLOAT32: { float v;    memcpy(&v, p, sizeof(v)); return v; }
+        case PlyType_FLOAT64: { double v;   memcpy(&v, p, sizeof(v)); return v; }
+        default:
+            return 0.0;
+    }
+}
+
+#endif /* PLY_H */
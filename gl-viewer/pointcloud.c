@@ -0,0 +1,567 @@
+#define _DEFAULT_SOURCE
+#define _FILE_OFFSET_BITS 64
+#define GL_GLEXT_PROTOTYPES
+
+#include "pointcloud.h"
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined __APPLE__ && defined __MACH__
+ #include <GLUT/glut.h>
+#else
+ #include <GL/glut.h>
+#endif // __APPLE__ && __MACH__
+#include "logger.h"
+#include "octree.h"
+
+enum
+{
+    kMaxRequests = 32,              // 読み込みを待つ節点の数の上限
+    kMaxCompleted = 64,             // 転送を待つ節点の数の上限
+    kMaxUploadPoints = 1 << 20,     // 1フレームで転送する点の数の上限
+    kMaxResidentPoints = 1 << 25,   // VBOに置いておく点の数の目安
+};
+
+static const float kCloudRadius = 100.0f;
+static const float kMaxSpacing = 2.0f; // 画面上の点の間隔がこれより大きければ子をたどる [px]
+static const float kPointSize = 2.0f;
+
+typedef enum
+{
+    NodeState_UNLOADED,
+    NodeState_REQUESTED,
+    NodeState_LOADING,
+    NodeState_LOADED,   // 読み込みを終えて転送を待っている
+    NodeState_RESIDENT,
+    NodeState_FAILED,
+} NodeState;
+
+typedef struct
+{
+    uint64_t offset;
+    uint32_t numPoints;
+    uint32_t firstChild;
+    uint8_t childMask;
+    float min[3], size;      // 根の最小の角からの範囲
+    NodeState state;         // s_mutex で守る
+    OctreePoint* points;     // 読み込んだ点。転送したら解放する
+    GLuint buffer;           // 描画するスレッドだけが使う
+    unsigned long lastUsed;  // 最後に描画したフレーム
+    int prev, next;          // 最近描画した順のリスト
+} Node;
+
+typedef struct
+{
+    int node;
+    float spacing; // 画面上の点の間隔 [px]
+} Candidate;
+
+static Node* s_nodes;
+static int s_numNodes;
+static int s_fd = -1;
+static float s_center[3], s_radius; // 点の範囲の外接球
+
+static pthread_t s_thread;
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+static bool s_running;
+static int s_requests[kMaxRequests]; // 優先度の高い順
+static int s_numRequests, s_nextRequest;
+static int s_completed[kMaxCompleted];
+static int s_numCompleted;
+static bool s_loading; // 読み込むスレッドがファイルを読んでいる
+
+static int s_recentHead = -1, s_recentTail = -1;
+static unsigned long s_frame;
+static Candidate* s_heap;
+static int* s_visible;
+static PointCloudStatistics s_statistics;
+
+static bool readAll(int fd, void* buffer, size_t size, uint64_t offset)
+{
+    uint8_t* p = buffer;
+    while (size > 0) {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static void* loadNodes(void* arg)
+{
+    pthread_mutex_lock(&s_mutex);
+    while (s_running) {
+        // 転送が追いつかないときは、読み込んだ点がメモリにたまらないように待つ
+        if (s_nextRequest >= s_numRequests || s_numCompleted >= kMaxCompleted) {
+            pthread_cond_wait(&s_cond, &s_mutex);
+            continue;
+        }
+        int index = s_requests[s_nextRequest++];
+        Node* node = &s_nodes[index];
+        if (node->state != NodeState_REQUESTED) {
+            continue;
+        }
+        node->state = NodeState_LOADING;
+        s_loading = true;
+        size_t size = sizeof(OctreePoint) * node->numPoints;
+        uint64_t offset = node->offset;
+        pthread_mutex_unlock(&s_mutex);
+
+        OctreePoint* points = malloc(size);
+        bool result = points != NULL && readAll(s_fd, points, size, offset);
+
+        pthread_mutex_lock(&s_mutex);
+        s_loading = false;
+        if (!result) {
+            LOG_ERROR("Failed to read node: %d", index);
+            free(points);
+            node->state = NodeState_FAILED;
+            continue;
+        }
+        node->points = points;
+        node->state = NodeState_LOADED;
+        s_completed[s_numCompleted++] = index;
+    }
+    pthread_mutex_unlock(&s_mutex);
+    return NULL;
+}
+
+static int countBits(uint8_t mask)
+{
+    int count = 0;
+    for (; mask != 0; mask &= mask - 1) {
+        count++;
+    }
+    return count;
+}
+
+bool pointcloud_open(const char* filename)
+{
+    s_fd = open(filename, O_RDONLY);
+    if (s_fd == -1) {
+        LOG_ERROR("Failed to open file: %s", filename);
+        return false;
+    }
+    OctreeHeader header;
+    if (!readAll(s_fd, &header, sizeof(header), 0)
+            || memcmp(header.magic, OCTREE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != OCTREE_VERSION || header.numNodes == 0) {
+        LOG_ERROR("Unsupported octree file: %s", filename);
+        pointcloud_close();
+        return false;
+    }
+    OctreeNode* records = malloc(sizeof(OctreeNode) * header.numNodes);
+    s_nodes = calloc(header.numNodes, sizeof(Node));
+    s_heap = malloc(sizeof(Candidate) * header.numNodes);
+    s_visible = malloc(sizeof(int) * header.numNodes);
+    if (records == NULL || s_nodes == NULL || s_heap == NULL || s_visible == NULL
+            || !readAll(s_fd, records, sizeof(OctreeNode) * header.numNodes, header.nodeOffset)) {
+        LOG_ERROR("Failed to read octree nodes: %s", filename);
+        free(records);
+        pointcloud_close();
+        return false;
+    }
+
+    // 幅優先の順なので、親の範囲から子の範囲を決めていける
+    s_numNodes = header.numNodes;
+    s_nodes[0].size = header.size;
+    for (int i = 0; i < s_numNodes; i++) {
+        Node* node = &s_nodes[i];
+        node->offset = records[i].offset;
+        node->numPoints = records[i].numPoints;
+        node->firstChild = records[i].firstChild;
+        node->childMask = records[i].childMask;
+        node->prev = node->next = -1;
+        if (node->childMask != 0 && (node->firstChild <= (uint32_t) i
+                || node->firstChild + countBits(node->childMask) > (uint32_t) s_numNodes)) {
+            LOG_ERROR("Broken octree node: %d", i);
+            free(records);
+            pointcloud_close();
+            return false;
+        }
+        float half = node->size * 0.5f;
+        for (int k = 0, child = node->firstChild; k < 8; k++) {
+            if (node->childMask & (1 << k)) {
+                Node* c = &s_nodes[child++];
+                c->min[0] = node->min[0] + (k & 1) * half;
+                c->min[1] = node->min[1] + ((k >> 1) & 1) * half;
+                c->min[2] = node->min[2] + ((k >> 2) & 1) * half;
+                c->size = half;
+            }
+        }
+    }
+    free(records);
+
+    float diagonal = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        float extent = (float) (header.max[k] - header.min[k]);
+        s_center[k] = extent * 0.5f;
+        diagonal += extent * extent;
+    }
+    s_radius = fmaxf(sqrtf(diagonal) * 0.5f, 1e-6f);
+    memset(&s_statistics, 0, sizeof(s_statistics));
+    s_statistics.numNodes = s_numNodes;
+    s_statistics.numPoints = header.numPoints;
+
+    s_running = true;
+    if (pthread_create(&s_thread, NULL, loadNodes, NULL) != 0) {
+        LOG_ERROR("Failed to create loader thread");
+        s_running = false;
+        pointcloud_close();
+        return false;
+    }
+    LOG_INFO("Opened %s: %llu points, %d nodes", filename, (unsigned long long) header.numPoints, s_numNodes);
+    return true;
+}
+
+void pointcloud_close(void)
+{
+    if (s_running) {
+        pthread_mutex_lock(&s_mutex);
+        s_running = false;
+        pthread_cond_broadcast(&s_cond);
+        pthread_mutex_unlock(&s_mutex);
+        pthread_join(s_thread, NULL);
+    }
+    for (int i = 0; i < s_numNodes; i++) {
+        if (s_nodes[i].buffer != 0) {
+            glDeleteBuffers(1, &s_nodes[i].buffer);
+        }
+        free(s_nodes[i].points);
+    }
+    free(s_nodes);
+    free(s_heap);
+    free(s_visible);
+    s_nodes = NULL;
+    s_heap = NULL;
+    s_visible = NULL;
+    s_numNodes = 0;
+    s_numRequests = s_nextRequest = s_numCompleted = 0;
+    s_recentHead = s_recentTail = -1;
+    if (s_fd != -1) {
+        close(s_fd);
+        s_fd = -1;
+    }
+}
+
+bool pointcloud_update(void)
+{
+    pthread_mutex_lock(&s_mutex);
+    bool completed = s_numCompleted > 0;
+    pthread_mutex_unlock(&s_mutex);
+    return completed;
+}
+
+bool pointcloud_isLoading(void)
+{
+    pthread_mutex_lock(&s_mutex);
+    bool loading = s_nextRequest < s_numRequests || s_loading || s_numCompleted > 0;
+    pthread_mutex_unlock(&s_mutex);
+    return loading;
+}
+
+const PointCloudStatistics* pointcloud_getStatistics(void)
+{
+    return &s_statistics;
+}
+
+static void detach(int index)
+{
+    Node* node = &s_nodes[index];
+    if (node->prev >= 0) {
+        s_nodes[node->prev].next = node->next;
+    } else {
+        s_recentHead = node->next;
+    }
+    if (node->next >= 0) {
+        s_nodes[node->next].prev = node->prev;
+    } else {
+        s_recentTail = node->prev;
+    }
+    node->prev = node->next = -1;
+}
+
+// 最近描画した順のリストの先頭へ移す
+static void touch(int index)
+{
+    Node* node = &s_nodes[index];
+    if (s_recentHead == index) {
+        node->lastUsed = s_frame;
+        return;
+    }
+    if (node->prev >= 0 || s_recentTail == index) {
+        detach(index);
+    }
+    node->next = s_recentHead;
+    if (s_recentHead >= 0) {
+        s_nodes[s_recentHead].prev = index;
+    }
+    s_recentHead = index;
+    if (s_recentTail < 0) {
+        s_recentTail = index;
+    }
+    node->lastUsed = s_frame;
+}
+
+// 上限を越えた分だけ、しばらく描画していない節点をVBOから追い出す
+static void evict(void)
+{
+    while (s_statistics.residentPoints > kMaxResidentPoints && s_recentTail >= 0) {
+        int index = s_recentTail;
+        Node* node = &s_nodes[index];
+        if (node->lastUsed + 1 >= s_frame) {
+            break; // 直前のフレームで描画した節点は残す
+        }
+        detach(index);
+        glDeleteBuffers(1, &node->buffer);
+        node->buffer = 0;
+        s_statistics.residentNodes--;
+        s_statistics.residentPoints -= node->numPoints;
+        s_statistics.evictedNodes++;
+        pthread_mutex_lock(&s_mutex);
+        node->state = NodeState_UNLOADED;
+        pthread_mutex_unlock(&s_mutex);
+    }
+}
+
+// 読み込みを終えた節点をVBOに転送する。1フレームで転送する量は抑える
+static void upload(void)
+{
+    int indices[kMaxCompleted];
+    int n = 0;
+    size_t points = 0;
+    pthread_mutex_lock(&s_mutex);
+    while (n < s_numCompleted && points < kMaxUploadPoints) {
+        indices[n] = s_completed[n];
+        s_nodes[indices[n]].state = NodeState_RESIDENT;
+        points += s_nodes[indices[n]].numPoints;
+        n++;
+    }
+    s_numCompleted -= n;
+    memmove(s_completed, s_completed + n, sizeof(int) * s_numCompleted);
+    if (n > 0) {
+        pthread_cond_signal(&s_cond);
+    }
+    pthread_mutex_unlock(&s_mutex);
+
+    for (int i = 0; i < n; i++) {
+        Node* node = &s_nodes[indices[i]];
+        glGenBuffers(1, &node->buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, node->buffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(OctreePoint) * node->numPoints, node->points, GL_STATIC_DRAW);
+        free(node->points);
+        node->points = NULL;
+        touch(indices[i]);
+        s_statistics.residentNodes++;
+        s_statistics.residentPoints += node->numPoints;
+        s_statistics.loadedNodes++;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    evict();
+}
+
+// 前の要求のうちまだ読み込んでいないものを取り消し、新しい要求に置き換える
+static void request(const int* indices, int n)
+{
+    pthread_mutex_lock(&s_mutex);
+    for (int i = s_nextRequest; i < s_numRequests; i++) {
+        if (s_nodes[s_requests[i]].state == NodeState_REQUESTED) {
+            s_nodes[s_requests[i]].state = NodeState_UNLOADED;
+        }
+    }
+    s_numRequests = s_nextRequest = 0;
+    for (int i = 0; i < n; i++) {
+        Node* node = &s_nodes[indices[i]];
+        if (node->state == NodeState_UNLOADED) {
+            node->state = NodeState_REQUESTED;
+            s_requests[s_numRequests++] = indices[i];
+        }
+    }
+    if (s_numRequests > 0) {
+        pthread_cond_signal(&s_cond);
+    }
+    pthread_mutex_unlock(&s_mutex);
+}
+
+static void pushCandidate(int* size, int node, float spacing)
+{
+    int i = (*size)++;
+    while (i > 0 && s_heap[(i - 1) / 2].spacing < spacing) {
+        s_heap[i] = s_heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    s_heap[i] = (Candidate) { node, spacing };
+}
+
+static Candidate popCandidate(int* size)
+{
+    Candidate top = s_heap[0];
+    Candidate last = s_heap[--(*size)];
+    int i = 0;
+    for (;;) {
+        int child = i * 2 + 1;
+        if (child >= *size) {
+            break;
+        }
+        if (child + 1 < *size && s_heap[child + 1].spacing > s_heap[child].spacing) {
+            child++;
+        }
+        if (s_heap[child].spacing <= last.spacing) {
+            break;
+        }
+        s_heap[i] = s_heap[child];
+        i = child;
+    }
+    s_heap[i] = last;
+    return top;
+}
+
+typedef struct
+{
+    float planes[6][4];  // 視錐台の平面。内側が正
+    float modelview[16];
+    float pixelScale;    // 視点から距離1での1単位の大きさ [px]
+    bool perspective;
+} View;
+
+static void setUpView(View* view)
+{
+    GLfloat projection[16], m[16];
+    GLint viewport[4];
+    glGetFloatv(GL_MODELVIEW_MATRIX, view->modelview);
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            m[c * 4 + r] = 0.0f;
+            for (int k = 0; k < 4; k++) {
+                m[c * 4 + r] += projection[k * 4 + r] * view->modelview[c * 4 + k];
+            }
+        }
+    }
+    // 列優先の行列の行の和と差から平面を求める
+    for (int i = 0; i < 6; i++) {
+        int row = i / 2;
+        float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+        for (int k = 0; k < 4; k++) {
+            view->planes[i][k] = m[k * 4 + 3] + sign * m[k * 4 + row];
+        }
+    }
+    view->pixelScale = projection[5] * viewport[3] * 0.5f;
+    view->perspective = projection[15] == 0.0f;
+}
+
+static bool isVisible(const View* view, const Node* node)
+{
+    for (int i = 0; i < 6; i++) {
+        const float* p = view->planes[i];
+        float x = node->min[0] + (p[0] > 0.0f ? node->size : 0.0f);
+        float y = node->min[1] + (p[1] > 0.0f ? node->size : 0.0f);
+        float z = node->min[2] + (p[2] > 0.0f ? node->size : 0.0f);
+        if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 節点の点の間隔が画面上で何画素になるかを、節点の中で最も視点に近いところで見積もる
+static float getScreenSpacing(const View* view, const Node* node)
+{
+    const float* m = view->modelview;
+    float half = node->size * 0.5f;
+    float c[3] = { node->min[0] + half, node->min[1] + half, node->min[2] + half };
+    float scale = sqrtf(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+    float spacing = node->size / OCTREE_GRID_SIZE * scale * view->pixelScale;
+    if (!view->perspective) {
+        return spacing;
+    }
+    float e[3];
+    for (int r = 0; r < 3; r++) {
+        e[r] = m[r] * c[0] + m[4 + r] * c[1] + m[8 + r] * c[2] + m[12 + r];
+    }
+    float distance = sqrtf(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]) - half * sqrtf(3.0f) * scale;
+    return spacing / fmaxf(distance, 0.1f);
+}
+
+size_t pointcloud_draw(size_t maxPoints)
+{
+    if (s_numNodes == 0) {
+        return 0;
+    }
+    s_frame++;
+    upload();
+
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    float scale = kCloudRadius / s_radius;
+    glScalef(scale, scale, scale);
+    glTranslatef(-s_center[0], -s_center[1], -s_center[2]);
+    View view;
+    setUpView(&view);
+
+    // 画面上の点の間隔が大きい節点から順に、点の数の上限までたどる。
+    // 親の点は子の点と重ならないので、読み込んでいない子は描画しないだけでよい
+    int heapSize = 0, numVisible = 0, numWanted = 0;
+    int wanted[kMaxRequests];
+    size_t numPoints = 0;
+    if (isVisible(&view, &s_nodes[0])) {
+        pushCandidate(&heapSize, 0, getScreenSpacing(&view, &s_nodes[0]));
+    }
+    while (heapSize > 0) {
+        Candidate candidate = popCandidate(&heapSize);
+        Node* node = &s_nodes[candidate.node];
+        if (node->buffer == 0) {
+            if (numWanted < kMaxRequests) {
+                wanted[numWanted++] = candidate.node;
+            }
+            continue;
+        }
+        if (numPoints + node->numPoints > maxPoints) {
+            break;
+        }
+        numPoints += node->numPoints;
+        s_visible[numVisible++] = candidate.node;
+        touch(candidate.node);
+        if (candidate.spacing <= kMaxSpacing) {
+            continue;
+        }
+        for (int k = 0, child = node->firstChild; k < 8; k++) {
+            if (node->childMask & (1 << k)) {
+                if (isVisible(&view, &s_nodes[child])) {
+                    pushCandidate(&heapSize, child, getScreenSpacing(&view, &s_nodes[child]));
+                }
+                child++;
+            }
+        }
+    }
+    request(wanted, numWanted);
+
+    glPushAttrib(GL_ENABLE_BIT | GL_POINT_BIT);
+    glDisable(GL_LIGHTING);
+    glPointSize(kPointSize);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    for (int i = 0; i < numVisible; i++) {
+        const Node* node = &s_nodes[s_visible[i]];
+        glBindBuffer(GL_ARRAY_BUFFER, node->buffer);
+        glVertexPointer(3, GL_FLOAT, sizeof(OctreePoint), (const GLvoid*) offsetof(OctreePoint, x));
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(OctreePoint), (const GLvoid*) offsetof(OctreePoint, r));
+        glDrawArrays(GL_POINTS, 0, node->numPoints);
+    }
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glPopAttrib();
+    glPopMatrix();
+    return numPoints;
+}
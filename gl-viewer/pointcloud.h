@@ -0,0 +1,31 @@
+#ifndef POINTCLOUD_H
+#define POINTCLOUD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct
+{
+    size_t numNodes;
+    size_t numPoints;
+    size_t residentNodes;  // VBOに載っている節点の数
+    size_t residentPoints;
+    size_t loadedNodes;    // これまでに読み込んだ節点の数
+    size_t evictedNodes;   // これまでに追い出した節点の数
+} PointCloudStatistics;
+
+// buildoctree で作成した八分木を開き、節点を読み込むスレッドを開始する。
+// OpenGLのコンテキストを作成してから呼び出す
+bool pointcloud_open(const char* filename);
+void pointcloud_close(void);
+// 読み込みを終えて転送を待つ節点があればtrueを返す。scheduler_setContentTimer に渡して再描画を要求する
+bool pointcloud_update(void);
+// 要求した節点の読み込みや転送が残っていればtrueを返す
+bool pointcloud_isLoading(void);
+// 視錐台に入る節点を画面上の点の間隔が大きい順にたどり、合わせて maxPoints 以内の点を描画する。
+// 足りない節点は読み込みを要求し、使われていない節点はVBOから追い出す。
+// 点群は外接球が原点を中心とする半径100に収まるように拡大縮小する。描画した点の数を返す
+size_t pointcloud_draw(size_t maxPoints);
+const PointCloudStatistics* pointcloud_getStatistics(void);
+
+#endif /* POINTCLOUD_H */
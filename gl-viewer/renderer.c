@@ -0,0 +1,185 @@
+#define GL_GLEXT_PROTOTYPES
+
+#include "renderer.h"
+#include <stddef.h>
+#include "logger.h"
+
+enum
+{
+    kPositionLocation = 0,
+    kNormalLocation = 1,
+};
+
+static const float kMeshRadius = 100.0f;
+static const GLfloat kSceneAmbient[4] = { 0.2f, 0.2f, 0.2f, 1.0f }; // GL_LIGHT_MODEL_AMBIENT の既定値
+
+// 無限遠の視点 (GL_LIGHT_MODEL_LOCAL_VIEWER が GL_FALSE) での固定機能の計算と同じ
+static const char* kVertexShader =
+    "#version 120\n"
+    "attribute vec3 position;\n"
+    "attribute vec3 normal;\n"
+    "uniform vec4 lightPosition;\n" // 視点座標系
+    "uniform vec4 ambient;\n"       // 環境光の合計と材質の環境光の積
+    "uniform vec4 diffuse;\n"
+    "uniform vec4 specular;\n"
+    "uniform float shininess;\n"
+    "varying vec4 color;\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 eye = gl_ModelViewMatrix * vec4(position, 1.0);\n"
+    "    vec3 n = normalize(gl_NormalMatrix * normal);\n"
+    "    vec3 l = normalize(lightPosition.xyz * eye.w - eye.xyz * lightPosition.w);\n"
+    "    float nl = dot(n, l);\n"
+    "    vec3 h = normalize(l + vec3(0.0, 0.0, 1.0));\n"
+    "    float nh = (nl > 0.0) ? pow(max(dot(n, h), 0.0), shininess) : 0.0;\n"
+    "    color = vec4(ambient.rgb + diffuse.rgb * max(nl, 0.0) + specular.rgb * nh, diffuse.a);\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4(position, 1.0);\n"
+    "}\n";
+
+static const char* kFragmentShader =
+    "#version 120\n"
+    "varying vec4 color;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_FragColor = color;\n"
+    "}\n";
+
+static GLuint s_program;
+static GLint s_lightPosition, s_ambient, s_diffuse, s_specular, s_shininess;
+
+static GLuint compileShader(GLenum type, const char* source)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        LOG_ERROR("Failed to compile shader: %s", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+GLuint renderer_createProgram(const char* vertexSource, const char* fragmentSource,
+        const char* const* attributes, int numAttributes)
+{
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    if (vertexShader == 0 || fragmentShader == 0) {
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        return 0;
+    }
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    for (int i = 0; i < numAttributes; i++) {
+        glBindAttribLocation(program, i, attributes[i]);
+    }
+    glLinkProgram(program);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        LOG_ERROR("Failed to link program: %s", log);
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+bool renderer_initialize(void)
+{
+    static const char* const attributes[] = {
+        [kPositionLocation] = "position",
+        [kNormalLocation] = "normal",
+    };
+    s_program = renderer_createProgram(kVertexShader, kFragmentShader, attributes, 2);
+    if (s_program == 0) {
+        return false;
+    }
+    s_lightPosition = glGetUniformLocation(s_program, "lightPosition");
+    s_ambient = glGetUniformLocation(s_program, "ambient");
+    s_diffuse = glGetUniformLocation(s_program, "diffuse");
+    s_specular = glGetUniformLocation(s_program, "specular");
+    s_shininess = glGetUniformLocation(s_program, "shininess");
+    return true;
+}
+
+void renderer_finalize(void)
+{
+    glDeleteProgram(s_program);
+    s_program = 0;
+}
+
+// 列優先の行列 m で4次元のベクトル v を変換する
+static void transform(const GLfloat m[16], const GLfloat v[4], GLfloat result[4])
+{
+    for (int i = 0; i < 4; i++) {
+        result[i] = m[i] * v[0] + m[4 + i] * v[1] + m[8 + i] * v[2] + m[12 + i] * v[3];
+    }
+}
+
+void renderer_drawMesh(const Mesh* mesh, int level, const Light* light, const Material* material)
+{
+    if (s_program == 0 || level < 0 || level >= mesh->numLevels) {
+        return;
+    }
+    const MeshLevel* l = &mesh->levels[level];
+
+    // glLightfv と同じく、ライトの位置は設定したときのモデルビュー行列で視点座標系に変換する
+    GLfloat modelview[16], lightPosition[4];
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+    transform(modelview, light->position, lightPosition);
+    GLfloat ambient[4], diffuse[4], specular[4];
+    for (int i = 0; i < 4; i++) {
+        ambient[i] = (kSceneAmbient[i] + light->ambient[i]) * material->ambient[i];
+        diffuse[i] = light->diffuse[i] * material->diffuse[i];
+        specular[i] = light->specular[i] * material->specular[i];
+    }
+
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    float scale = kMeshRadius / mesh->radius;
+    glScalef(scale, scale, scale);
+    glTranslatef(-mesh->center[0], -mesh->center[1], -mesh->center[2]);
+
+    glUseProgram(s_program);
+    glUniform4fv(s_lightPosition, 1, lightPosition);
+    glUniform4fv(s_ambient, 1, ambient);
+    glUniform4fv(s_diffuse, 1, diffuse);
+    glUniform4fv(s_specular, 1, specular);
+    glUniform1f(s_shininess, material->shininess[0]);
+
+    // スキャンしたモデルは面の向きがそろっていないことが多いので、両面を描画する
+    GLboolean culling = glIsEnabled(GL_CULL_FACE);
+    glDisable(GL_CULL_FACE);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, l->buffer);
+    glEnableVertexAttribArray(kPositionLocation);
+    glEnableVertexAttribArray(kNormalLocation);
+    glVertexAttribPointer(kPositionLocation, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex),
+            (const GLvoid*) offsetof(MeshVertex, x));
+    glVertexAttribPointer(kNormalLocation, 3, GL_BYTE, GL_TRUE, sizeof(MeshVertex),
+            (const GLvoid*) offsetof(MeshVertex, nx));
+    glDrawElements(GL_TRIANGLES, (GLsizei) (l->numTriangles * 3), GL_UNSIGNED_INT, (const GLvoid*) l->offset);
+    glDisableVertexAttribArray(kNormalLocation);
+    glDisableVertexAttribArray(kPositionLocation);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (culling) {
+        glEnable(GL_CULL_FACE);
+    }
+    glUseProgram(0);
+    glPopMatrix();
+}
@@ -0,0 +1,40 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <stdbool.h>
+#if defined __APPLE__ && defined __MACH__
+ #include <GLUT/glut.h>
+#else
+ #include <GL/glut.h>
+#endif // __APPLE__ && __MACH__
+#include "mesh.h"
+
+typedef struct
+{
+    GLfloat position[4];  // ライトの位置
+    GLfloat ambient[4];   // 環境光
+    GLfloat diffuse[4];   // 拡散光（照明のカラー）
+    GLfloat specular[4];  // 鏡面光
+    GLfloat direction[3]; // スポットの方向
+} Light;
+
+typedef struct
+{
+    GLfloat ambient[4];   // 材質の環境光
+    GLfloat diffuse[4];   // 材質の拡散光
+    GLfloat specular[4];  // 材質の鏡面光
+    GLfloat shininess[1]; // 鏡面係数
+} Material;
+
+// シェーダをコンパイルしてリンクする。attributes[i] の頂点属性を番号 i に割り当てる。失敗したら0を返す
+GLuint renderer_createProgram(const char* vertexSource, const char* fragmentSource,
+        const char* const* attributes, int numAttributes);
+// OpenGLのコンテキストを作成してから呼び出す。シェーダをコンパイルする
+bool renderer_initialize(void);
+void renderer_finalize(void);
+// 固定機能の頂点ごとのライティングと同じ計算をシェーダで行い、メッシュの詳細度 level を1回の呼び出しで描画する。
+// メッシュは外接球が原点を中心とする半径100に収まるように拡大縮小する。
+// ライトの位置は現在のモデルビュー行列で変換する
+void renderer_drawMesh(const Mesh* mesh, int level, const Light* light, const Material* material);
+
+#endif /* RENDERER_H */
@@ -0,0 +1,148 @@
+#define GL_GLEXT_PROTOTYPES
+
+#include "cubemap.h"
+#include <stdio.h>
+#if defined __APPLE__ && defined __MACH__
+ #include <GLUT/glut.h>
+#else
+ #include <GL/glut.h>
+#endif // __APPLE__ && __MACH__
+#include "remap.h"
+
+#ifndef GL_TEXTURE_CUBE_MAP_SEAMLESS
+ #define GL_TEXTURE_CUBE_MAP_SEAMLESS 0x884F
+#endif // GL_TEXTURE_CUBE_MAP_SEAMLESS
+
+static const float kCubeSize = 10.0f; // 描画する立方体の一辺の半分
+
+typedef struct
+{
+    int srcWidth, srcHeight;
+    int faceSize;
+    bool rotated; // 元画像の上下左右が反転している
+} CubeMapping;
+
+static RemapTable s_table;
+static CubeMapping s_mapping;
+
+static GLuint s_texture;
+static int s_faceSize;
+
+// OpenGLのキューブマップの面上の座標 (sc, tc) [-1, 1] に対応する方向を求める
+static void getFaceDirection(int face, double sc, double tc, double d[3])
+{
+    switch (face) {
+        case 0: d[0] =  1.0; d[1] = -tc;  d[2] = -sc;  break; // +X
+        case 1: d[0] = -1.0; d[1] = -tc;  d[2] =  sc;  break; // -X
+        case 2: d[0] =  sc;  d[1] =  1.0; d[2] =  tc;  break; // +Y
+        case 3: d[0] =  sc;  d[1] = -1.0; d[2] = -tc;  break; // -Y
+        case 4: d[0] =  sc;  d[1] = -tc;  d[2] =  1.0; break; // +Z
+        default: d[0] = -sc; d[1] = -tc;  d[2] = -1.0; break; // -Z
+    }
+}
+
+static bool mapToEquirectangular(double x, double y, void* arg, double* u, double* v)
+{
+    const CubeMapping* m = arg;
+    int face = (int) (y / m->faceSize);
+    double d[3];
+    getFaceDirection(face, 2.0 * x / m->faceSize - 1.0, 2.0 * (y - face * m->faceSize) / m->faceSize - 1.0, d);
+    Remap_toEquirectangular(d, m->srcWidth, m->srcHeight, m->rotated, u, v);
+    return true;
+}
+
+bool Cubemap_convert(const IplImage* image, IplImage** faces)
+{
+    bool rotated = image->origin == IPL_ORIGIN_BL;
+    if (s_table.entries == NULL || s_mapping.srcWidth != image->width
+            || s_mapping.srcHeight != image->height || s_mapping.rotated != rotated) {
+        Remap_release(&s_table);
+        s_mapping.srcWidth = image->width;
+        s_mapping.srcHeight = image->height;
+        s_mapping.faceSize = image->width / 4;
+        s_mapping.rotated = rotated;
+        if (s_mapping.faceSize < 1 || !Remap_create(&s_table, s_mapping.faceSize, s_mapping.faceSize * 6,
+                image->width, image->height, mapToEquirectangular, &s_mapping)) {
+            return false;
+        }
+    }
+
+    IplImage* dst = *faces;
+    if (dst == NULL || dst->width != s_table.width || dst->height != s_table.height) {
+        cvReleaseImage(faces);
+        dst = *faces = cvCreateImage(cvSize(s_table.width, s_table.height), IPL_DEPTH_8U, 3);
+    }
+    Remap_apply(&s_table, image, dst);
+    return true;
+}
+
+void Cubemap_initialize(void)
+{
+    glGenTextures(1, &s_texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, s_texture);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // 双線形補間
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // 双線形補間
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS); // 面の境目でも隣の面と補間する（OpenGL 3.2以降）
+    glGetError(); // 対応していない場合のエラーは無視する
+}
+
+void Cubemap_finalize(void)
+{
+    glDeleteTextures(1, &s_texture);
+    Remap_release(&s_table);
+    s_faceSize = 0;
+}
+
+void Cubemap_update(const IplImage* faces)
+{
+    int size = faces->width;
+    glBindTexture(GL_TEXTURE_CUBE_MAP, s_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4); // IplImageの行は4バイト境界に揃えられている
+    for (int i = 0; i < 6; i++) {
+        const char* data = faces->imageData + (size_t) i * size * faces->widthStep;
+        if (size != s_faceSize) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, size, size,
+                    0, GL_BGR_EXT, GL_UNSIGNED_BYTE, data);
+        } else {
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, size, size,
+                    GL_BGR_EXT, GL_UNSIGNED_BYTE, data);
+        }
+    }
+    s_faceSize = size;
+}
+
+void Cubemap_draw(void)
+{
+    static const GLfloat vertices[6][4][3] = {
+        { {  1, -1, -1 }, {  1,  1, -1 }, {  1,  1,  1 }, {  1, -1,  1 } },
+        { { -1, -1, -1 }, { -1, -1,  1 }, { -1,  1,  1 }, { -1,  1, -1 } },
+        { { -1,  1, -1 }, { -1,  1,  1 }, {  1,  1,  1 }, {  1,  1, -1 } },
+        { { -1, -1, -1 }, {  1, -1, -1 }, {  1, -1,  1 }, { -1, -1,  1 } },
+        { { -1, -1,  1 }, {  1, -1,  1 }, {  1,  1,  1 }, { -1,  1,  1 } },
+        { { -1, -1, -1 }, { -1,  1, -1 }, {  1,  1, -1 }, {  1, -1, -1 } },
+    };
+
+    if (s_faceSize == 0) {
+        return;
+    }
+    glMatrixMode(GL_TEXTURE);
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+
+    glEnable(GL_TEXTURE_CUBE_MAP);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, s_texture);
+    // 頂点の方向をそのままテクスチャ座標にする
+    glBegin(GL_QUADS);
+    for (int i = 0; i < 6; i++) {
+        for (int j = 0; j < 4; j++) {
+            const GLfloat* v = vertices[i][j];
+            glTexCoord3fv(v);
+            glVertex3f(kCubeSize * v[0], kCubeSize * v[1], kCubeSize * v[2]);
+        }
+    }
+    glEnd();
+    glDisable(GL_TEXTURE_CUBE_MAP);
+}
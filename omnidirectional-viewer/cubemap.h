@@ -0,0 +1,20 @@
+#ifndef CUBEMAP_H
+#define CUBEMAP_H
+
+#include <stdbool.h>
+#include <opencv/cv.h>
+
+// 正距円筒画像を立方体の6面（+X, -X, +Y, -Y, +Z, -Z の順に縦に並べた画像）に変換する。
+// 面の一辺は元画像の幅の1/4で、赤道付近の解像度は変わらない。
+// 元画像の origin が IPL_ORIGIN_BL の場合は上下左右を反転済みとみなす。
+// *faces は大きさが合えば使い回し、合わなければ作り直す。1つのスレッドから呼び出す
+bool Cubemap_convert(const IplImage* image, IplImage** faces);
+
+// OpenGLのコンテキストを作成してから呼び出す
+void Cubemap_initialize(void);
+void Cubemap_finalize(void);
+void Cubemap_update(const IplImage* faces);
+// 視点を中心とした立方体にキューブマップを貼って描画する
+void Cubemap_draw(void);
+
+#endif /* CUBEMAP_H */
@@ -0,0 +1,243 @@
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+#include "perspective.h"
+
+enum
+{
+    kMaxViews = 1024,
+    kMaxWriters = 16,
+    kMaxLineLength = 256,
+};
+
+typedef struct
+{
+    IplImage* image;
+    char path[PATH_MAX];
+} Output;
+
+static Perspective s_perspectives[kMaxViews];
+static Output s_outputs[kMaxViews];
+static int s_numViews;
+
+static const char* s_outputDir = ".";
+static bool s_dryRun; // 切り出すだけで書き込まない
+
+static int s_nextOutput; // 書き込みスレッドが次に取り出す出力
+static int s_numFrames;
+static double s_extractTime; // [ms]
+
+static double getTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0; // [ms]
+}
+
+static bool addView(const char* text)
+{
+    PerspectiveView view;
+    if (s_numViews >= kMaxViews) {
+        fprintf(stderr, "ERROR: Too many views: %s\n", text);
+        return false;
+    }
+    if (!Perspective_parseView(text, &view)) {
+        return false;
+    }
+    Perspective_initialize(&s_perspectives[s_numViews++], &view);
+    return true;
+}
+
+// 1行に1つの視点を書いたファイルを読み込む。空行と # で始まる行は無視する
+static bool loadViews(const char* filename)
+{
+    FILE* fp = fopen(filename, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Failed to open file: %s\n", filename);
+        return false;
+    }
+    char line[kMaxLineLength];
+    bool result = true;
+    while (result && fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0' && line[0] != '#') {
+            result = addView(line);
+        }
+    }
+    fclose(fp);
+    return result;
+}
+
+static void* writeOutputs(void* arg)
+{
+    for (;;) {
+        int i = __atomic_fetch_add(&s_nextOutput, 1, __ATOMIC_RELAXED);
+        if (i >= s_numViews) {
+            break;
+        }
+        if (!cvSaveImage(s_outputs[i].path, s_outputs[i].image, NULL)) {
+            fprintf(stderr, "ERROR: Failed to write image: %s\n", s_outputs[i].path);
+        }
+    }
+    return NULL;
+}
+
+// JPEGの圧縮は切り出しより重いので、視点ごとに分けて複数のスレッドで書き込む
+static void writeAll(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int numThreads = (cpus > 0) ? (int) cpus : 1;
+    numThreads = (numThreads < kMaxWriters) ? numThreads : kMaxWriters;
+    numThreads = (numThreads < s_numViews) ? numThreads : s_numViews;
+
+    pthread_t threads[kMaxWriters];
+    int started = 0;
+    s_nextOutput = 0;
+    for (int i = 1; i < numThreads; i++, started++) {
+        if (pthread_create(&threads[started], NULL, writeOutputs, NULL) != 0) {
+            break;
+        }
+    }
+    writeOutputs(NULL);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// 1枚の画像をデコードして、すべての視点を切り出す
+static bool extractImage(const char* path)
+{
+    IplImage* image = cvLoadImage(path, CV_LOAD_IMAGE_COLOR);
+    if (image == NULL) {
+        fprintf(stderr, "ERROR: Failed to load image: %s\n", path);
+        return false;
+    }
+
+    // 出力ファイル名は入力ファイル名から拡張子を除いて視点の番号を付ける
+    const char* name = strrchr(path, '/');
+    name = (name != NULL) ? name + 1 : path;
+    const char* ext = strrchr(name, '.');
+    int nameLength = (ext != NULL && ext != name) ? (int) (ext - name) : (int) strlen(name);
+
+    bool result = true;
+    double start = getTime();
+    for (int i = 0; i < s_numViews && result; i++) {
+        result = Perspective_extract(&s_perspectives[i], image, &s_outputs[i].image);
+        snprintf(s_outputs[i].path, sizeof(s_outputs[i].path), "%s/%.*s_%02d.jpg",
+                s_outputDir, nameLength, name, i);
+    }
+    s_extractTime += getTime() - start;
+    cvReleaseImage(&image);
+
+    if (result) {
+        s_numFrames++;
+        if (!s_dryRun) {
+            writeAll();
+        }
+    }
+    return result;
+}
+
+static int filter(const struct dirent* file)
+{
+    if (file->d_name[0] == '.') {
+        return 0;
+    }
+    return 1;
+}
+
+static bool extractDirectory(const char* dir)
+{
+    struct dirent** list;
+    int listSize = scandir(dir, &list, filter, alphasort);
+    if (listSize == -1) {
+        fprintf(stderr, "ERROR: Failed to scan directory: %s\n", dir);
+        return false;
+    }
+    for (int i = 0; i < listSize; i++) {
+        char path[PATH_MAX];
+        if (snprintf(path, sizeof(path), "%s/%s", dir, list[i]->d_name) >= (int) sizeof(path)) {
+            fprintf(stderr, "ERROR: Path too long: %s/%s\n", dir, list[i]->d_name);
+        } else {
+            extractImage(path); // 読めない画像は飛ばす
+        }
+        free(list[i]);
+    }
+    free(list);
+    return true;
+}
+
+static bool isDirectory(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void printStatistics(double totalTime)
+{
+    if (s_numFrames == 0) {
+        return;
+    }
+    int views = s_numFrames * s_numViews;
+    printf("Extracted %d views from %d frames: %.1f views/s (%.1f views/s including decode%s)\n",
+            views, s_numFrames, views * 1000.0 / s_extractTime,
+            views * 1000.0 / totalTime, s_dryRun ? "" : " and encode");
+}
+
+int main(int argc, char** argv)
+{
+    if (argc <= 1) {
+        fprintf(stderr, "usage: %s [-n] [-o <output directory>] (-v <yaw:pitch:fovy:widthxheight>|-l <view file>)... <image|image directory>...\n", argv[0]);
+        return 1;
+    }
+    int i = 1;
+    for (; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0) { // 書き込まずに速度だけを測る
+            s_dryRun = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            s_outputDir = argv[++i];
+        } else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            if (!addView(argv[++i])) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            if (!loadViews(argv[++i])) {
+                return 1;
+            }
+        } else {
+            break;
+        }
+    }
+    if (s_numViews == 0 || i == argc) {
+        fprintf(stderr, "ERROR: No views or no input images\n");
+        return 1;
+    }
+
+    double start = getTime();
+    bool result = true;
+    for (; i < argc; i++) {
+        if (isDirectory(argv[i])) {
+            result = extractDirectory(argv[i]) && result;
+        } else {
+            result = extractImage(argv[i]) && result;
+        }
+    }
+    printStatistics(getTime() - start);
+
+    for (int j = 0; j < s_numViews; j++) {
+        Perspective_release(&s_perspectives[j]);
+        cvReleaseImage(&s_outputs[j].image);
+    }
+    return result ? 0 : 1;
+}
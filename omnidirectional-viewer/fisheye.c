@@ -0,0 +1,196 @@
+#include "fisheye.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "remap.h"
+
+#ifndef M_PI
+ #define M_PI 3.14159265358979323846
+#endif // M_PI
+
+static const double kDefaultFov = 190.0; // [deg]
+static const double kMaxFov = 360.0; // [deg]
+
+// 前のレンズは -y 方向、後ろのレンズは +y 方向を向き、どちらも上方向は +z
+static const double kAxes[2][3] = { { 0.0, -1.0, 0.0 }, { 0.0, 1.0, 0.0 } };
+static const double kRights[2][3] = { { -1.0, 0.0, 0.0 }, { 1.0, 0.0, 0.0 } };
+
+typedef struct
+{
+    const FisheyeLens* lens;
+    int lensIndex;
+    int width, height; // 出力画像の大きさ
+    int srcWidth, srcHeight;
+    bool rotated; // 元画像の上下左右が反転している
+} LensMapping;
+
+static FisheyeParams s_params;
+static bool s_hasParams;
+
+static RemapTable s_tables[2];
+static uint8_t* s_weights; // 前のレンズの重み
+static bool s_rotated;
+
+static double dot(const double a[3], const double b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void setDefaultLenses(FisheyeParams* params, double fov)
+{
+    for (int i = 0; i < 2; i++) {
+        params->lenses[i].cx = (i == 0) ? 0.25 : 0.75;
+        params->lenses[i].cy = 0.5;
+        params->lenses[i].radius = 0.5;
+        params->lenses[i].fov = fov;
+    }
+}
+
+bool Fisheye_parseParams(const char* text, FisheyeParams* params)
+{
+    assert(text != NULL && params != NULL);
+
+    double fov = kDefaultFov;
+    FisheyeLens* l = params->lenses;
+    char rest;
+    int n = sscanf(text, "%lf:%lf,%lf,%lf:%lf,%lf,%lf%c", &fov,
+            &l[0].cx, &l[0].cy, &l[0].radius, &l[1].cx, &l[1].cy, &l[1].radius, &rest);
+    if (n != 1 && n != 7) {
+        fprintf(stderr, "ERROR: Invalid fisheye parameters (fov[:cx,cy,radius:cx,cy,radius]): %s\n", text);
+        return false;
+    }
+    if (!(0.0 < fov && fov < kMaxFov)) {
+        fprintf(stderr, "ERROR: Invalid fisheye field of view: %s\n", text);
+        return false;
+    }
+    if (n == 1) {
+        setDefaultLenses(params, fov);
+        return true;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (l[i].radius <= 0.0) {
+            fprintf(stderr, "ERROR: Invalid fisheye radius: %s\n", text);
+            return false;
+        }
+        l[i].fov = fov;
+    }
+    return true;
+}
+
+void Fisheye_setParams(const FisheyeParams* params)
+{
+    s_params = *params;
+    s_hasParams = true;
+}
+
+static bool mapToFisheye(double x, double y, void* arg, double* u, double* v)
+{
+    const LensMapping* m = arg;
+    double d[3];
+    Remap_fromEquirectangular(x, y, m->width, m->height, d);
+
+    // 等距離射影では、光軸からの角度に比例して円の中心から離れる
+    double c = fmin(fmax(dot(d, kAxes[m->lensIndex]), -1.0), 1.0);
+    double theta = acos(c);
+    double halfFov = m->lens->fov * M_PI / 360.0;
+    if (theta > halfFov) {
+        return false;
+    }
+    double r = m->lens->radius * m->srcHeight * theta / halfFov;
+    double up[3] = { 0.0, 0.0, 1.0 };
+    double dx = dot(d, kRights[m->lensIndex]);
+    double dy = dot(d, up);
+    double s = sqrt(dx * dx + dy * dy);
+    if (s > 0.0) {
+        dx /= s;
+        dy /= s;
+    }
+    *u = m->lens->cx * m->srcWidth + r * dx;
+    *v = m->lens->cy * m->srcHeight - r * dy;
+    if (m->rotated) {
+        *u = m->srcWidth - *u;
+        *v = m->srcHeight - *v;
+    }
+    return true;
+}
+
+// 前のレンズの重みを、視野が重なる範囲で光軸からの角度に応じて1から0へ線形に変える
+static void createWeights(int width, int height)
+{
+    double lo = M_PI - s_params.lenses[1].fov * M_PI / 360.0; // ここまでは後ろのレンズに写らない
+    double hi = s_params.lenses[0].fov * M_PI / 360.0;        // ここから先は前のレンズに写らない
+    if (hi <= lo) { // 重ならない場合は中間で切り替える
+        lo = hi = (lo + hi) / 2.0;
+    }
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            double d[3];
+            Remap_fromEquirectangular(x + 0.5, y + 0.5, width, height, d);
+            double theta = acos(fmin(fmax(dot(d, kAxes[0]), -1.0), 1.0));
+            double w = (hi > lo) ? (hi - theta) / (hi - lo) : (theta <= lo ? 1.0 : 0.0);
+            s_weights[y * width + x] = (uint8_t) lround(fmin(fmax(w, 0.0), 1.0) * kRemapWeightOne);
+        }
+    }
+}
+
+static bool createTables(int srcWidth, int srcHeight, bool rotated)
+{
+    Fisheye_finalize();
+    int width = srcHeight * 2;
+    int height = srcHeight;
+    s_weights = malloc((size_t) width * height);
+    if (s_weights == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate blend weights: %dx%d\n", width, height);
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        LensMapping mapping = {
+            .lens = &s_params.lenses[i], .lensIndex = i,
+            .width = width, .height = height,
+            .srcWidth = srcWidth, .srcHeight = srcHeight,
+            .rotated = rotated,
+        };
+        if (!Remap_create(&s_tables[i], width, height, srcWidth, srcHeight, mapToFisheye, &mapping)) {
+            Fisheye_finalize();
+            return false;
+        }
+    }
+    createWeights(width, height);
+    s_rotated = rotated;
+    return true;
+}
+
+bool Fisheye_convert(const IplImage* image, IplImage** equirect)
+{
+    assert(image != NULL && equirect != NULL);
+
+    if (!s_hasParams) {
+        setDefaultLenses(&s_params, kDefaultFov);
+        s_hasParams = true;
+    }
+    bool rotated = image->origin == IPL_ORIGIN_BL;
+    if (s_weights == NULL || s_tables[0].srcWidth != image->width
+            || s_tables[0].srcHeight != image->height || s_rotated != rotated) {
+        if (!createTables(image->width, image->height, rotated)) {
+            return false;
+        }
+    }
+
+    IplImage* dst = *equirect;
+    if (dst == NULL || dst->width != s_tables[0].width || dst->height != s_tables[0].height) {
+        cvReleaseImage(equirect);
+        dst = *equirect = cvCreateImage(cvSize(s_tables[0].width, s_tables[0].height), IPL_DEPTH_8U, 3);
+    }
+    Remap_blend(&s_tables[0], &s_tables[1], s_weights, image, dst);
+    return true;
+}
+
+void Fisheye_finalize(void)
+{
+    Remap_release(&s_tables[0]);
+    Remap_release(&s_tables[1]);
+    free(s_weights);
+    s_weights = NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef FISHEYE_H
+#define FISHEYE_H
+
+#include <stdbool.h>
+#include <opencv/cv.h>
+
+// 等距離射影の魚眼レンズ。位置と半径はフレームの大きさに対する比で表すので、縮小して読み込んでも変わらない
+typedef struct
+{
+    double cx, cy; // 円の中心（フレームの幅と高さに対する比）
+    double radius; // 円の半径（フレームの高さに対する比）
+    double fov;    // 円の縁までの視野角 [deg]
+} FisheyeLens;
+
+// 前後に向けた2つの魚眼レンズ。前のレンズは正距円筒画像の中央、後ろのレンズは左右の端に写る
+typedef struct
+{
+    FisheyeLens lenses[2];
+} FisheyeParams;
+
+// "fov" または "fov:cx,cy,radius:cx,cy,radius" の形式の文字列を読み取る。
+// 省略した位置と半径は、2つの円を左右に並べたフレームとみなして決める
+bool Fisheye_parseParams(const char* text, FisheyeParams* params);
+void Fisheye_setParams(const FisheyeParams* params);
+// 2つの魚眼画像を並べたフレームを、高さが同じで幅が2倍の正距円筒画像に変換する。
+// 視野が重なる範囲は2つのレンズの画素を混ぜ合わせる。
+// 元画像の origin が IPL_ORIGIN_BL の場合は上下左右を反転済みとみなす。
+// *equirect は大きさが合えば使い回し、合わなければ作り直す。1つのスレッドから呼び出す
+bool Fisheye_convert(const IplImage* image, IplImage** equirect);
+void Fisheye_finalize(void);
+
+#endif /* FISHEYE_H */
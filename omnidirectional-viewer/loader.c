@@ -1,20 +1,87 @@
 #define _SVID_SOURCE
+#define _DEFAULT_SOURCE
 
 #include "loader.h"
 #include <assert.h>
 #include <dirent.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <opencv/highgui.h>
+#include <opencv2/core/version.hpp>
+#include "cubemap.h"
+#include "fisheye.h"
+#include "pack.h"
+#include "watcher.h"
+
+// 先読みする画像の数 + 表示中の画像の数
+enum { kRingSize = 4 + 1 };
 
 static const char kSeparator = '/';
-static const size_t kMaxPathLength = 64;
+static const long kWatchInterval = 5; // 新しいファイルを確認する間隔 [ms]
+
+// OpenCV 3.1 からは cvLoadImage も 1/2, 1/4, 1/8 に縮小してデコードできる。
+// JPEGはDCTの段階で縮小するので、元のサイズでデコードするよりも速い。
+// C のヘッダには定義がないので、imgcodecs.hpp の cv::ImreadModes と同じ値を定義する
+#if CV_MAJOR_VERSION > 3 || (CV_MAJOR_VERSION == 3 && CV_MINOR_VERSION >= 1)
+enum
+{
+    IMREAD_REDUCED_COLOR_2 = 17,
+    IMREAD_REDUCED_COLOR_4 = 33,
+    IMREAD_REDUCED_COLOR_8 = 65,
+};
+static const int kReducedLoadFlags[] = {
+    CV_LOAD_IMAGE_COLOR, IMREAD_REDUCED_COLOR_2, IMREAD_REDUCED_COLOR_4, IMREAD_REDUCED_COLOR_8
+};
+static const int kMaxReduction = 3;
+#else
+static const int kReducedLoadFlags[] = { CV_LOAD_IMAGE_COLOR };
+static const int kMaxReduction = 0; // 縮小のフラグを無視して元のサイズでデコードする
+#endif
+
+static int s_requiredWidth; // 表示に必要な画像の幅 [px]。0の場合は縮小しない
+static int s_imageWidth;    // ヘッダから幅が分からない画像の元の幅の見積もり [px]
 
 static const char* s_dirname;
 static struct dirent** s_list;
 static int s_listSize;
 static int s_listIndex;
 
+// 先読みした画像のリングバッファ。画像の領域は使い回す
+static IplImage* s_ring[kRingSize];
+static int s_ringHead;      // 次に取り出す位置
+static int s_ringCount;     // 取り出せる画像の数
+static int s_ringHeld = -1; // 表示側が使用中の位置
+
+static pthread_t s_thread;
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+static bool s_running;
+static bool s_live; // 新しく書き込まれた画像だけを表示する
+static bool s_flipped; // 画像の上下左右が表示と逆になっているか。読み込み元ごとに決まる
+static bool s_cubemap; // 立方体の6面に変換してから取り出す
+static bool s_fisheye; // 2つの魚眼画像を並べたフレームを正距円筒画像に変換してから取り出す
+static IplImage* s_fisheyeImage; // 魚眼画像から変換した正距円筒画像。さらに立方体の6面に変換する場合に使う
+
+// 動画を表示する場合は画像ごとの再生時刻に合わせて取り出す
+static CvCapture* s_capture;
+static double s_ringTime[kRingSize]; // 各画像の再生時刻 [ms]
+static double s_clockStart = -1.0;   // 再生を始めた時刻 [ms]。負の場合は次に取り出す画像に合わせる
+static double s_clockOffset;         // 再生を始めた時点の再生時刻 [ms]
+static double s_currentTime;         // 表示中の画像の再生時刻 [ms]
+static double s_seekTime = -1.0;     // 移動先の再生時刻 [ms]。負の場合は移動しない
+static unsigned int s_seekCount;     // 移動を要求された回数
+
+// パックファイルを表示する場合はマップした領域を直接参照する
+static bool s_packed;
+static int s_packIndex;
+static IplImage s_packImage;
+static IplImage* s_packFaces; // 正距円筒画像のパックファイルを立方体の6面に変換した画像
+
 static int filter(const struct dirent* file)
 {
     if (file->d_name[0] == '.') {
@@ -23,56 +90,468 @@ static int filter(const struct dirent* file)
     return 1;
 }
 
+static bool getFilePath(char* path, const char* dir, const char* file, size_t n)
+{
+    size_t length = strlen(dir);
+    const char* separator = (length > 0 && dir[length - 1] == kSeparator) ? "" : "/";
+    return snprintf(path, n, "%s%s%s", dir, separator, file) < (int) n;
+}
+
+static unsigned int readBigEndian(const unsigned char* p, int n)
+{
+    unsigned int value = 0;
+    for (int i = 0; i < n; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+// JPEGとPNGのヘッダから画像の幅 [px] を読む。それ以外の形式や読めない場合は0を返す
+static int readImageWidth(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return 0;
+    }
+    int width = 0;
+    unsigned char buf[24];
+    if (fread(buf, 1, 2, fp) == 2 && buf[0] == 0xff && buf[1] == 0xd8) {
+        // SOFマーカーまでセグメントを読み飛ばす
+        while (fread(buf, 1, 4, fp) == 4 && buf[0] == 0xff) {
+            int marker = buf[1];
+            long length = readBigEndian(buf + 2, 2);
+            bool sof = marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+            if (sof) {
+                if (fread(buf, 1, 5, fp) == 5) {
+                    width = readBigEndian(buf + 3, 2);
+                }
+                break;
+            }
+            if (marker == 0xda || length < 2 || fseek(fp, length - 2, SEEK_CUR) != 0) {
+                break;
+            }
+        }
+    } else if (fread(buf + 2, 1, 22, fp) == 22 && memcmp(buf, "\x89PNG\r\n\x1a\n", 8) == 0
+            && memcmp(buf + 12, "IHDR", 4) == 0) {
+        width = (int) readBigEndian(buf + 16, 4);
+    }
+    fclose(fp);
+    return (width > 0) ? width : 0;
+}
+
+static IplImage* loadImage(const char* file)
+{
+    char path[PATH_MAX];
+    if (!getFilePath(path, s_dirname, file, sizeof(path))) {
+        fprintf(stderr, "ERROR: Path too long: %s/%s\n", s_dirname, file);
+        return NULL;
+    }
+
+    // 表示に必要な幅を下回らない範囲で縮小する。
+    // 元の幅はヘッダから読み、読めない形式では直前に元のサイズで読み込んだ画像と同じとみなす
+    int requiredWidth = __atomic_load_n(&s_requiredWidth, __ATOMIC_RELAXED);
+    int headerWidth = (requiredWidth > 0 && kMaxReduction > 0) ? readImageWidth(path) : 0;
+    int sourceWidth = (headerWidth > 0) ? headerWidth : s_imageWidth;
+    int reduction = 0;
+    if (requiredWidth > 0 && sourceWidth > 0) {
+        while (reduction < kMaxReduction && (sourceWidth >> (reduction + 1)) >= requiredWidth) {
+            reduction++;
+        }
+    }
+
+    IplImage* image = cvLoadImage(path, kReducedLoadFlags[reduction]);
+    if (image == NULL) {
+        fprintf(stderr, "ERROR: Failed to load image: %s\n", path);
+        return NULL;
+    }
+    // 要求した倍率で縮小されたとは限らないので、元の幅はデコードした幅から推測しない
+    if (headerWidth > 0) {
+        s_imageWidth = headerWidth;
+    } else if (reduction == 0) {
+        s_imageWidth = image->width;
+    }
+    return image;
+}
+
+// 画像をリングバッファの領域へ書き込む
+static bool copyImage(int slot, const IplImage* image)
+{
+    if (s_fisheye) {
+        if (!Fisheye_convert(image, s_cubemap ? &s_fisheyeImage : &s_ring[slot])) {
+            return false;
+        }
+        if (!s_cubemap) {
+            return true;
+        }
+        image = s_fisheyeImage;
+    }
+    if (s_cubemap) {
+        return Cubemap_convert(image, &s_ring[slot]);
+    }
+    IplImage* dst = s_ring[slot];
+    if (dst == NULL || dst->width != image->width || dst->height != image->height) {
+        cvReleaseImage(&s_ring[slot]);
+        dst = s_ring[slot] = cvCreateImage(cvSize(image->width, image->height), IPL_DEPTH_8U, 3);
+    }
+    cvCopy(image, dst, NULL);
+    return true;
+}
+
+// デコードした画像をそのままリングバッファに格納する
+static bool storeImage(int slot, IplImage* image)
+{
+    if (s_cubemap || s_fisheye) {
+        bool result = copyImage(slot, image);
+        cvReleaseImage(&image);
+        return result;
+    }
+    cvReleaseImage(&s_ring[slot]);
+    s_ring[slot] = image;
+    return true;
+}
+
+static void* prefetch(void* arg)
+{
+    int failures = 0;
+
+    pthread_mutex_lock(&s_mutex);
+    while (s_running) {
+        // 空きがなければ表示側が取り出すまで待つ
+        if (s_ringCount + (s_ringHeld >= 0) >= kRingSize) {
+            pthread_cond_wait(&s_cond, &s_mutex);
+            continue;
+        }
+        int slot = (s_ringHead + s_ringCount) % kRingSize;
+        pthread_mutex_unlock(&s_mutex);
+
+        if (s_listIndex >= s_listSize) {
+            s_listIndex = 0;
+        }
+        IplImage* image = loadImage(s_list[s_listIndex++]->d_name);
+        bool loaded = image != NULL && storeImage(slot, image);
+        if (loaded) {
+            failures = 0;
+        }
+
+        pthread_mutex_lock(&s_mutex);
+        if (loaded) {
+            s_ringCount++;
+        } else if (++failures >= s_listSize) {
+            fprintf(stderr, "ERROR: No loadable image in directory: %s\n", s_dirname);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_mutex);
+    return NULL;
+}
+
+// 新しく書き込まれた画像のうち最新のものを読み込み続ける
+static void* follow(void* arg)
+{
+    char name[NAME_MAX + 1];
+
+    while (__atomic_load_n(&s_running, __ATOMIC_RELAXED)) {
+        if (!Watcher_takeNewest(name, sizeof(name))) {
+            struct timespec ts = { 0, kWatchInterval * 1000000 };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+
+        pthread_mutex_lock(&s_mutex);
+        // 空きがなければ、まだ表示されていない最新の画像を新しい画像で置き換える
+        if (s_ringCount + (s_ringHeld >= 0) >= kRingSize) {
+            s_ringCount--;
+        }
+        int slot = (s_ringHead + s_ringCount) % kRingSize;
+        pthread_mutex_unlock(&s_mutex);
+
+        IplImage* image = loadImage(name);
+        if (image != NULL && storeImage(slot, image)) {
+            pthread_mutex_lock(&s_mutex);
+            s_ringCount++;
+            pthread_mutex_unlock(&s_mutex);
+        }
+    }
+    return NULL;
+}
+
+static double getTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0; // [ms]
+}
+
+// 動画をデコードし続ける。最後まで再生したら先頭に戻る
+static void* decode(void* arg)
+{
+    double fps = cvGetCaptureProperty(s_capture, CV_CAP_PROP_FPS);
+    double interval = (fps > 0.0) ? 1000.0 / fps : 40.0; // [ms]
+    double loopOffset = 0.0; // 先頭に戻った分だけ再生時刻を進める
+    double lastTime = -HUGE_VAL;
+    bool rewound = false;
+    bool oriented = false; // 画像の向きは最初の画像で判定する
+
+    pthread_mutex_lock(&s_mutex);
+    while (s_running) {
+        if (s_seekTime >= 0.0) {
+            double target = fmax(s_seekTime - loopOffset, 0.0);
+            s_seekTime = -1.0;
+            pthread_mutex_unlock(&s_mutex);
+            cvSetCaptureProperty(s_capture, CV_CAP_PROP_POS_MSEC, target);
+            lastTime = -HUGE_VAL;
+            pthread_mutex_lock(&s_mutex);
+            continue;
+        }
+        // 空きがなければ表示側が取り出すまで待つ
+        if (s_ringCount + (s_ringHeld >= 0) >= kRingSize) {
+            pthread_cond_wait(&s_cond, &s_mutex);
+            continue;
+        }
+        int slot = (s_ringHead + s_ringCount) % kRingSize;
+        unsigned int seekCount = s_seekCount;
+        pthread_mutex_unlock(&s_mutex);
+
+        IplImage* frame = cvQueryFrame(s_capture); // 画像の領域はキャプチャが所有する
+        if (frame == NULL) {
+            if (rewound) {
+                fprintf(stderr, "ERROR: No decodable frame in video\n");
+                pthread_mutex_lock(&s_mutex);
+                break;
+            }
+            loopOffset = lastTime + interval;
+            cvSetCaptureProperty(s_capture, CV_CAP_PROP_POS_FRAMES, 0.0);
+            rewound = true;
+            pthread_mutex_lock(&s_mutex);
+            continue;
+        }
+        if (!oriented) {
+            __atomic_store_n(&s_flipped, frame->origin == IPL_ORIGIN_TL, __ATOMIC_RELAXED);
+            oriented = true;
+        }
+        rewound = false;
+        double time = cvGetCaptureProperty(s_capture, CV_CAP_PROP_POS_MSEC) + loopOffset;
+        if (time <= lastTime) { // 再生時刻が取得できない形式では一定間隔とみなす
+            time = lastTime + interval;
+        }
+        lastTime = time;
+        bool stored = copyImage(slot, frame);
+
+        pthread_mutex_lock(&s_mutex);
+        // デコード中に再生位置が移動した場合は捨てる
+        if (stored && seekCount == s_seekCount) {
+            s_ringTime[slot] = time;
+            s_ringCount++;
+        }
+    }
+    pthread_mutex_unlock(&s_mutex);
+    return NULL;
+}
+
+static bool startThread(void* (*routine)(void*))
+{
+    s_running = true;
+    if (pthread_create(&s_thread, NULL, routine, NULL) != 0) {
+        fprintf(stderr, "ERROR: Failed to create prefetch thread\n");
+        s_running = false;
+        return false;
+    }
+    return true;
+}
+
+static bool isDirectory(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
 bool Loader_initialize(const char* dir)
 {
     assert(dir != NULL);
 
+    if (Pack_isPackFile(dir)) {
+        s_packed = Pack_open(dir);
+        s_packIndex = 0;
+        s_flipped = false; // パックファイルは反転済み
+        return s_packed;
+    }
+    // ディレクトリでなければ動画として読み込む
+    if (!isDirectory(dir)) {
+        s_capture = cvCaptureFromFile(dir);
+        if (s_capture == NULL) {
+            fprintf(stderr, "ERROR: Failed to open video: %s\n", dir);
+            return false;
+        }
+        return startThread(decode);
+    }
+
     s_dirname = dir;
+    s_flipped = true; // cvLoadImage は常に左上を原点とした画像を返す
     s_listSize = scandir(s_dirname, &s_list, filter, alphasort);
     if (s_listSize == -1) {
         fprintf(stderr, "ERROR: Failed to scan directory: %s\n", s_dirname);
         return false;
     }
+    if (s_listSize == 0) {
+        return true;
+    }
+    return startThread(prefetch);
+}
+
+bool Loader_initializeLive(const char* dir)
+{
+    assert(dir != NULL);
+
+    // ディレクトリ内の既存の画像は読み込まないので、ファイル数によらずすぐに開始できる
+    s_dirname = dir;
+    s_live = true;
+    s_flipped = true;
+    if (!Watcher_initialize(dir)) {
+        return false;
+    }
+    if (!startThread(follow)) {
+        Watcher_finalize();
+        return false;
+    }
     return true;
 }
 
 void Loader_finalize(void)
 {
+    if (s_packed) {
+        Pack_close();
+        cvReleaseImage(&s_packFaces);
+        s_packed = false;
+        return;
+    }
+
+    pthread_mutex_lock(&s_mutex);
+    bool running = s_running;
+    s_running = false;
+    pthread_cond_broadcast(&s_cond);
+    pthread_mutex_unlock(&s_mutex);
+    if (running) {
+        pthread_join(s_thread, NULL);
+    }
+    if (s_live) {
+        Watcher_finalize();
+        s_live = false;
+    }
+    if (s_capture != NULL) {
+        cvReleaseCapture(&s_capture);
+    }
+
+    for (int i = 0; i < kRingSize; i++) {
+        cvReleaseImage(&s_ring[i]);
+    }
+    cvReleaseImage(&s_fisheyeImage);
+    Fisheye_finalize();
     for (int i = 0; i < s_listSize; i++) {
         free(s_list[i]);
     }
     free(s_list);
 }
 
-static void getFilePath(char* path, const char* dir, const char* file, size_t n)
+// 再生時刻を過ぎた画像のうち最新のものまでの数を求める。まだ表示する時刻でなければ-1を返す
+static int getVideoSkip(void)
 {
-    strncat(path, dir, n);
-    if (path[strlen(path) - 1] != kSeparator) {
-        strncat(path, &kSeparator, n);
+    double now = getTime();
+    if (s_clockStart < 0.0) {
+        s_clockStart = now;
+        s_clockOffset = s_ringTime[s_ringHead];
+    }
+    double time = now - s_clockStart + s_clockOffset;
+    int skip = -1;
+    while (skip + 1 < s_ringCount && s_ringTime[(s_ringHead + skip + 1) % kRingSize] <= time) {
+        skip++;
     }
-    strncat(path, file, n);
+    return skip;
 }
 
-IplImage* Loader_loadImage(void)
+const IplImage* Loader_loadImage(void)
 {
-    if (s_listIndex >= s_listSize) {
-        s_listIndex = 0;
+    if (s_packed) {
+        Pack_getFrame(s_packIndex, &s_packImage);
+        s_packIndex = (s_packIndex + 1) % Pack_getFrameCount();
+        // 立方体の6面を格納したパックファイルでなければ、ここで変換する
+        if (s_cubemap && !Pack_isCubemap()) {
+            return Cubemap_convert(&s_packImage, &s_packFaces) ? s_packFaces : NULL;
+        }
+        return &s_packImage;
     }
 
-    char path[kMaxPathLength];
-    memset(path, 0, kMaxPathLength);
-    getFilePath(path, s_dirname, s_list[s_listIndex]->d_name, kMaxPathLength);
+    const IplImage* image = NULL;
 
-    IplImage* image = cvLoadImage(path, CV_LOAD_IMAGE_COLOR);
-    if (image == NULL) {
-        fprintf(stderr, "ERROR: Failed to load image: %s\n", path);
-        return NULL;
+    pthread_mutex_lock(&s_mutex);
+    // 前回取り出した画像の領域を返却する
+    s_ringHeld = -1;
+    if (s_ringCount > 0) {
+        // 新しい画像だけを表示する場合は、表示が間に合わなかった画像を捨てる
+        int skip = s_live ? s_ringCount - 1 : 0;
+        if (s_capture != NULL) {
+            skip = getVideoSkip();
+        }
+        if (skip >= 0) {
+            s_ringHeld = (s_ringHead + skip) % kRingSize;
+            s_ringHead = (s_ringHeld + 1) % kRingSize;
+            s_ringCount -= skip + 1;
+            s_currentTime = s_ringTime[s_ringHeld];
+            image = s_ring[s_ringHeld];
+        }
     }
-    // 上下が逆のときは反転させる
-    if (image->origin == 0) {
-        cvFlip(image, image, -1);
+    pthread_cond_signal(&s_cond);
+    pthread_mutex_unlock(&s_mutex);
+    return image;
+}
+
+bool Loader_isFlipped(void)
+{
+    // 立方体の6面はテクスチャに転送する向きで作成する。魚眼画像からは左上を原点とした画像に変換する
+    if (Loader_isCubemap()) {
+        return false;
     }
+    return (s_fisheye && !s_packed) || __atomic_load_n(&s_flipped, __ATOMIC_RELAXED);
+}
 
-    s_listIndex++;
-    return image;
+void Loader_setCubemap(bool cubemap)
+{
+    s_cubemap = cubemap;
+}
+
+void Loader_setFisheye(const FisheyeParams* params)
+{
+    s_fisheye = params != NULL;
+    if (params != NULL) {
+        Fisheye_setParams(params);
+    }
+}
+
+bool Loader_isCubemap(void)
+{
+    return s_cubemap || (s_packed && Pack_isCubemap());
+}
+
+void Loader_setViewport(int height, double fovy)
+{
+    // 球の中心から見たとき、正距円筒画像の1周分が画面上で占める幅
+    double width = M_PI * height / tan(fovy * M_PI / 360.0);
+    __atomic_store_n(&s_requiredWidth, (int) ceil(width), __ATOMIC_RELAXED);
+}
+
+bool Loader_isVideo(void)
+{
+    return s_capture != NULL;
+}
+
+void Loader_seek(double offset)
+{
+    pthread_mutex_lock(&s_mutex);
+    if (s_capture != NULL) {
+        s_seekTime = fmax(s_currentTime + offset, 0.0);
+        s_seekCount++;
+        s_ringCount = 0;
+        s_clockStart = -1.0;
+        pthread_cond_signal(&s_cond);
+    }
+    pthread_mutex_unlock(&s_mutex);
 }
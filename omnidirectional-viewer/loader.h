@@ -3,9 +3,31 @@
 
 #include <stdbool.h>
 #include <opencv/cv.h>
+#include "fisheye.h"
 
+// 正距円筒画像を立方体の6面（Cubemap_convert の形式）に変換してから取り出すかを設定する。
+// 初期化の前に呼び出す
+void Loader_setCubemap(bool cubemap);
+// 画像ディレクトリと動画のフレームを、2つの魚眼画像を並べたものとして正距円筒画像に変換する。
+// NULLの場合は変換しない。パックファイルには適用しない。初期化の前に呼び出す
+void Loader_setFisheye(const FisheyeParams* params);
+// dir には画像ディレクトリ、パックファイルまたは動画ファイルを指定する
 bool Loader_initialize(const char* dir);
+// ディレクトリに新しく書き込まれた画像を、書き込まれるたびに表示する
+bool Loader_initializeLive(const char* dir);
 void Loader_finalize(void);
-IplImage* Loader_loadImage(void);
+// 先読みした次の画像を取り出す。先読みが間に合っていなければ待たずにNULLを返す。
+// 返した画像は次に呼び出すまで有効
+const IplImage* Loader_loadImage(void);
+// 取り出す画像の上下左右が表示と逆になっているか。テクスチャ座標を反転させて表示する
+bool Loader_isFlipped(void);
+// 取り出す画像が立方体の6面かどうか。立方体の6面を格納したパックファイルの場合もtrueを返す
+bool Loader_isCubemap(void);
+// 表示領域の高さ [px] と縦の視野角 [deg] を設定する。画像はこの表示に足りる大きさまで縮小して読み込む
+void Loader_setViewport(int height, double fovy);
+// 動画ファイルを読み込んでいるか
+bool Loader_isVideo(void);
+// 動画の再生位置を offset [ms] だけ移動する。動画以外では何もしない
+void Loader_seek(double offset);
 
 #endif /* LOADER_H */
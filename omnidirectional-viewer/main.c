@@ -1,6 +1,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 #if defined __APPLE__ && defined __MACH__
@@ -8,13 +9,24 @@
 #else
  #include <GL/glut.h>
 #endif // __APPLE__ && __MACH__
+#include "cubemap.h"
+#include "fisheye.h"
 #include "loader.h"
+#include "pack.h"
+#include "scheduler.h"
+#include "sphere.h"
+#include "texture.h"
+#include "tiles.h"
 
 #ifndef M_PI
  #define M_PI 3.14159265358979323846
 #endif // M_PI
 
-static const unsigned int kTimerPeriod = 100; // [ms]
+static const double kDefaultFrameRate = 10.0; // 画像を切り替える頻度の初期値 [fps]
+static const unsigned int kVideoPollPeriod = 5; // 動画の次の画像の再生時刻を確認する間隔 [ms]
+static const double kSeekStep = 10000.0; // 矢印キーで移動する再生時間 [ms]
+static const double kZoomStep = 5.0; // 1回のズームで変える視野角 [deg]
+static const double kMinFovy = 10.0, kMaxFovy = 120.0; // [deg]
 
 typedef struct
 {
@@ -36,8 +48,13 @@ static Viewpoint viewpoint = {
 };
 static MouseButton leftButton;
 
-static GLuint displayList;
-static GLuint texture;
+static bool mipmap;
+static bool live;
+static double fovy = 90.0; // 縦の視野角 [deg]
+static bool tiled; // タイルファイルを表示する
+static bool cubemap; // 立方体の6面に変換して表示する
+static double frameRate = kDefaultFrameRate; // 画像を切り替える頻度 [fps]。表示の頻度とは別に決める
+static bool tilesComplete; // 見えている範囲のタイルがすべて揃っている
 
 static void setViewpoint(const Viewpoint* v)
 {
@@ -75,56 +92,89 @@ static void setUpView(int width, int height)
     glViewport(0, 0, width, height); // ビューポートの設定
 
     // 透視投影
-    gluPerspective(90.0, // x-z平面の視野角
+    gluPerspective(fovy, // x-z平面の視野角
                    (float) width / height, // 視野角の縦横比
                    1.0,    // 前方クリップ面と視点間の距離
                    100.0); // 後方クリップ面と視点間の距離
+
+    Loader_setViewport(height, fovy);
 }
 
-static void updateTexture(const IplImage* img, bool mipmap)
+static void zoom(double step)
 {
-    if (mipmap) { // Mipmapの場合は画像サイズの制限はない
-        gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGB, img->width, img->height,
-                GL_BGR_EXT, GL_UNSIGNED_BYTE, img->imageData);
-    } else { // 画像サイズは2のn乗でなければならない
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, img->width, img->height,
-                0, GL_BGR_EXT, GL_UNSIGNED_BYTE, img->imageData);
-    }
+    fovy = fmax(fmin(fovy - step, kMaxFovy), kMinFovy);
+    setUpView(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+    scheduler_invalidate();
 }
 
-static void callDisplayListWithTexture()
+static void drawSphereWithTexture(void)
 {
     glPushMatrix();
     glEnable(GL_ALPHA_TEST);
     glEnable(GL_TEXTURE_2D);
-    glCallList(displayList);
+    Texture_bind();
+
+    // 画像を反転させずに転送しているので、テクスチャ座標の方を反転させる
+    glMatrixMode(GL_TEXTURE);
+    glLoadIdentity();
+    if (Loader_isFlipped()) {
+        glTranslatef(1.0f, 1.0f, 0.0f);
+        glScalef(-1.0f, -1.0f, 1.0f);
+    }
+    glMatrixMode(GL_MODELVIEW);
+
+    const Viewpoint* v = &viewpoint;
+    Sphere_draw(v->cx - v->ex, v->cy - v->ey, v->cz - v->ez,
+            fovy, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
     glDisable(GL_TEXTURE_2D);
     glDisable(GL_ALPHA_TEST);
     glPopMatrix();
 }
 
+// 次の画像が読み込めていればテクスチャへ転送する。読み込めていなければ前の画像を表示し続ける
+static bool updateContent(void)
+{
+    if (tiled) {
+        return !tilesComplete; // タイルが揃うまで描画し直す
+    }
+    const IplImage* image = Loader_loadImage();
+    if (image == NULL) {
+        return !Loader_isCubemap() && Texture_flush(); // 1つ前の画像の転送中に書き込んだ最新の画像
+    }
+    if (Loader_isCubemap()) {
+        Cubemap_update(image);
+    } else {
+        Texture_update(image);
+    }
+    return true;
+}
+
 static void display()
 {
+    scheduler_beginFrame();
     glMatrixMode(GL_MODELVIEW); // 現在の行列をモデルビュー変換行列に変更する
     glLoadIdentity(); // 変換行列を単位行列に初期化する
 
     clearBuffer();
     setViewpoint(&viewpoint);
 
-    IplImage* image = Loader_loadImage();
-    if (image == NULL) {
-        exit(EXIT_FAILURE);
+    if (tiled) {
+        const Viewpoint* v = &viewpoint;
+        tilesComplete = Tiles_draw(v->cx - v->ex, v->cy - v->ey, v->cz - v->ez,
+                fovy, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+    } else if (Loader_isCubemap()) {
+        Cubemap_draw();
+    } else {
+        drawSphereWithTexture();
     }
-    updateTexture(image, false);
-    cvReleaseImage(&image);
-    callDisplayListWithTexture();
 
-    glutSwapBuffers(); // ダブルバッファリングのためのバッファの交換
+    scheduler_endFrame();
 }
 
 static void reshape(int width, int height)
 {
     setUpView(width, height);
+    scheduler_invalidate();
 }
 
 static void keyboard(unsigned char key, int x, int y)
@@ -137,6 +187,27 @@ static void keyboard(unsigned char key, int x, int y)
         case ' ':
             glutFullScreen();
             break;
+
+        case '+':
+            zoom(kZoomStep);
+            break;
+
+        case '-':
+            zoom(-kZoomStep);
+            break;
+    }
+}
+
+static void specialKey(int key, int x, int y)
+{
+    switch (key) {
+        case GLUT_KEY_LEFT:
+            Loader_seek(-kSeekStep);
+            break;
+
+        case GLUT_KEY_RIGHT:
+            Loader_seek(kSeekStep);
+            break;
     }
 }
 
@@ -170,74 +241,113 @@ static void mouseDrag(int x, int y)
         rotate(&viewpoint, theta, phi);
         leftButton.x = x;
         leftButton.y = y;
+        scheduler_invalidate();
     }
 }
 
-static void timer(int value)
+static bool init(void)
 {
-    glutPostRedisplay();
-    glutTimerFunc(kTimerPeriod, timer, 0);
+    scheduler_initialize(true);
+    Cubemap_initialize();
+    return Sphere_initialize() && Texture_initialize(mipmap);
 }
 
-static void initDisplayList(void)
+static void printStatistics(void)
 {
-    displayList = glGenLists(1);
-    glNewList(displayList, GL_COMPILE);
-
-    GLUquadricObj* sphere = gluNewQuadric();
-    gluQuadricNormals(sphere, GLU_SMOOTH); // 面の法線を生成するか、する場合は頂点ごとにひとつの法線を生成するのか、または面ごとに作成するのかを定義
-    gluQuadricTexture(sphere, GL_TRUE); // テクスチャ座標をを生成するかを定義
-    gluQuadricDrawStyle(sphere, GLU_FILL); // 四辺形を多角形、線、または点の集合として描くかを定義
-
-    // 球を描画(オブジェクト, 半径, 経線方向の分割数, 緯線方向の分割数)
-    gluSphere(sphere, 50.0, 32, 32);
-
-    // 円柱の描画(オブジェクト, 底面の半径, 上面の半径, 高さ, 経線方向の分割数, 緯線方向の分割数)
-    //gluCylinder(sphere, 2.0, 2.0, 10.0, 64, 64);
-    //glTranslatef(0.0, 0.0, -5.0);
-
-    gluDeleteQuadric(sphere);
-
-    glEndList();
-}
+    const SchedulerStatistics* frames = scheduler_getStatistics();
+    if (frames->frames > 0) {
+        printf("Drew %lu frames (vsync %s): CPU average %.3f ms, max %.3f ms\n", frames->frames,
+                frames->swapInterval > 0 ? "on" : "off",
+                frames->cpuTime / frames->frames, frames->maxCpuTime);
+    }
+    if (frames->gpuFrames > 0) {
+        printf("GPU average %.3f ms, max %.3f ms\n",
+                frames->gpuTime / frames->gpuFrames, frames->maxGpuTime);
+    }
+    if (frames->intervals > 0) {
+        double mean = frames->intervalTime / frames->intervals;
+        double variance = frames->intervalSquareTime / frames->intervals - mean * mean;
+        printf("Frame interval average %.3f ms, jitter %.3f ms, max %.3f ms\n",
+                mean, sqrt(fmax(variance, 0.0)), frames->maxInterval);
+    }
 
-static void initTexture(void)
-{
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 4); // テクスチャがRGBAで表現されていることをOpenGLに伝える
-    glGenTextures(1, &texture); // テクスチャの数を指定
-    glBindTexture(GL_TEXTURE_2D, texture); // テクスチャの作成と使用
-
-    // テクスチャを拡大・縮小する方法の指定
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST); // 最近傍法
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // 最近傍法
-    //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // 双線形補間
-    //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // 双線形補間
-
-    // テクスチャの繰り返しの指定
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP); // s軸方向の繰り返しを行わない
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP); // t軸方向の繰り返しを行わない
+    const TextureStatistics* stats = Texture_getStatistics();
+    if (stats->frames == 0) {
+        return;
+    }
+    printf("Uploaded %lu frames (%.1f MB) %s: CPU average %.3f ms, max %.3f ms\n",
+            stats->frames, stats->bytes / (1024.0 * 1024.0),
+            stats->pixelBuffer ? "via pixel buffers" : "directly",
+            stats->totalTime / stats->frames, stats->maxTime);
+    if (stats->gpuFrames > 0) {
+        printf("Upload GPU average %.3f ms, max %.3f ms\n",
+                stats->gpuTime / stats->gpuFrames, stats->maxGpuTime);
+    }
 }
 
-static void init(void)
+static void finalize(void)
 {
-    initDisplayList();
-    initTexture();
+    if (tiled) {
+        Tiles_close();
+    } else {
+        Loader_finalize();
+    }
 }
 
 static void onExit(void)
 {
-    glDeleteTextures(1, &texture);
-    Loader_finalize();
+    printStatistics();
+    Texture_finalize();
+    Sphere_finalize();
+    Cubemap_finalize();
+    scheduler_finalize();
+    finalize();
 }
 
 int main(int argc, char** argv)
 {
     if (argc <= 1) {
-        fprintf(stderr, "usage: %s [options] <image directory>\n", argv[0]);
+        fprintf(stderr, "usage: %s [-m] [-w] [-c] [-r <fps>] [-f <fov[:cx,cy,radius:cx,cy,radius]>] <image directory|pack file|video file>\n", argv[0]);
+        fprintf(stderr, "       %s [-m] <tile file>\n", argv[0]);
+        fprintf(stderr, "       %s [-c] -p <pack file> <image directory>\n", argv[0]);
+        fprintf(stderr, "       %s -t <tile file> <panorama image>\n", argv[0]);
         return 1;
     }
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "-m") == 0) { // Mipmapを使って縮小表示を滑らかにする
+            mipmap = true;
+        } else if (strcmp(argv[i], "-c") == 0) { // キューブマップで表示する
+            cubemap = true;
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc - 1) { // 2つの魚眼画像を並べたフレームを変換して表示する
+            FisheyeParams params;
+            if (!Fisheye_parseParams(argv[++i], &params)) {
+                return 1;
+            }
+            Loader_setFisheye(&params);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc - 1) { // 画像を切り替える頻度 [fps]
+            frameRate = atof(argv[++i]);
+            if (frameRate <= 0.0) {
+                fprintf(stderr, "ERROR: Invalid frame rate: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-w") == 0) { // 新しく書き込まれた画像を表示し続ける
+            live = true;
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc - 1) { // パックファイルを作成して終了する
+            return Pack_create(argv[i + 1], argv[argc - 1], cubemap) ? 0 : 1;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc - 1) { // タイルファイルを作成して終了する
+            return Tiles_create(argv[i + 1], argv[argc - 1]) ? 0 : 1;
+        }
+    }
     const char* dirname = argv[argc - 1];
-    Loader_initialize(dirname);
+    tiled = Tiles_isTileFile(dirname);
+    Loader_setCubemap(cubemap);
+    if (tiled) {
+        if (!Tiles_open(dirname)) {
+            return 1;
+        }
+    } else if (!(live ? Loader_initializeLive(dirname) : Loader_initialize(dirname))) {
+        return 1;
+    }
 
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
@@ -245,15 +355,21 @@ int main(int argc, char** argv)
     glutInitWindowSize(640, 480);
     glutCreateWindow("Omnidirectional Viewer");
 
+    if (!init()) {
+        finalize();
+        return 1;
+    }
     atexit(onExit);
-    init();
 
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
     glutKeyboardFunc(keyboard);
+    glutSpecialFunc(specialKey);
     glutMouseFunc(mouseClick);
     glutMotionFunc(mouseDrag);
-    glutTimerFunc(kTimerPeriod, timer, 0);
+    // 動画は画像ごとの再生時刻に合わせて取り出すので、短い間隔で確認する
+    unsigned int period = (!tiled && Loader_isVideo()) ? kVideoPollPeriod : (unsigned int) (1000.0 / frameRate);
+    scheduler_setContentTimer(period, updateContent);
 
     glutMainLoop();
     return 0;
@@ -0,0 +1,251 @@
+#define _DEFAULT_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "pack.h"
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <opencv/highgui.h>
+#include "cubemap.h"
+
+static const char kMagic[8] = { 'O', 'M', 'N', 'I', 'P', 'A', 'C', 'K' };
+static const size_t kHeaderSize = 32;
+static const size_t kPageSize = 4096; // フレームを揃える境界
+static const int kReadAhead = 2; // 先読みを依頼するフレーム数
+
+typedef struct
+{
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t widthStep;
+    uint32_t count;
+    uint32_t layout;
+    uint32_t reserved;
+} PackHeader;
+
+enum
+{
+    kLayoutEquirectangular = 0,
+    kLayoutCubemap = 1,
+};
+
+static void* s_data = MAP_FAILED;
+static size_t s_dataSize;
+static PackHeader s_header;
+static const uint64_t* s_offsets;
+
+static int filter(const struct dirent* file)
+{
+    if (file->d_name[0] == '.') {
+        return 0;
+    }
+    return 1;
+}
+
+static size_t alignToPage(size_t size)
+{
+    return (size + kPageSize - 1) / kPageSize * kPageSize;
+}
+
+static bool writeAt(int fd, const void* buf, size_t size, off_t offset)
+{
+    return pwrite(fd, buf, size, offset) == (ssize_t) size;
+}
+
+// 書き込む形式に変換する。正距円筒画像は上下左右を反転させる
+static IplImage* convertFrame(const IplImage* image, bool cubemap)
+{
+    IplImage* frame = NULL;
+    if (cubemap) {
+        if (!Cubemap_convert(image, &frame)) {
+            cvReleaseImage(&frame);
+        }
+        return frame;
+    }
+    frame = cvCreateImage(cvSize(image->width, image->height), IPL_DEPTH_8U, 3);
+    if (image->origin == 0) {
+        cvFlip(image, frame, -1);
+    } else {
+        cvCopy(image, frame, NULL);
+    }
+    return frame;
+}
+
+bool Pack_create(const char* filename, const char* dir, bool cubemap)
+{
+    assert(filename != NULL && dir != NULL);
+
+    struct dirent** list;
+    int listSize = scandir(dir, &list, filter, alphasort);
+    if (listSize == -1) {
+        fprintf(stderr, "ERROR: Failed to scan directory: %s\n", dir);
+        return false;
+    }
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "ERROR: Failed to open file: %s\n", filename);
+        for (int i = 0; i < listSize; i++) {
+            free(list[i]);
+        }
+        free(list);
+        return false;
+    }
+
+    PackHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.layout = cubemap ? kLayoutCubemap : kLayoutEquirectangular;
+    uint64_t* offsets = calloc(listSize > 0 ? listSize : 1, sizeof(uint64_t));
+    off_t offset = alignToPage(kHeaderSize + sizeof(uint64_t) * listSize);
+    bool result = true;
+
+    for (int i = 0; i < listSize && result; i++) {
+        char path[PATH_MAX];
+        if (snprintf(path, sizeof(path), "%s/%s", dir, list[i]->d_name) >= (int) sizeof(path)) {
+            fprintf(stderr, "ERROR: Path too long: %s/%s\n", dir, list[i]->d_name);
+            continue;
+        }
+        IplImage* image = cvLoadImage(path, CV_LOAD_IMAGE_COLOR);
+        IplImage* frame = (image != NULL) ? convertFrame(image, cubemap) : NULL;
+        cvReleaseImage(&image);
+        if (frame == NULL) {
+            fprintf(stderr, "ERROR: Failed to load image: %s\n", path);
+            continue;
+        }
+        if (header.count == 0) {
+            header.width = frame->width;
+            header.height = frame->height;
+            header.widthStep = frame->widthStep;
+        }
+        if ((uint32_t) frame->width != header.width || (uint32_t) frame->height != header.height) {
+            fprintf(stderr, "ERROR: Image size differs from the first image: %s\n", path);
+        } else if (writeAt(fd, frame->imageData, frame->imageSize, offset)) {
+            offsets[header.count++] = offset;
+            offset += alignToPage(frame->imageSize);
+        } else {
+            fprintf(stderr, "ERROR: Failed to write file: %s\n", filename);
+            result = false;
+        }
+        cvReleaseImage(&frame);
+    }
+
+    // ヘッダと索引はフレーム数が確定してから書き込む
+    if (result) {
+        result = writeAt(fd, &header, sizeof(header), 0)
+                && writeAt(fd, offsets, sizeof(uint64_t) * header.count, kHeaderSize)
+                && ftruncate(fd, offset) == 0;
+        if (result) {
+            printf("Packed %u frames (%ux%u) into %s\n", header.count, header.width, header.height, filename);
+        }
+    }
+    close(fd);
+    free(offsets);
+    for (int i = 0; i < listSize; i++) {
+        free(list[i]);
+    }
+    free(list);
+    return result && header.count > 0;
+}
+
+bool Pack_isPackFile(const char* filename)
+{
+    char magic[sizeof(kMagic)];
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    bool result = fread(magic, 1, sizeof(magic), fp) == sizeof(magic)
+            && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+    fclose(fp);
+    return result;
+}
+
+bool Pack_open(const char* filename)
+{
+    assert(filename != NULL);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "ERROR: Failed to open file: %s\n", filename);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < kHeaderSize) {
+        fprintf(stderr, "ERROR: Not a pack file: %s\n", filename);
+        close(fd);
+        return false;
+    }
+    s_dataSize = st.st_size;
+    s_data = mmap(NULL, s_dataSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s_data == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Failed to map file: %s\n", filename);
+        return false;
+    }
+
+    memcpy(&s_header, s_data, sizeof(s_header));
+    s_offsets = (const uint64_t*) ((const char*) s_data + kHeaderSize);
+    size_t frameSize = (size_t) s_header.widthStep * s_header.height;
+    bool valid = memcmp(s_header.magic, kMagic, sizeof(kMagic)) == 0
+            && s_header.count > 0
+            && s_header.layout <= kLayoutCubemap
+            && s_header.widthStep >= s_header.width * 3
+            && kHeaderSize + sizeof(uint64_t) * s_header.count <= s_dataSize;
+    for (uint32_t i = 0; valid && i < s_header.count; i++) {
+        valid = s_offsets[i] % kPageSize == 0 && s_offsets[i] + frameSize <= s_dataSize;
+    }
+    if (!valid) {
+        fprintf(stderr, "ERROR: Not a pack file: %s\n", filename);
+        Pack_close();
+        return false;
+    }
+    madvise(s_data, s_dataSize, MADV_SEQUENTIAL);
+    return true;
+}
+
+void Pack_close(void)
+{
+    if (s_data != MAP_FAILED) {
+        munmap(s_data, s_dataSize);
+        s_data = MAP_FAILED;
+    }
+    s_dataSize = 0;
+    s_offsets = NULL;
+    memset(&s_header, 0, sizeof(s_header));
+}
+
+bool Pack_isCubemap(void)
+{
+    return s_header.layout == kLayoutCubemap;
+}
+
+int Pack_getFrameCount(void)
+{
+    return s_header.count;
+}
+
+void Pack_getFrame(int index, IplImage* image)
+{
+    assert(0 <= index && index < (int) s_header.count);
+
+    size_t frameSize = (size_t) s_header.widthStep * s_header.height;
+    for (int i = 1; i <= kReadAhead; i++) {
+        int next = (index + i) % s_header.count;
+        madvise((char*) s_data + s_offsets[next], frameSize, MADV_WILLNEED);
+    }
+
+    // 正距円筒画像は反転済みであることを IPL_ORIGIN_BL で表す
+    int origin = Pack_isCubemap() ? IPL_ORIGIN_TL : IPL_ORIGIN_BL;
+    cvInitImageHeader(image, cvSize(s_header.width, s_header.height), IPL_DEPTH_8U, 3, origin, 4);
+    image->widthStep = s_header.widthStep;
+    image->imageSize = frameSize;
+    image->imageData = (char*) s_data + s_offsets[index];
+}
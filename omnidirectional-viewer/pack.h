@@ -0,0 +1,35 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdbool.h>
+#include <opencv/cv.h>
+
+//
+// パックファイルの形式（リトルエンディアン）
+//
+//   char     magic[8]          "OMNIPACK"
+//   uint32_t width             画像の幅
+//   uint32_t height            画像の高さ
+//   uint32_t widthStep         1行のバイト数（4バイト境界）
+//   uint32_t count             フレーム数
+//   uint32_t layout            0: 正距円筒画像、1: 立方体の6面を縦に並べた画像
+//   uint32_t reserved
+//   uint64_t offsets[count]    各フレームの先頭位置（ページ境界）
+//   uint8_t  frames[][height * widthStep]
+//
+// フレームはBGR画像で、そのままテクスチャへ転送できる。正距円筒画像は上下左右を反転済み。
+//
+
+// ディレクトリ内の画像をデコードしてパックファイルに書き込む。cubemap の場合は立方体の6面に変換する
+bool Pack_create(const char* filename, const char* dir, bool cubemap);
+// パックファイルかどうかをマジックナンバーで判定する
+bool Pack_isPackFile(const char* filename);
+
+bool Pack_open(const char* filename);
+void Pack_close(void);
+bool Pack_isCubemap(void);
+int Pack_getFrameCount(void);
+// image をマップした領域の index 番目のフレームを指すヘッダにする。以降のフレームは先読みを依頼する
+void Pack_getFrame(int index, IplImage* image);
+
+#endif /* PACK_H */
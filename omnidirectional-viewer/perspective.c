@@ -0,0 +1,129 @@
+#include "perspective.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef M_PI
+ #define M_PI 3.14159265358979323846
+#endif // M_PI
+
+static const double kMaxFovy = 170.0; // [deg]
+
+// 視線の向きと画面の右方向、上方向
+typedef struct
+{
+    double forward[3], right[3], up[3];
+    double tanX, tanY; // 画面の端の傾き
+    int width, height;
+    int srcWidth, srcHeight;
+    bool rotated;
+} Camera;
+
+static void normalize(double v[3])
+{
+    double d = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    v[0] /= d;
+    v[1] /= d;
+    v[2] /= d;
+}
+
+// gluLookAt と同じく、上方向ベクトル (0, 0, 1) から画面の右方向と上方向を決める
+static void setUpCamera(Camera* camera, const PerspectiveView* view)
+{
+    double yaw = view->yaw * M_PI / 180.0;
+    double pitch = view->pitch * M_PI / 180.0;
+    double* f = camera->forward;
+    double* r = camera->right;
+    double* u = camera->up;
+    f[0] = sin(yaw) * cos(pitch);
+    f[1] = cos(yaw) * cos(pitch);
+    f[2] = sin(pitch);
+    r[0] = f[1];
+    r[1] = -f[0];
+    r[2] = 0.0;
+    if (r[0] == 0.0 && r[1] == 0.0) { // 真上か真下を向いている
+        r[0] = cos(yaw);
+        r[1] = -sin(yaw);
+    }
+    normalize(r);
+    u[0] = r[1] * f[2] - r[2] * f[1];
+    u[1] = r[2] * f[0] - r[0] * f[2];
+    u[2] = r[0] * f[1] - r[1] * f[0];
+
+    // gluPerspective と同じく、縦の視野角と縦横比から横の範囲を決める
+    camera->tanY = tan(view->fovy * M_PI / 360.0);
+    camera->tanX = camera->tanY * view->width / view->height;
+    camera->width = view->width;
+    camera->height = view->height;
+}
+
+static bool mapToEquirectangular(double x, double y, void* arg, double* u, double* v)
+{
+    const Camera* c = arg;
+    double sx = (2.0 * x / c->width - 1.0) * c->tanX;
+    double sy = (1.0 - 2.0 * y / c->height) * c->tanY;
+    double d[3];
+    for (int i = 0; i < 3; i++) {
+        d[i] = c->forward[i] + sx * c->right[i] + sy * c->up[i];
+    }
+    Remap_toEquirectangular(d, c->srcWidth, c->srcHeight, c->rotated, u, v);
+    return true;
+}
+
+bool Perspective_parseView(const char* text, PerspectiveView* view)
+{
+    char rest;
+    if (sscanf(text, "%lf:%lf:%lf:%dx%d%c", &view->yaw, &view->pitch, &view->fovy,
+            &view->width, &view->height, &rest) != 5) {
+        fprintf(stderr, "ERROR: Invalid view (yaw:pitch:fovy:widthxheight): %s\n", text);
+        return false;
+    }
+    if (view->width <= 0 || view->height <= 0 || !(0.0 < view->fovy && view->fovy <= kMaxFovy)) {
+        fprintf(stderr, "ERROR: Invalid view size or field of view: %s\n", text);
+        return false;
+    }
+    return true;
+}
+
+void Perspective_initialize(Perspective* perspective, const PerspectiveView* view)
+{
+    assert(perspective != NULL && view != NULL);
+
+    memset(perspective, 0, sizeof(*perspective));
+    perspective->view = *view;
+}
+
+void Perspective_release(Perspective* perspective)
+{
+    Remap_release(&perspective->table);
+}
+
+bool Perspective_extract(Perspective* perspective, const IplImage* image, IplImage** dst)
+{
+    assert(perspective != NULL && image != NULL && dst != NULL);
+
+    RemapTable* table = &perspective->table;
+    bool rotated = image->origin == IPL_ORIGIN_BL;
+    if (table->entries == NULL || table->srcWidth != image->width
+            || table->srcHeight != image->height || perspective->rotated != rotated) {
+        Camera camera;
+        setUpCamera(&camera, &perspective->view);
+        camera.srcWidth = image->width;
+        camera.srcHeight = image->height;
+        camera.rotated = rotated;
+        Remap_release(table);
+        if (!Remap_create(table, camera.width, camera.height,
+                image->width, image->height, mapToEquirectangular, &camera)) {
+            return false;
+        }
+        perspective->rotated = rotated;
+    }
+
+    if (*dst == NULL || (*dst)->width != table->width || (*dst)->height != table->height) {
+        cvReleaseImage(dst);
+        *dst = cvCreateImage(cvSize(table->width, table->height), IPL_DEPTH_8U, 3);
+    }
+    Remap_apply(table, image, *dst);
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef PERSPECTIVE_H
+#define PERSPECTIVE_H
+
+#include <stdbool.h>
+#include <opencv/cv.h>
+#include "remap.h"
+
+// ビューアと同じ向きの取り方をする。視点の初期値（注視点 (1, 0, 0)）は yaw = 90, pitch = 0
+typedef struct
+{
+    double yaw;   // 方位角。y軸からx軸の向きに測る [deg]
+    double pitch; // 仰角。x-y平面からz軸の向きに測る [deg]
+    double fovy;  // 縦の視野角 [deg]
+    int width, height; // 出力画像の大きさ
+} PerspectiveView;
+
+// 視点ごとに変換表を保持する
+typedef struct
+{
+    PerspectiveView view;
+    RemapTable table;
+    bool rotated; // 表を作成した元画像の上下左右が反転している
+} Perspective;
+
+// "yaw:pitch:fovy:widthxheight" の形式の文字列を読み取る
+bool Perspective_parseView(const char* text, PerspectiveView* view);
+
+void Perspective_initialize(Perspective* perspective, const PerspectiveView* view);
+void Perspective_release(Perspective* perspective);
+// 正距円筒画像から透視投影の画像を切り出す。元画像の大きさが変わった場合だけ変換表を作り直す。
+// 元画像の origin が IPL_ORIGIN_BL の場合は上下左右を反転済みとみなす。
+// *dst は大きさが合えば使い回し、合わなければ作り直す
+bool Perspective_extract(Perspective* perspective, const IplImage* image, IplImage** dst);
+
+#endif /* PERSPECTIVE_H */
@@ -0,0 +1,273 @@
+#define _DEFAULT_SOURCE
+
+#include "remap.h"
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+ #include <emmintrin.h>
+#endif // __SSE2__
+
+#ifndef M_PI
+ #define M_PI 3.14159265358979323846
+#endif // M_PI
+
+enum { kMaxThreads = 16 };
+
+typedef struct
+{
+    const RemapTable* table;
+    const RemapTable* second; // 混ぜ合わせる場合のもう1つの表
+    const uint8_t* weights;
+    const IplImage* src;
+    IplImage* dst;
+    int begin, end; // 処理する行の範囲
+} RemapTask;
+
+bool Remap_create(RemapTable* table, int width, int height,
+        int srcWidth, int srcHeight, RemapFunction function, void* arg)
+{
+    assert(table != NULL && function != NULL);
+
+    if (srcWidth < 2 || srcHeight < 2) {
+        fprintf(stderr, "ERROR: Source image is too small: %dx%d\n", srcWidth, srcHeight);
+        return false;
+    }
+    if (srcWidth > kRemapMaxSize || srcHeight > kRemapMaxSize) {
+        fprintf(stderr, "ERROR: Source image is too large: %dx%d\n", srcWidth, srcHeight);
+        return false;
+    }
+    table->entries = malloc(sizeof(RemapEntry) * width * height);
+    if (table->entries == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate remap table: %dx%d\n", width, height);
+        return false;
+    }
+    table->width = width;
+    table->height = height;
+    table->srcWidth = srcWidth;
+    table->srcHeight = srcHeight;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            RemapEntry* entry = &table->entries[y * width + x];
+            double u, v;
+            memset(entry, 0, sizeof(*entry));
+            if (!function(x + 0.5, y + 0.5, arg, &u, &v)) {
+                entry->flags = kRemapInvalid;
+                continue;
+            }
+            // 画素の中心を基準にして、右下の画素が画像内に収まるように左上の画素を決める
+            u = fmin(fmax(u - 0.5, 0.0), srcWidth - 1);
+            v = fmin(fmax(v - 0.5, 0.0), srcHeight - 1);
+            int x0 = (int) u < srcWidth - 1 ? (int) u : srcWidth - 2;
+            int y0 = (int) v < srcHeight - 1 ? (int) v : srcHeight - 2;
+            entry->x = (uint16_t) x0;
+            entry->y = (uint16_t) y0;
+            entry->fx = (uint8_t) lround((u - x0) * kRemapWeightOne);
+            entry->fy = (uint8_t) lround((v - y0) * kRemapWeightOne);
+            // 4バイト単位で読むので、最後の画素では画像の末尾を越えてしまう
+            if (y0 == srcHeight - 2 && x0 == srcWidth - 2) {
+                entry->flags = kRemapScalar;
+            }
+        }
+    }
+    return true;
+}
+
+void Remap_release(RemapTable* table)
+{
+    free(table->entries);
+    table->entries = NULL;
+}
+
+static void samplePixel(const uint8_t* p, int step, const RemapEntry* entry, uint8_t* dst)
+{
+    int fx = entry->fx, fy = entry->fy;
+    for (int c = 0; c < 3; c++) {
+        int top = p[c] * (kRemapWeightOne - fx) + p[c + 3] * fx;
+        int bottom = p[step + c] * (kRemapWeightOne - fx) + p[step + c + 3] * fx;
+        int value = top * (kRemapWeightOne - fy) + bottom * fy;
+        dst[c] = (uint8_t) ((value + (1 << (2 * kRemapWeightBits - 1))) >> (2 * kRemapWeightBits));
+    }
+}
+
+#ifdef __SSE2__
+static inline __m128i loadPixels(const uint8_t* p)
+{
+    // 左右の画素を1チャンネルずつ交互に並べる（b0 b1 g0 g1 r0 r1 …）
+    uint32_t left, right;
+    memcpy(&left, p, sizeof(left));
+    memcpy(&right, p + 3, sizeof(right));
+    __m128i pixels = _mm_unpacklo_epi8(_mm_cvtsi32_si128(left), _mm_cvtsi32_si128(right));
+    return _mm_unpacklo_epi8(pixels, _mm_setzero_si128());
+}
+
+// 横方向と縦方向の補間をそれぞれ _mm_madd_epi16 で計算する
+static inline void samplePixelSSE2(const uint8_t* p, int step, const RemapEntry* entry, uint8_t* dst)
+{
+    __m128i wx = _mm_set1_epi32((entry->fx << 16) | (kRemapWeightOne - entry->fx));
+    __m128i wy = _mm_set1_epi32((entry->fy << 16) | (kRemapWeightOne - entry->fy));
+    __m128i top = _mm_madd_epi16(loadPixels(p), wx);
+    __m128i bottom = _mm_madd_epi16(loadPixels(p + step), wx);
+    // 横方向の補間結果は 255 * 128 以下なので16ビットに収まる
+    __m128i rows = _mm_unpacklo_epi16(_mm_packs_epi32(top, top), _mm_packs_epi32(bottom, bottom));
+    __m128i value = _mm_madd_epi16(rows, wy);
+    value = _mm_add_epi32(value, _mm_set1_epi32(1 << (2 * kRemapWeightBits - 1)));
+    value = _mm_srli_epi32(value, 2 * kRemapWeightBits);
+    value = _mm_packs_epi32(value, value);
+    uint32_t bgr = _mm_cvtsi128_si32(_mm_packus_epi16(value, value));
+    dst[0] = (uint8_t) bgr;
+    dst[1] = (uint8_t) (bgr >> 8);
+    dst[2] = (uint8_t) (bgr >> 16);
+}
+#endif // __SSE2__
+
+static inline void sampleEntry(const uint8_t* src, int step, const RemapEntry* entry, uint8_t* dst)
+{
+    if (entry->flags & kRemapInvalid) {
+        dst[0] = dst[1] = dst[2] = 0;
+        return;
+    }
+    const uint8_t* p = src + (size_t) entry->y * step + entry->x * 3;
+    if (entry->flags & kRemapScalar) {
+        samplePixel(p, step, entry, dst);
+    } else {
+#ifdef __SSE2__
+        samplePixelSSE2(p, step, entry, dst);
+#else
+        samplePixel(p, step, entry, dst);
+#endif // __SSE2__
+    }
+}
+
+static void blendRow(const RemapTask* task, const uint8_t* src, int step, int y, uint8_t* dst)
+{
+    int width = task->table->width;
+    const RemapEntry* first = &task->table->entries[y * width];
+    const RemapEntry* second = &task->second->entries[y * width];
+    const uint8_t* weights = &task->weights[y * width];
+    for (int x = 0; x < width; x++, dst += 3) {
+        int w = weights[x];
+        if (w == kRemapWeightOne) {
+            sampleEntry(src, step, &first[x], dst);
+        } else if (w == 0) {
+            sampleEntry(src, step, &second[x], dst);
+        } else {
+            uint8_t a[3], b[3];
+            sampleEntry(src, step, &first[x], a);
+            sampleEntry(src, step, &second[x], b);
+            for (int c = 0; c < 3; c++) {
+                int value = a[c] * w + b[c] * (kRemapWeightOne - w);
+                dst[c] = (uint8_t) ((value + (1 << (kRemapWeightBits - 1))) >> kRemapWeightBits);
+            }
+        }
+    }
+}
+
+static void* remapRows(void* arg)
+{
+    const RemapTask* task = arg;
+    const RemapTable* table = task->table;
+    const uint8_t* src = (const uint8_t*) task->src->imageData;
+    int step = task->src->widthStep;
+
+    for (int y = task->begin; y < task->end; y++) {
+        uint8_t* dst = (uint8_t*) task->dst->imageData + y * task->dst->widthStep;
+        if (task->second != NULL) {
+            blendRow(task, src, step, y, dst);
+            continue;
+        }
+        const RemapEntry* entry = &table->entries[y * table->width];
+        for (int x = 0; x < table->width; x++, entry++, dst += 3) {
+            sampleEntry(src, step, entry, dst);
+        }
+    }
+    return NULL;
+}
+
+static int getThreadCount(int rows)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = (cpus > 0) ? (int) cpus : 1;
+    count = (count < kMaxThreads) ? count : kMaxThreads;
+    return (count < rows) ? count : (rows > 0 ? rows : 1);
+}
+
+static void run(const RemapTable* table, const RemapTable* second, const uint8_t* weights,
+        const IplImage* src, IplImage* dst)
+{
+    assert(table->entries != NULL);
+    assert(src->width == table->srcWidth && src->height == table->srcHeight);
+    assert(src->widthStep >= src->width * 3 && src->nChannels == 3);
+    assert(dst->width == table->width && dst->height == table->height && dst->nChannels == 3);
+
+    int numThreads = getThreadCount(table->height);
+    RemapTask tasks[kMaxThreads];
+    pthread_t threads[kMaxThreads];
+    for (int i = 0; i < numThreads; i++) {
+        tasks[i].table = table;
+        tasks[i].second = second;
+        tasks[i].weights = weights;
+        tasks[i].src = src;
+        tasks[i].dst = dst;
+        tasks[i].begin = table->height * i / numThreads;
+        tasks[i].end = table->height * (i + 1) / numThreads;
+    }
+    // 最初の範囲は呼び出したスレッドで処理する
+    int started = 1;
+    for (int i = 1; i < numThreads; i++, started++) {
+        if (pthread_create(&threads[i], NULL, remapRows, &tasks[i]) != 0) {
+            break;
+        }
+    }
+    remapRows(&tasks[0]);
+    for (int i = started; i < numThreads; i++) {
+        remapRows(&tasks[i]); // スレッドを作れなかった範囲
+    }
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+void Remap_apply(const RemapTable* table, const IplImage* src, IplImage* dst)
+{
+    run(table, NULL, NULL, src, dst);
+}
+
+void Remap_blend(const RemapTable* first, const RemapTable* second, const uint8_t* weights,
+        const IplImage* src, IplImage* dst)
+{
+    assert(second->entries != NULL && weights != NULL);
+    assert(second->width == first->width && second->height == first->height);
+    assert(second->srcWidth == first->srcWidth && second->srcHeight == first->srcHeight);
+
+    run(first, second, weights, src, dst);
+}
+
+void Remap_toEquirectangular(const double d[3], int width, int height, bool rotated, double* u, double* v)
+{
+    double azimuth = atan2(d[0], d[1]);
+    if (azimuth < 0.0) {
+        azimuth += 2.0 * M_PI;
+    }
+    double polar = acos(d[2] / sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+    *u = width * azimuth / (2.0 * M_PI);
+    *v = height * polar / M_PI;
+    if (rotated) {
+        *u = width - *u;
+        *v = height - *v;
+    }
+}
+
+void Remap_fromEquirectangular(double u, double v, int width, int height, double d[3])
+{
+    double azimuth = 2.0 * M_PI * u / width;
+    double polar = M_PI * v / height;
+    d[0] = sin(polar) * sin(azimuth);
+    d[1] = sin(polar) * cos(azimuth);
+    d[2] = cos(polar);
+}
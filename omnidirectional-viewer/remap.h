@@ -0,0 +1,58 @@
+#ifndef REMAP_H
+#define REMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <opencv/cv.h>
+
+enum
+{
+    kRemapWeightBits = 7, // 補間の重みの精度
+    kRemapWeightOne = 1 << kRemapWeightBits,
+};
+
+enum { kRemapMaxSize = UINT16_MAX };
+
+enum
+{
+    kRemapInvalid = 1, // 元画像の範囲外なので黒にする
+    kRemapScalar = 2,  // 元画像の末尾を越えて読まないようにSIMDを使わない
+};
+
+typedef struct
+{
+    uint16_t x, y;   // 補間に使う左上の画素の位置 [px]。行のバイト数は変換するときの画像に従う
+    uint8_t fx, fy;  // 右と下の画素の重み（0〜kRemapWeightOne）
+    uint8_t flags;
+    uint8_t reserved;
+} RemapEntry;
+
+typedef struct
+{
+    int width, height;       // 出力画像の大きさ
+    int srcWidth, srcHeight; // 元画像の大きさ
+    RemapEntry* entries;
+} RemapTable;
+
+// 出力画像の画素 (x, y) に対応する元画像上の座標 (u, v) [px] を求める。範囲外ならfalseを返す
+typedef bool (*RemapFunction)(double x, double y, void* arg, double* u, double* v);
+
+// 出力画像の画素ごとに元画像の参照位置を求めて、表を作成する。元画像の幅と高さは kRemapMaxSize 以下
+bool Remap_create(RemapTable* table, int width, int height,
+        int srcWidth, int srcHeight, RemapFunction function, void* arg);
+void Remap_release(RemapTable* table);
+// 表に従って双線形補間で画像を変換する。行を分けて複数のスレッドで処理する
+void Remap_apply(const RemapTable* table, const IplImage* src, IplImage* dst);
+// 2つの表で補間した画素を、画素ごとの first の重み weights（0〜kRemapWeightOne）で混ぜ合わせる。
+// 重みが0か kRemapWeightOne の画素は片方の表だけを使う
+void Remap_blend(const RemapTable* first, const RemapTable* second, const uint8_t* weights,
+        const IplImage* src, IplImage* dst);
+
+// 方向ベクトル d に対応する正距円筒画像上の座標 (u, v) [px] を求める。
+// 球の表示と同じく、方位角はy軸からx軸の向きに、極角はz軸から測る。
+// rotated の場合は上下左右を反転させた画像上の座標を返す
+void Remap_toEquirectangular(const double d[3], int width, int height, bool rotated, double* u, double* v);
+// 正距円筒画像上の座標 (u, v) [px] に対応する単位方向ベクトルを求める
+void Remap_fromEquirectangular(double u, double v, int width, int height, double d[3]);
+
+#endif /* REMAP_H */
@@ -0,0 +1,211 @@
+#define GL_GLEXT_PROTOTYPES
+
+#include "sphere.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#if defined __APPLE__ && defined __MACH__
+ #include <GLUT/glut.h>
+#else
+ #include <GL/glut.h>
+#endif // __APPLE__ && __MACH__
+
+#ifndef M_PI
+ #define M_PI 3.14159265358979323846
+#endif // M_PI
+
+enum
+{
+    kSectors = 16, // 経線方向のパッチの数
+    kBands = 8,    // 緯線方向のパッチの数
+    kNumPatches = kSectors * kBands,
+    kMinSlices = kSectors,
+    kMaxSlices = 256, // 頂点の番号を16ビットに収める
+};
+
+static const float kRadius = 50.0f;
+// 平面の三角形で補間したテクスチャ座標のずれの許容値 [px]
+static const double kMaxError = 0.5;
+
+typedef struct
+{
+    GLfloat s, t;
+    GLfloat x, y, z;
+} Vertex;
+
+typedef struct
+{
+    size_t first, count; // 索引の範囲
+    double center[3];    // パッチの中心の方向
+    double radius;       // 中心から端までの角度 [rad]
+} Patch;
+
+static GLuint s_vertexBuffer;
+static GLuint s_indexBuffer;
+static Patch s_patches[kNumPatches];
+static int s_slices; // 経線方向の分割数。緯線方向はこの半分
+
+static void getDirection(int slices, int stacks, double i, double j, double d[3])
+{
+    double azimuth = 2.0 * M_PI * i / slices;
+    double polar = M_PI * j / stacks;
+    d[0] = sin(polar) * sin(azimuth);
+    d[1] = sin(polar) * cos(azimuth);
+    d[2] = cos(polar);
+}
+
+static double getAngle(const double a[3], const double b[3])
+{
+    double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    return acos(fmax(fmin(dot, 1.0), -1.0));
+}
+
+// 一辺の角度が a の四角形を2つの三角形で近似すると、上下の辺の長さの違いによって
+// テクスチャ座標が球面上でおよそ a^2 / 8 [rad] ずれる
+static int getSliceCount(double fovy, int height)
+{
+    double pixelAngle = 2.0 * tan(fovy * M_PI / 360.0) / height; // 画面中央の1画素の角度 [rad]
+    double segment = sqrt(8.0 * kMaxError * pixelAngle);
+    int slices = (int) ceil(2.0 * M_PI / segment);
+    slices = (slices + kSectors - 1) / kSectors * kSectors;
+    return (slices < kMinSlices) ? kMinSlices : (slices > kMaxSlices ? kMaxSlices : slices);
+}
+
+// パッチごとに行を三角形ストリップでつなげ、頂点キャッシュに載りやすい狭い範囲の頂点を続けて参照する。
+// 行の間とパッチの間は縮退した三角形でつなげるので、隣り合うパッチはまとめて描画できる
+static bool createMesh(int slices)
+{
+    int stacks = slices / 2;
+    int cols = slices / kSectors;
+    int rows = stacks / kBands;
+    size_t numVertices = (size_t) (slices + 1) * (stacks + 1);
+    size_t patchIndices = (size_t) rows * (cols + 1) * 2 + (rows - 1) * 2;
+    size_t numIndices = patchIndices * kNumPatches + (kNumPatches - 1) * 2;
+
+    Vertex* vertices = malloc(sizeof(Vertex) * numVertices);
+    GLushort* indices = malloc(sizeof(GLushort) * numIndices);
+    if (vertices == NULL || indices == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate sphere mesh: %d slices\n", slices);
+        free(vertices);
+        free(indices);
+        return false;
+    }
+
+    // gluSphere と同じく、s は経度とともに1から0へ、t は北極の1から南極の0へ変わる
+    for (int j = 0; j <= stacks; j++) {
+        for (int i = 0; i <= slices; i++) {
+            Vertex* v = &vertices[j * (slices + 1) + i];
+            double d[3];
+            getDirection(slices, stacks, i, j, d);
+            v->s = 1.0f - (float) i / slices;
+            v->t = 1.0f - (float) j / stacks;
+            v->x = kRadius * d[0];
+            v->y = kRadius * d[1];
+            v->z = kRadius * d[2];
+        }
+    }
+
+    size_t n = 0;
+    for (int b = 0; b < kBands; b++) {
+        for (int s = 0; s < kSectors; s++) {
+            Patch* patch = &s_patches[b * kSectors + s];
+            int i0 = s * cols, j0 = b * rows;
+            if (n > 0) {
+                indices[n] = indices[n - 1];
+                n++;
+                indices[n++] = j0 * (slices + 1) + i0;
+            }
+            patch->first = n;
+            for (int j = j0; j < j0 + rows; j++) {
+                if (j > j0) {
+                    indices[n] = indices[n - 1];
+                    n++;
+                    indices[n++] = j * (slices + 1) + i0;
+                }
+                for (int i = i0; i <= i0 + cols; i++) {
+                    indices[n++] = j * (slices + 1) + i;
+                    indices[n++] = (j + 1) * (slices + 1) + i;
+                }
+            }
+            patch->count = n - patch->first;
+
+            getDirection(slices, stacks, i0 + cols * 0.5, j0 + rows * 0.5, patch->center);
+            patch->radius = 0.0;
+            for (int k = 0; k < 9; k++) {
+                double d[3];
+                getDirection(slices, stacks, i0 + cols * (k % 3) * 0.5, j0 + rows * (k / 3) * 0.5, d);
+                patch->radius = fmax(patch->radius, getAngle(patch->center, d));
+            }
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, s_vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * numVertices, vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s_indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * n, indices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    free(vertices);
+    free(indices);
+    s_slices = slices;
+    return true;
+}
+
+bool Sphere_initialize(void)
+{
+    glGenBuffers(1, &s_vertexBuffer);
+    glGenBuffers(1, &s_indexBuffer);
+    return createMesh(getSliceCount(90.0, 480));
+}
+
+void Sphere_finalize(void)
+{
+    glDeleteBuffers(1, &s_vertexBuffer);
+    glDeleteBuffers(1, &s_indexBuffer);
+    s_slices = 0;
+}
+
+void Sphere_draw(double dx, double dy, double dz, double fovy, int width, int height)
+{
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    int slices = getSliceCount(fovy, height);
+    if (slices != s_slices && !createMesh(slices)) {
+        return;
+    }
+
+    double norm = sqrt(dx * dx + dy * dy + dz * dz);
+    double view[3] = { dx / norm, dy / norm, dz / norm };
+    double aspect = (double) width / height;
+    double halfAngle = atan(tan(fovy * M_PI / 360.0) * sqrt(1.0 + aspect * aspect));
+
+    glBindBuffer(GL_ARRAY_BUFFER, s_vertexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s_indexBuffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (const GLvoid*) offsetof(Vertex, s));
+    glVertexPointer(3, GL_FLOAT, sizeof(Vertex), (const GLvoid*) offsetof(Vertex, x));
+
+    // 視野に入るパッチが続く範囲をまとめて描画する
+    int begin = -1;
+    for (int i = 0; i <= kNumPatches; i++) {
+        bool visible = i < kNumPatches
+                && getAngle(s_patches[i].center, view) <= halfAngle + s_patches[i].radius;
+        if (visible && begin < 0) {
+            begin = i;
+        } else if (!visible && begin >= 0) {
+            size_t first = s_patches[begin].first;
+            size_t count = s_patches[i - 1].first + s_patches[i - 1].count - first;
+            glDrawElements(GL_TRIANGLE_STRIP, count, GL_UNSIGNED_SHORT,
+                    (const GLvoid*) (first * sizeof(GLushort)));
+            begin = -1;
+        }
+    }
+
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,13 @@
+#ifndef SPHERE_H
+#define SPHERE_H
+
+#include <stdbool.h>
+
+// OpenGLのコンテキストを作成してから呼び出す
+bool Sphere_initialize(void);
+void Sphere_finalize(void);
+// 視線方向 (dx, dy, dz)、縦の視野角 fovy [deg] と表示領域の大きさ [px] から分割数を決めて、
+// 視野に入る部分だけを描画する。テクスチャ座標は gluSphere と同じ
+void Sphere_draw(double dx, double dy, double dz, double fovy, int width, int height);
+
+#endif /* SPHERE_H */
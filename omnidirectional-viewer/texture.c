@@ -0,0 +1,275 @@
+#define _POSIX_C_SOURCE 199309L
+#define GL_GLEXT_PROTOTYPES
+
+#include "texture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined __APPLE__ && defined __MACH__
+ #include <GLUT/glut.h>
+ #define glGenerateMipmap glGenerateMipmapEXT
+#else
+ #include <GL/glut.h>
+#endif // __APPLE__ && __MACH__
+
+// 交互に使うピクセルバッファオブジェクトの数。1つからテクスチャへ転送する間に、もう1つへ書き込む
+enum { kNumPixelBuffers = 2 };
+// 転送にかかったGPU時間を測るクエリの数。結果は待たずに後のフレームで読み出す
+enum { kNumQueries = 4 };
+
+static GLuint s_texture;
+static GLuint s_pixelBuffers[kNumPixelBuffers];
+static int s_pendingBuffer = -1; // テクスチャへまだ転送していない画像を持つバッファ。なければ-1
+static bool s_mipmap;
+static int s_width, s_height;
+static TextureStatistics s_statistics;
+
+#ifdef GL_TIMESTAMP
+static GLuint s_queries[kNumQueries][2]; // 転送の前後のGPUの時刻
+static bool s_queryPending[kNumQueries];
+static int s_queryIndex;
+#endif // GL_TIMESTAMP
+
+static double getTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0; // [ms]
+}
+
+static bool isSupported(int major, int minor)
+{
+    const char* version = (const char*) glGetString(GL_VERSION);
+    int glMajor = 0, glMinor = 0;
+    if (version == NULL || sscanf(version, "%d.%d", &glMajor, &glMinor) != 2) {
+        return false;
+    }
+    return glMajor > major || (glMajor == major && glMinor >= minor);
+}
+
+static void allocate(const IplImage* image)
+{
+    s_width = image->width;
+    s_height = image->height;
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, s_width, s_height,
+            0, GL_BGR_EXT, GL_UNSIGNED_BYTE, NULL);
+}
+
+// 結果が出ているクエリからGPU時間を集計する
+static void collectQueries(void)
+{
+#ifdef GL_TIMESTAMP
+    for (int i = 0; i < kNumQueries; i++) {
+        if (!s_queryPending[i]) {
+            continue;
+        }
+        GLuint available = 0;
+        glGetQueryObjectuiv(s_queries[i][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            continue;
+        }
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(s_queries[i][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(s_queries[i][1], GL_QUERY_RESULT, &end);
+        s_queryPending[i] = false;
+        double elapsed = (end - begin) / 1000000.0; // [ms]
+        s_statistics.gpuFrames++;
+        s_statistics.gpuTime += elapsed;
+        if (elapsed > s_statistics.maxGpuTime) {
+            s_statistics.maxGpuTime = elapsed;
+        }
+    }
+#endif // GL_TIMESTAMP
+}
+
+// テクスチャへの転送の前にGPUの時刻を記録する。フレーム全体を測る GL_TIME_ELAPSED とは入れ子にできないので時刻の差で測る。
+// 計測しない場合は-1を返す
+static int beginQuery(void)
+{
+#ifdef GL_TIMESTAMP
+    if (s_statistics.timerQuery) {
+        collectQueries();
+        if (!s_queryPending[s_queryIndex]) {
+            glQueryCounter(s_queries[s_queryIndex][0], GL_TIMESTAMP);
+            return s_queryIndex;
+        }
+    }
+#endif // GL_TIMESTAMP
+    return -1;
+}
+
+static void endQuery(int query)
+{
+#ifdef GL_TIMESTAMP
+    if (query >= 0) {
+        glQueryCounter(s_queries[query][1], GL_TIMESTAMP);
+        s_queryPending[query] = true;
+        s_queryIndex = (query + 1) % kNumQueries;
+    }
+#endif // GL_TIMESTAMP
+}
+
+// ピクセルバッファへ画像を書き込む
+static bool fillPixelBuffer(int index, const IplImage* image)
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s_pixelBuffers[index]);
+    // 以前の内容を破棄して、転送中のバッファを待たないようにする
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, image->imageSize, NULL, GL_STREAM_DRAW);
+    void* buffer = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    if (buffer != NULL) {
+        memcpy(buffer, image->imageData, image->imageSize);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    } else {
+        fprintf(stderr, "ERROR: Failed to map pixel buffer\n");
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return buffer != NULL;
+}
+
+// ピクセルバッファからテクスチャへ転送する。転送はGPU側で非同期に行われる
+static void uploadPixelBuffer(int index)
+{
+    int query = beginQuery();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s_pixelBuffers[index]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, s_width, s_height, GL_BGR_EXT, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (s_mipmap) {
+        glGenerateMipmap(GL_TEXTURE_2D); // GPU側でMipmapを生成する
+    }
+    endQuery(query);
+}
+
+// 前のフレームで書き込んだバッファからテクスチャへ転送し、GPUが転送している間に次のバッファへ書き込む。
+// そのため表示は1枚遅れ、新しい画像がなければ Texture_flush で転送する。
+// 大きさが変わった場合は古い画像を捨てて、書き込んだ画像をすぐに転送する
+static void uploadFromPixelBuffer(const IplImage* image, bool resized)
+{
+    int index = (s_pendingBuffer < 0) ? 0 : (s_pendingBuffer + 1) % kNumPixelBuffers;
+    if (s_pendingBuffer >= 0 && !resized) {
+        uploadPixelBuffer(s_pendingBuffer);
+    }
+    s_pendingBuffer = -1;
+    if (!fillPixelBuffer(index, image)) {
+        return;
+    }
+    if (resized) {
+        uploadPixelBuffer(index);
+    } else {
+        s_pendingBuffer = index;
+    }
+}
+
+static void recordTime(double start)
+{
+    double elapsed = getTime() - start;
+    s_statistics.totalTime += elapsed;
+    if (elapsed > s_statistics.maxTime) {
+        s_statistics.maxTime = elapsed;
+    }
+}
+
+bool Texture_initialize(bool mipmap)
+{
+    s_mipmap = mipmap;
+    memset(&s_statistics, 0, sizeof(s_statistics));
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4); // IplImageの行は4バイト境界に揃えられている
+    glGenTextures(1, &s_texture); // テクスチャの数を指定
+    glBindTexture(GL_TEXTURE_2D, s_texture); // テクスチャの作成と使用
+
+    // テクスチャを拡大・縮小する方法の指定
+    if (s_mipmap) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // 双線形補間
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); // 三線形補間
+    } else {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST); // 最近傍法
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // 最近傍法
+    }
+
+    // テクスチャの繰り返しの指定
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP); // s軸方向の繰り返しを行わない
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP); // t軸方向の繰り返しを行わない
+
+    if (s_mipmap && !isSupported(3, 0)) {
+        fprintf(stderr, "ERROR: glGenerateMipmap requires OpenGL 3.0\n");
+        return false;
+    }
+    // ピクセルバッファオブジェクトはOpenGL 2.1から使える。使えなければ直接転送する
+    s_statistics.pixelBuffer = isSupported(2, 1);
+    if (s_statistics.pixelBuffer) {
+        glGenBuffers(kNumPixelBuffers, s_pixelBuffers);
+    }
+    s_pendingBuffer = -1;
+#ifdef GL_TIMESTAMP
+    // GPUの時刻のクエリはOpenGL 3.3から使える
+    s_statistics.timerQuery = isSupported(3, 3);
+    if (s_statistics.timerQuery) {
+        glGenQueries(kNumQueries * 2, &s_queries[0][0]);
+        memset(s_queryPending, 0, sizeof(s_queryPending));
+    }
+#endif // GL_TIMESTAMP
+    return true;
+}
+
+void Texture_finalize(void)
+{
+    if (s_statistics.pixelBuffer) {
+        glDeleteBuffers(kNumPixelBuffers, s_pixelBuffers);
+    }
+#ifdef GL_TIMESTAMP
+    if (s_statistics.timerQuery) {
+        glDeleteQueries(kNumQueries * 2, &s_queries[0][0]);
+    }
+#endif // GL_TIMESTAMP
+    glDeleteTextures(1, &s_texture);
+    s_width = s_height = 0;
+}
+
+void Texture_update(const IplImage* image)
+{
+    double start = getTime();
+
+    glBindTexture(GL_TEXTURE_2D, s_texture);
+    bool resized = image->width != s_width || image->height != s_height;
+    if (resized) {
+        allocate(image);
+    }
+    if (s_statistics.pixelBuffer) {
+        uploadFromPixelBuffer(image, resized);
+    } else {
+        int query = beginQuery();
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image->width, image->height,
+                GL_BGR_EXT, GL_UNSIGNED_BYTE, image->imageData);
+        if (s_mipmap) {
+            glGenerateMipmap(GL_TEXTURE_2D); // GPU側でMipmapを生成する
+        }
+        endQuery(query);
+    }
+    s_statistics.frames++;
+    s_statistics.bytes += image->imageSize;
+    recordTime(start);
+}
+
+bool Texture_flush(void)
+{
+    if (s_pendingBuffer < 0) {
+        return false;
+    }
+    double start = getTime();
+    glBindTexture(GL_TEXTURE_2D, s_texture);
+    uploadPixelBuffer(s_pendingBuffer);
+    s_pendingBuffer = -1;
+    recordTime(start);
+    return true;
+}
+
+void Texture_bind(void)
+{
+    glBindTexture(GL_TEXTURE_2D, s_texture);
+}
+
+const TextureStatistics* Texture_getStatistics(void)
+{
+    return &s_statistics;
+}
@@ -0,0 +1,31 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <stdbool.h>
+#include <opencv/cv.h>
+
+typedef struct
+{
+    unsigned long frames;     // 転送したフレーム数
+    unsigned long long bytes; // 転送したバイト数
+    double totalTime;         // 転送にかかったCPU時間の合計 [ms]
+    double maxTime;           // 1回の転送にかかった最大のCPU時間 [ms]
+    unsigned long gpuFrames;  // GPU時間を計測できた転送の数
+    double gpuTime;           // テクスチャへの転送とMipmapの生成にかかったGPU時間の合計 [ms]
+    double maxGpuTime;        // 1回の転送にかかった最大のGPU時間 [ms]
+    bool pixelBuffer;         // ピクセルバッファオブジェクトを使っているか
+    bool timerQuery;          // GPU時間を計測しているか
+} TextureStatistics;
+
+// OpenGLのコンテキストを作成してから呼び出す
+bool Texture_initialize(bool mipmap);
+void Texture_finalize(void);
+// 画像をテクスチャへ転送する。テクスチャの領域は画像サイズが変わったときだけ確保し直す。
+// ピクセルバッファを使う場合は前の画像を転送する間に画像を書き込むので、テクスチャには1つ前の画像が入る
+void Texture_update(const IplImage* image);
+// まだテクスチャへ転送していない画像があれば転送してtrueを返す。新しい画像がないときに呼び出す
+bool Texture_flush(void);
+void Texture_bind(void);
+const TextureStatistics* Texture_getStatistics(void);
+
+#endif /* TEXTURE_H */
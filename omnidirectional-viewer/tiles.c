@@ -0,0 +1,619 @@
+#define _DEFAULT_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "tiles.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+#if defined __APPLE__ && defined __MACH__
+ #include <GLUT/glut.h>
+#else
+ #include <GL/glut.h>
+#endif // __APPLE__ && __MACH__
+
+enum
+{
+    kMaxLevels = 16,
+    kCacheSize = 96,  // GPU上に置いておくタイルの数
+    kQueueSize = 32,  // 読み込みを要求中のタイルとデコード済みで転送待ちのタイルの数
+    kMaxUploads = 4,  // 1フレームで転送するタイルの数
+};
+
+static const char kMagic[8] = { 'O', 'M', 'N', 'I', 'T', 'I', 'L', 'E' };
+static const size_t kHeaderSize = 16;
+static const int kTileSize = 512;
+static const int kJpegQuality = 90;
+static const double kRadius = 50.0; // 球の半径
+static const double kSegmentAngle = M_PI / 32.0; // タイルを球面に貼るときの分割の細かさ [rad]
+
+typedef struct
+{
+    uint32_t width, height;
+    uint32_t cols, rows;
+} Level;
+
+typedef struct
+{
+    uint64_t offset;
+    uint32_t size;
+    uint32_t reserved;
+} TileEntry;
+
+typedef struct
+{
+    int level, index;
+} TileKey;
+
+typedef struct
+{
+    TileKey key;
+    IplImage* image; // デコードに失敗した場合はNULL
+} DecodedTile;
+
+typedef struct
+{
+    TileKey key; // 使っていない場合は level が-1
+    GLuint texture;
+    bool valid;
+    unsigned long lastUsed; // 最後に描画したフレーム
+} CacheEntry;
+
+typedef struct
+{
+    TileKey key;
+    double angle; // 視線方向との角度 [rad]
+} Candidate;
+
+static void* s_data = MAP_FAILED;
+static size_t s_dataSize;
+static int s_tileSize;
+static int s_numLevels;
+static Level s_levels[kMaxLevels];
+static int s_firstTile[kMaxLevels]; // 各段階の最初のタイルの番号
+static const TileEntry* s_tiles;
+
+static bool s_texturesReady;
+static GLuint* s_baseTextures; // 最も粗い段階のタイルは常に置いておく
+static CacheEntry s_cache[kCacheSize];
+static unsigned long s_frame;
+
+static pthread_t s_thread;
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+static bool s_running;
+static TileKey s_requests[kQueueSize];
+static int s_requestCount;
+static int s_requestNext; // 次に読み込む要求の位置
+static TileKey s_fetching = { -1, -1 };
+static DecodedTile s_decoded[kQueueSize];
+static int s_decodedCount;
+
+static bool isSameTile(TileKey a, TileKey b)
+{
+    return a.level == b.level && a.index == b.index;
+}
+
+static int getTileCount(const Level* level)
+{
+    return level->cols * level->rows;
+}
+
+static IplImage* decodeTile(TileKey key)
+{
+    const TileEntry* entry = &s_tiles[s_firstTile[key.level] + key.index];
+    CvMat buffer = cvMat(1, entry->size, CV_8UC1, (char*) s_data + entry->offset);
+    IplImage* image = cvDecodeImage(&buffer, CV_LOAD_IMAGE_COLOR);
+    if (image == NULL) {
+        fprintf(stderr, "ERROR: Failed to decode tile: level %d, index %d\n", key.level, key.index);
+    }
+    return image;
+}
+
+// 要求されたタイルを視線方向に近い順に読み込む
+static void* fetch(void* arg)
+{
+    pthread_mutex_lock(&s_mutex);
+    while (s_running) {
+        if (s_requestNext >= s_requestCount || s_decodedCount >= kQueueSize) {
+            pthread_cond_wait(&s_cond, &s_mutex);
+            continue;
+        }
+        TileKey key = s_requests[s_requestNext++];
+        s_fetching = key;
+        pthread_mutex_unlock(&s_mutex);
+
+        IplImage* image = decodeTile(key);
+
+        pthread_mutex_lock(&s_mutex);
+        s_fetching.level = -1;
+        s_decoded[s_decodedCount].key = key;
+        s_decoded[s_decodedCount].image = image;
+        s_decodedCount++;
+    }
+    pthread_mutex_unlock(&s_mutex);
+    return NULL;
+}
+
+static bool writeAt(int fd, const void* buf, size_t size, off_t offset)
+{
+    return pwrite(fd, buf, size, offset) == (ssize_t) size;
+}
+
+static int buildLevels(IplImage* levels[], IplImage* image)
+{
+    int numLevels = 1;
+    levels[0] = image;
+    while (numLevels < kMaxLevels
+            && (levels[numLevels - 1]->width > 2 * kTileSize || levels[numLevels - 1]->height > kTileSize)) {
+        const IplImage* prev = levels[numLevels - 1];
+        CvSize size = cvSize(prev->width / 2 > 0 ? prev->width / 2 : 1, prev->height / 2 > 0 ? prev->height / 2 : 1);
+        levels[numLevels] = cvCreateImage(size, IPL_DEPTH_8U, 3);
+        cvResize(prev, levels[numLevels], CV_INTER_AREA);
+        numLevels++;
+    }
+    return numLevels;
+}
+
+bool Tiles_create(const char* filename, const char* imageFile)
+{
+    assert(filename != NULL && imageFile != NULL);
+
+    IplImage* image = cvLoadImage(imageFile, CV_LOAD_IMAGE_COLOR);
+    if (image == NULL) {
+        fprintf(stderr, "ERROR: Failed to load image: %s\n", imageFile);
+        return false;
+    }
+    IplImage* images[kMaxLevels];
+    Level levels[kMaxLevels];
+    int numLevels = buildLevels(images, image);
+    int numTiles = 0;
+    for (int i = 0; i < numLevels; i++) {
+        levels[i].width = images[i]->width;
+        levels[i].height = images[i]->height;
+        levels[i].cols = (images[i]->width + kTileSize - 1) / kTileSize;
+        levels[i].rows = (images[i]->height + kTileSize - 1) / kTileSize;
+        numTiles += getTileCount(&levels[i]);
+    }
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool result = fd != -1;
+    if (!result) {
+        fprintf(stderr, "ERROR: Failed to open file: %s\n", filename);
+    }
+    TileEntry* entries = calloc(numTiles, sizeof(TileEntry));
+    off_t offset = kHeaderSize + sizeof(Level) * numLevels + sizeof(TileEntry) * numTiles;
+    const int params[] = { CV_IMWRITE_JPEG_QUALITY, kJpegQuality, 0 };
+
+    for (int i = 0, n = 0; result && i < numLevels; i++) {
+        for (int row = 0; result && row < (int) levels[i].rows; row++) {
+            for (int col = 0; result && col < (int) levels[i].cols; col++, n++) {
+                int x = col * kTileSize, y = row * kTileSize;
+                cvSetImageROI(images[i], cvRect(x, y,
+                        (x + kTileSize < images[i]->width) ? kTileSize : images[i]->width - x,
+                        (y + kTileSize < images[i]->height) ? kTileSize : images[i]->height - y));
+                CvMat* jpeg = cvEncodeImage(".jpg", images[i], params);
+                cvResetImageROI(images[i]);
+                result = jpeg != NULL && writeAt(fd, jpeg->data.ptr, jpeg->rows * jpeg->cols, offset);
+                if (result) {
+                    entries[n].offset = offset;
+                    entries[n].size = jpeg->rows * jpeg->cols;
+                    offset += entries[n].size;
+                } else {
+                    fprintf(stderr, "ERROR: Failed to write tile: %s\n", filename);
+                }
+                cvReleaseMat(&jpeg);
+            }
+        }
+    }
+
+    if (result) {
+        char header[kHeaderSize];
+        uint32_t values[2] = { kTileSize, numLevels };
+        memcpy(header, kMagic, sizeof(kMagic));
+        memcpy(header + sizeof(kMagic), values, sizeof(values));
+        result = writeAt(fd, header, kHeaderSize, 0)
+                && writeAt(fd, levels, sizeof(Level) * numLevels, kHeaderSize)
+                && writeAt(fd, entries, sizeof(TileEntry) * numTiles, kHeaderSize + sizeof(Level) * numLevels);
+        if (result) {
+            printf("Wrote %d tiles in %d levels (%dx%d) into %s\n",
+                    numTiles, numLevels, image->width, image->height, filename);
+        }
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    free(entries);
+    for (int i = 0; i < numLevels; i++) {
+        cvReleaseImage(&images[i]);
+    }
+    return result;
+}
+
+bool Tiles_isTileFile(const char* filename)
+{
+    char magic[sizeof(kMagic)];
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    bool result = fread(magic, 1, sizeof(magic), fp) == sizeof(magic)
+            && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+    fclose(fp);
+    return result;
+}
+
+static bool readIndex(void)
+{
+    const char* data = s_data;
+    uint32_t values[2];
+    memcpy(values, data + sizeof(kMagic), sizeof(values));
+    s_tileSize = values[0];
+    s_numLevels = values[1];
+    if (memcmp(data, kMagic, sizeof(kMagic)) != 0 || s_tileSize <= 0
+            || s_numLevels <= 0 || s_numLevels > kMaxLevels
+            || kHeaderSize + sizeof(Level) * s_numLevels > s_dataSize) {
+        return false;
+    }
+    memcpy(s_levels, data + kHeaderSize, sizeof(Level) * s_numLevels);
+
+    int numTiles = 0;
+    for (int i = 0; i < s_numLevels; i++) {
+        s_firstTile[i] = numTiles;
+        numTiles += getTileCount(&s_levels[i]);
+    }
+    size_t indexOffset = kHeaderSize + sizeof(Level) * s_numLevels;
+    if (indexOffset + sizeof(TileEntry) * numTiles > s_dataSize) {
+        return false;
+    }
+    s_tiles = (const TileEntry*) (data + indexOffset);
+    for (int i = 0; i < numTiles; i++) {
+        if (s_tiles[i].offset + s_tiles[i].size > s_dataSize) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Tiles_open(const char* filename)
+{
+    assert(filename != NULL);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "ERROR: Failed to open file: %s\n", filename);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < kHeaderSize) {
+        fprintf(stderr, "ERROR: Not a tile file: %s\n", filename);
+        close(fd);
+        return false;
+    }
+    s_dataSize = st.st_size;
+    s_data = mmap(NULL, s_dataSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s_data == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Failed to map file: %s\n", filename);
+        return false;
+    }
+    if (!readIndex()) {
+        fprintf(stderr, "ERROR: Not a tile file: %s\n", filename);
+        Tiles_close();
+        return false;
+    }
+    madvise(s_data, s_dataSize, MADV_RANDOM);
+
+    s_running = true;
+    if (pthread_create(&s_thread, NULL, fetch, NULL) != 0) {
+        fprintf(stderr, "ERROR: Failed to create fetch thread\n");
+        s_running = false;
+        Tiles_close();
+        return false;
+    }
+    return true;
+}
+
+void Tiles_close(void)
+{
+    pthread_mutex_lock(&s_mutex);
+    bool running = s_running;
+    s_running = false;
+    pthread_cond_broadcast(&s_cond);
+    pthread_mutex_unlock(&s_mutex);
+    if (running) {
+        pthread_join(s_thread, NULL);
+    }
+    for (int i = 0; i < s_decodedCount; i++) {
+        cvReleaseImage(&s_decoded[i].image);
+    }
+    s_decodedCount = s_requestCount = s_requestNext = 0;
+
+    if (s_texturesReady) {
+        glDeleteTextures(getTileCount(&s_levels[s_numLevels - 1]), s_baseTextures);
+        for (int i = 0; i < kCacheSize; i++) {
+            glDeleteTextures(1, &s_cache[i].texture);
+        }
+        free(s_baseTextures);
+        s_baseTextures = NULL;
+        s_texturesReady = false;
+    }
+    if (s_data != MAP_FAILED) {
+        munmap(s_data, s_dataSize);
+        s_data = MAP_FAILED;
+    }
+    s_dataSize = 0;
+    s_numLevels = 0;
+}
+
+static void setTextureParameters(GLuint texture)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // 双線形補間
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // 双線形補間
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); // 隣のタイルとの境目を目立たせない
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+static void uploadTile(GLuint texture, const IplImage* image)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4); // IplImageの行は4バイト境界に揃えられている
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image->width, image->height,
+            0, GL_BGR_EXT, GL_UNSIGNED_BYTE, image->imageData);
+}
+
+// OpenGLのコンテキストが必要なので、最初に描画するときに作成する
+static void initTextures(void)
+{
+    int numBaseTiles = getTileCount(&s_levels[s_numLevels - 1]);
+    s_baseTextures = calloc(numBaseTiles, sizeof(GLuint));
+    glGenTextures(numBaseTiles, s_baseTextures);
+    for (int i = 0; i < numBaseTiles; i++) {
+        TileKey key = { s_numLevels - 1, i };
+        setTextureParameters(s_baseTextures[i]);
+        IplImage* image = decodeTile(key);
+        if (image != NULL) {
+            uploadTile(s_baseTextures[i], image);
+            cvReleaseImage(&image);
+        }
+    }
+    for (int i = 0; i < kCacheSize; i++) {
+        glGenTextures(1, &s_cache[i].texture);
+        setTextureParameters(s_cache[i].texture);
+        s_cache[i].key.level = -1;
+        s_cache[i].valid = false;
+        s_cache[i].lastUsed = 0;
+    }
+    s_texturesReady = true;
+}
+
+static CacheEntry* findCache(TileKey key)
+{
+    for (int i = 0; i < kCacheSize; i++) {
+        if (isSameTile(s_cache[i].key, key)) {
+            return &s_cache[i];
+        }
+    }
+    return NULL;
+}
+
+// 最も長い間描画していないタイルを追い出す
+static CacheEntry* evictCache(void)
+{
+    CacheEntry* entry = &s_cache[0];
+    for (int i = 1; i < kCacheSize; i++) {
+        if (s_cache[i].lastUsed < entry->lastUsed) {
+            entry = &s_cache[i];
+        }
+    }
+    return entry;
+}
+
+static void storeTile(const DecodedTile* tile)
+{
+    CacheEntry* entry = findCache(tile->key);
+    if (entry == NULL) {
+        entry = evictCache();
+    }
+    entry->key = tile->key;
+    entry->valid = tile->image != NULL; // デコードできないタイルも記録して、再び要求しないようにする
+    entry->lastUsed = s_frame;
+    if (entry->valid) {
+        uploadTile(entry->texture, tile->image);
+    }
+}
+
+static void getDirection(const Level* level, double x, double y, double d[3])
+{
+    double azimuth = 2.0 * M_PI * x / level->width;
+    double polar = M_PI * y / level->height;
+    d[0] = sin(polar) * sin(azimuth);
+    d[1] = sin(polar) * cos(azimuth);
+    d[2] = cos(polar);
+}
+
+static double getAngle(const double a[3], const double b[3])
+{
+    double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    return acos(fmax(fmin(dot, 1.0), -1.0));
+}
+
+static void getTileRect(const Level* level, int index, double* x0, double* y0, double* x1, double* y1)
+{
+    *x0 = (index % level->cols) * s_tileSize;
+    *y0 = (index / level->cols) * s_tileSize;
+    *x1 = fmin(*x0 + s_tileSize, level->width);
+    *y1 = fmin(*y0 + s_tileSize, level->height);
+}
+
+// タイルの中心と視線方向の角度が、視野の対角の半分とタイルの広がりの和以下なら見えるとみなす
+static bool isVisible(const Level* level, int index, const double view[3], double halfAngle, double* angle)
+{
+    double x0, y0, x1, y1;
+    getTileRect(level, index, &x0, &y0, &x1, &y1);
+    double center[3];
+    getDirection(level, (x0 + x1) * 0.5, (y0 + y1) * 0.5, center);
+
+    double radius = 0.0;
+    for (int i = 0; i < 9; i++) {
+        if (i == 4) {
+            continue;
+        }
+        double d[3];
+        getDirection(level, x0 + (x1 - x0) * (i % 3) * 0.5, y0 + (y1 - y0) * (i / 3) * 0.5, d);
+        radius = fmax(radius, getAngle(center, d));
+    }
+    *angle = getAngle(center, view);
+    return *angle <= halfAngle + radius;
+}
+
+// 球面のうちタイルが覆う部分を描画する
+static void drawTile(const Level* level, int index, GLuint texture)
+{
+    double x0, y0, x1, y1;
+    getTileRect(level, index, &x0, &y0, &x1, &y1);
+    int cols = (int) ceil(2.0 * M_PI * (x1 - x0) / level->width / kSegmentAngle);
+    int rows = (int) ceil(M_PI * (y1 - y0) / level->height / kSegmentAngle);
+    cols = (cols > 0) ? cols : 1;
+    rows = (rows > 0) ? rows : 1;
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    for (int j = 0; j < rows; j++) {
+        glBegin(GL_QUAD_STRIP);
+        for (int i = 0; i <= cols; i++) {
+            for (int k = j; k <= j + 1; k++) {
+                double s = (double) i / cols;
+                double t = (double) k / rows;
+                double d[3];
+                getDirection(level, x0 + (x1 - x0) * s, y0 + (y1 - y0) * t, d);
+                glTexCoord2d(s, t);
+                glVertex3d(kRadius * d[0], kRadius * d[1], kRadius * d[2]);
+            }
+        }
+        glEnd();
+    }
+}
+
+// 表示に足りる解像度のうち最も粗い段階を選ぶ
+static int selectLevel(double fovy, int height)
+{
+    double required = M_PI * height / tan(fovy * M_PI / 360.0);
+    int level = 0;
+    while (level + 1 < s_numLevels && s_levels[level + 1].width >= required) {
+        level++;
+    }
+    return level;
+}
+
+static int compareCandidate(const void* a, const void* b)
+{
+    double angleA = ((const Candidate*) a)->angle;
+    double angleB = ((const Candidate*) b)->angle;
+    return (angleA > angleB) - (angleA < angleB);
+}
+
+static bool isPending(TileKey key)
+{
+    if (isSameTile(s_fetching, key)) {
+        return true;
+    }
+    for (int i = 0; i < s_decodedCount; i++) {
+        if (isSameTile(s_decoded[i].key, key)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// デコード済みのタイルを転送し、見えているのに足りないタイルの読み込みを要求し直す。
+// まだ転送していないタイルが残っていればtrueを返す
+static bool updateCache(const Candidate* candidates, int numCandidates)
+{
+    DecodedTile tiles[kMaxUploads];
+    int numTiles = 0;
+
+    pthread_mutex_lock(&s_mutex);
+    while (s_decodedCount > 0 && numTiles < kMaxUploads) {
+        tiles[numTiles++] = s_decoded[--s_decodedCount];
+    }
+    // まだ読み込みを始めていない要求は、今見えているタイルの要求で置き換える
+    s_requestCount = s_requestNext = 0;
+    for (int i = 0; i < numCandidates && s_requestCount + s_decodedCount + 1 < kQueueSize; i++) {
+        if (!isPending(candidates[i].key)) {
+            s_requests[s_requestCount++] = candidates[i].key;
+        }
+    }
+    bool remaining = s_requestCount > 0 || s_decodedCount > 0 || s_fetching.level >= 0;
+    pthread_cond_signal(&s_cond);
+    pthread_mutex_unlock(&s_mutex);
+
+    for (int i = 0; i < numTiles; i++) {
+        storeTile(&tiles[i]);
+        cvReleaseImage(&tiles[i].image);
+    }
+    return remaining || numTiles > 0;
+}
+
+bool Tiles_draw(float dx, float dy, float dz, double fovy, int width, int height)
+{
+    if (!s_texturesReady) {
+        initTextures();
+    }
+    s_frame++;
+
+    double norm = sqrt(dx * dx + dy * dy + dz * dz);
+    double view[3] = { dx / norm, dy / norm, dz / norm };
+    double aspect = (double) width / height;
+    double halfAngle = atan(tan(fovy * M_PI / 360.0) * sqrt(1.0 + aspect * aspect));
+    int target = selectLevel(fovy, height);
+
+    glMatrixMode(GL_TEXTURE);
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glEnable(GL_TEXTURE_2D);
+
+    // 粗い段階から順に重ねて描画する
+    const Level* base = &s_levels[s_numLevels - 1];
+    for (int i = 0; i < getTileCount(base); i++) {
+        drawTile(base, i, s_baseTextures[i]);
+    }
+    Candidate* candidates = malloc(sizeof(Candidate) * getTileCount(&s_levels[target]));
+    int numCandidates = 0;
+    for (int l = s_numLevels - 2; l >= target; l--) {
+        const Level* level = &s_levels[l];
+        for (int i = 0; i < getTileCount(level); i++) {
+            double angle;
+            if (!isVisible(level, i, view, halfAngle, &angle)) {
+                continue;
+            }
+            TileKey key = { l, i };
+            CacheEntry* entry = findCache(key);
+            if (entry != NULL) {
+                entry->lastUsed = s_frame;
+                if (entry->valid) {
+                    drawTile(level, i, entry->texture);
+                }
+            } else if (l == target) {
+                candidates[numCandidates].key = key;
+                candidates[numCandidates].angle = angle;
+                numCandidates++;
+            }
+        }
+    }
+    glDisable(GL_TEXTURE_2D);
+
+    qsort(candidates, numCandidates, sizeof(Candidate), compareCandidate);
+    bool remaining = updateCache(candidates, numCandidates);
+    free(candidates);
+    return !remaining;
+}
@@ -0,0 +1,36 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <stdbool.h>
+
+//
+// タイルファイルの形式（リトルエンディアン）
+//
+//   char     magic[8]        "OMNITILE"
+//   uint32_t tileSize        タイルの幅と高さ [px]
+//   uint32_t numLevels       解像度の段階の数
+//   {
+//     uint32_t width, height 画像の大きさ [px]
+//     uint32_t cols, rows    タイルの数
+//   } levels[numLevels]      0が元の解像度で、1つごとに縦横半分になる
+//   {
+//     uint64_t offset        JPEGデータの位置
+//     uint32_t size          JPEGデータの大きさ
+//     uint32_t reserved
+//   } tiles[]                段階ごとに左上から行優先で並ぶ
+//   uint8_t  data[]          JPEGデータ
+//
+
+// 正距円筒画像を縮小しながらタイルに分割して、タイルファイルに書き込む
+bool Tiles_create(const char* filename, const char* image);
+// タイルファイルかどうかをマジックナンバーで判定する
+bool Tiles_isTileFile(const char* filename);
+
+bool Tiles_open(const char* filename);
+void Tiles_close(void);
+// 視線方向と投影から見える範囲のタイルを選んで描画する。
+// 足りないタイルは別スレッドで読み込み、届くまでは粗い段階のタイルで代用する。
+// 足りないタイルがなく、表示が完成していればtrueを返す
+bool Tiles_draw(float dx, float dy, float dz, double fovy, int width, int height);
+
+#endif /* TILES_H */
@@ -0,0 +1,141 @@
+#define _DEFAULT_SOURCE
+
+#include "watcher.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+// 通知を受け取ってからファイル名を取り出すまでのキューの長さ（2のn乗）
+enum { kQueueSize = 64 };
+
+static const int kPollTimeout = 100; // [ms]
+
+// 監視スレッドが書き込み、読み込みスレッドが取り出すロックフリーのキュー
+static char s_queue[kQueueSize][NAME_MAX + 1];
+static unsigned int s_queueHead; // 取り出す側だけが更新する
+static unsigned int s_queueTail; // 書き込む側だけが更新する
+
+static int s_fd = -1;
+static pthread_t s_thread;
+static bool s_running;
+
+static void push(const char* name)
+{
+    unsigned int tail = __atomic_load_n(&s_queueTail, __ATOMIC_RELAXED);
+    // キューが一杯のときは取り出されるまで待つ。取り出す側は毎回キューを空にする
+    while (tail - __atomic_load_n(&s_queueHead, __ATOMIC_ACQUIRE) >= kQueueSize) {
+        if (!__atomic_load_n(&s_running, __ATOMIC_RELAXED)) {
+            return;
+        }
+        struct timespec ts = { 0, 1000000 };
+        nanosleep(&ts, NULL);
+    }
+    strncpy(s_queue[tail % kQueueSize], name, NAME_MAX);
+    s_queue[tail % kQueueSize][NAME_MAX] = '\0';
+    __atomic_store_n(&s_queueTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void* watch(void* arg)
+{
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = { s_fd, POLLIN, 0 };
+
+    while (__atomic_load_n(&s_running, __ATOMIC_RELAXED)) {
+        if (poll(&pfd, 1, kPollTimeout) <= 0) {
+            continue;
+        }
+        ssize_t length = read(s_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            continue;
+        }
+        for (char* p = buffer; p < buffer + length; ) {
+            const struct inotify_event* event = (const struct inotify_event*) p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                fprintf(stderr, "ERROR: Too many files were written, some were skipped\n");
+            } else if (event->len > 0 && event->name[0] != '.') {
+                push(event->name);
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return NULL;
+}
+
+bool Watcher_initialize(const char* dir)
+{
+    assert(dir != NULL);
+
+    s_fd = inotify_init();
+    if (s_fd == -1) {
+        fprintf(stderr, "ERROR: Failed to initialize inotify\n");
+        return false;
+    }
+    if (inotify_add_watch(s_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        fprintf(stderr, "ERROR: Failed to watch directory: %s\n", dir);
+        close(s_fd);
+        s_fd = -1;
+        return false;
+    }
+
+    s_queueHead = s_queueTail = 0;
+    s_running = true;
+    if (pthread_create(&s_thread, NULL, watch, NULL) != 0) {
+        fprintf(stderr, "ERROR: Failed to create watcher thread\n");
+        s_running = false;
+        close(s_fd);
+        s_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void Watcher_finalize(void)
+{
+    if (s_fd == -1) {
+        return;
+    }
+    __atomic_store_n(&s_running, false, __ATOMIC_RELAXED);
+    pthread_join(s_thread, NULL);
+    close(s_fd);
+    s_fd = -1;
+}
+
+bool Watcher_takeNewest(char* name, size_t n)
+{
+    unsigned int head = __atomic_load_n(&s_queueHead, __ATOMIC_RELAXED);
+    unsigned int tail = __atomic_load_n(&s_queueTail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return false;
+    }
+    snprintf(name, n, "%s", s_queue[(tail - 1) % kQueueSize]);
+    __atomic_store_n(&s_queueHead, tail, __ATOMIC_RELEASE);
+    return true;
+}
+
+#else
+
+bool Watcher_initialize(const char* dir)
+{
+    fprintf(stderr, "ERROR: Watching a directory is supported only on Linux\n");
+    return false;
+}
+
+void Watcher_finalize(void)
+{
+}
+
+bool Watcher_takeNewest(char* name, size_t n)
+{
+    return false;
+}
+
+#endif // __linux__
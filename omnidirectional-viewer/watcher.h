@@ -0,0 +1,14 @@
+#ifndef WATCHER_H
+#define WATCHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// ディレクトリの監視を開始する。書き込みが完了したファイルと移動してきたファイルを通知する
+bool Watcher_initialize(const char* dir);
+void Watcher_finalize(void);
+// 通知されたファイルのうち最も新しいものの名前を name に書き込む。それより古いものは捨てる。
+// 新しいファイルがなければfalseを返す。監視を開始したスレッドとは別の1つのスレッドから呼び出す
+bool Watcher_takeNewest(char* name, size_t n);
+
+#endif /* WATCHER_H */
@@ -0,0 +1,188 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <opencv2/opencv.hpp>
+#include "pose_log.h"
+
+/**
+ * ファイルからカメラ位置を読み込みます。
+ *
+ * @param[in] filename ファイル名
+ * @param[out] rvec カメラの回転ベクトル
+ * @param[out] tvec カメラの並進ベクトル
+ * @return 読み込めた場合はtrue、そうでなければfalse
+ */
+static bool readCameraPosition(const std::string& filename,
+        cv::Mat& rvec, cv::Mat& tvec) {
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        std::cerr << "ERROR: Failed to open file: " << filename << std::endl;
+        return false;
+    }
+    fs["rotation"] >> rvec;
+    fs["translation"] >> tvec;
+    fs.release();
+    return rvec.total() == 3 && tvec.total() == 3;
+}
+
+/**
+ * CSVの1行から時刻と姿勢を読み込みます。
+ * 先頭の列を時刻 [ms]、末尾の6列を rx,ry,rz,tx,ty,tz とみなします。
+ *
+ * @param[in] line 1行分の文字列
+ * @param[out] record レコード
+ * @return 読み込めた場合はtrue、そうでなければfalse
+ */
+static bool parseCsvLine(const char* line, PoseRecord& record) {
+    char* end;
+    double time = strtod(line, &end);
+    if (end == line || *end != ',') {
+        return false;
+    }
+
+    const char* fields = NULL;
+    int numSeparators = 0;
+    for (const char* p = line + strlen(line); p > line; p--) {
+        if (p[-1] == ',' && ++numSeparators == 6) {
+            fields = p;
+            break;
+        }
+    }
+    if (fields == NULL) {
+        return false;
+    }
+    double pose[6];
+    const char* p = fields;
+    for (int i = 0; i < 6; i++) {
+        pose[i] = strtod(p, &end);
+        if (end == p || (*end != ',' && *end != '\0' && *end != '\n' && *end != '\r')) {
+            return false;
+        }
+        p = end + 1;
+    }
+    record = makePoseRecord(time,
+            cv::Vec3d(pose[0], pose[1], pose[2]), cv::Vec3d(pose[3], pose[4], pose[5]));
+    return true;
+}
+
+static int appendCameraPosition(const std::string& logFileName,
+        const std::string& cameraPositionFileName, double time) {
+    cv::Mat rvec, tvec;
+    if (!readCameraPosition(cameraPositionFileName, rvec, tvec)) {
+        return 1;
+    }
+    rvec.convertTo(rvec, CV_64F);
+    tvec.convertTo(tvec, CV_64F);
+    PoseLogWriter writer;
+    if (!writer.open(logFileName)
+            || !writer.append(makePoseRecord(time,
+                    cv::Vec3d(rvec.ptr<double>()), cv::Vec3d(tvec.ptr<double>())))) {
+        std::cerr << "ERROR: Failed to append the camera position" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+static int importCsv(const std::string& logFileName, const std::string& csvFileName) {
+    FILE* fp = fopen(csvFileName.c_str(), "r");
+    if (fp == NULL) {
+        std::cerr << "ERROR: Failed to open file: " << csvFileName << std::endl;
+        return 1;
+    }
+    PoseLogWriter writer;
+    if (!writer.open(logFileName)) {
+        fclose(fp);
+        return 1;
+    }
+    // 行の長さに合わせて伸ばすバッファを使い回す
+    char* line = NULL;
+    std::size_t capacity = 0;
+    std::size_t count = 0;
+    while (getline(&line, &capacity, fp) != -1) {
+        PoseRecord record;
+        if (line[0] == '#' || !parseCsvLine(line, record)) {
+            continue;
+        }
+        if (!writer.append(record)) {
+            free(line);
+            fclose(fp);
+            return 1;
+        }
+        count++;
+    }
+    free(line);
+    fclose(fp);
+    std::cout << "Append " << count << " poses to " << logFileName << std::endl;
+    return 0;
+}
+
+static void printRecord(FILE* fp, const PoseRecord& record) {
+    cv::Vec3d rvec = getRotationVector(record);
+    const double* t = record.translation;
+    fprintf(fp, "%.3f,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n",
+            record.time, rvec[0], rvec[1], rvec[2], t[0], t[1], t[2]);
+}
+
+static int samplePoses(const std::string& logFileName, double interval,
+        int argc, char** argv) {
+    PoseLogReader reader;
+    if (!reader.open(logFileName)) {
+        return 1;
+    }
+    if (reader.size() == 0 || interval <= 0) {
+        return 1;
+    }
+    double start = (argc > 0) ? atof(argv[0]) : reader[0].time;
+    double end = (argc > 1) ? atof(argv[1]) : reader[reader.size() - 1].time;
+
+    printf("# time_ms,rx,ry,rz,tx,ty,tz\n");
+    for (long i = 0; start + i * interval <= end; i++) {
+        PoseRecord record;
+        if (reader.sample(start + i * interval, record)) {
+            printRecord(stdout, record);
+        }
+    }
+    return 0;
+}
+
+static void printUsage(const char* program) {
+    std::cerr << "usage: "
+            << program << " append <pose log> <camera position file> <time [ms]>\n"
+            << "       " << program << " import <pose log> <csv file>\n"
+            << "       " << program << " query <pose log> <time [ms]>\n"
+            << "       " << program << " sample <pose log> <interval [ms]> [start [ms]] [end [ms]]"
+            << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc <= 3) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    const std::string command(argv[1]);
+    const std::string logFileName(argv[2]);
+
+    if (command == "append" && argc > 4) {
+        return appendCameraPosition(logFileName, argv[3], atof(argv[4]));
+    } else if (command == "import") {
+        return importCsv(logFileName, argv[3]);
+    } else if (command == "query") {
+        PoseLogReader reader;
+        PoseRecord record;
+        if (!reader.open(logFileName)) {
+            return 1;
+        }
+        if (!reader.sample(atof(argv[3]), record)) {
+            std::cerr << "ERROR: Time out of range: " << argv[3] << std::endl;
+            return 1;
+        }
+        printRecord(stdout, record);
+        return 0;
+    } else if (command == "sample") {
+        return samplePoses(logFileName, atof(argv[3]), argc - 4, argv + 4);
+    }
+    printUsage(argv[0]);
+    return 1;
+}
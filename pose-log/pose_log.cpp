@@ -0,0 +1,262 @@
+#include "pose_log.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kMagic[8] = { 'P', 'O', 'S', 'E', 'L', 'O', 'G', '1' };
+static const std::size_t kHeaderSize = 32;
+static const std::size_t kIndexStride = 1024; // 索引に登録するレコードの間隔
+static const double kSlerpThreshold = 0.9995; // これより近い回転は線形補間する
+
+PoseRecord makePoseRecord(double time, const cv::Vec3d& rvec, const cv::Vec3d& tvec) {
+    PoseRecord record;
+    record.time = time;
+    double theta = std::sqrt(rvec.dot(rvec));
+    double s = (theta < 1e-12) ? 0.5 : std::sin(theta * 0.5) / theta;
+    record.rotation[0] = std::cos(theta * 0.5);
+    record.rotation[1] = rvec[0] * s;
+    record.rotation[2] = rvec[1] * s;
+    record.rotation[3] = rvec[2] * s;
+    for (int i = 0; i < 3; i++) {
+        record.translation[i] = tvec[i];
+    }
+    return record;
+}
+
+cv::Vec3d getRotationVector(const PoseRecord& record) {
+    const double* q = record.rotation;
+    double sign = (q[0] < 0) ? -1.0 : 1.0; // 回転角が[0, PI]になる側の四元数を使う
+    double norm = std::sqrt(q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    if (norm < 1e-12) {
+        return cv::Vec3d(2.0 * sign * q[1], 2.0 * sign * q[2], 2.0 * sign * q[3]);
+    }
+    double theta = 2.0 * std::atan2(norm, sign * q[0]);
+    double s = sign * theta / norm;
+    return cv::Vec3d(q[1] * s, q[2] * s, q[3] * s);
+}
+
+/**
+ * 2つの姿勢の間を補間します。
+ *
+ * @param[in] a 補間の始点
+ * @param[in] b 補間の終点
+ * @param[in] t 補間の割合（0でa、1でb）
+ * @param[out] record 補間した姿勢
+ */
+static void interpolate(const PoseRecord& a, const PoseRecord& b, double t, PoseRecord& record) {
+    double qb[4];
+    double dot = 0.0;
+    for (int i = 0; i < 4; i++) {
+        qb[i] = b.rotation[i];
+        dot += a.rotation[i] * qb[i];
+    }
+    // 最短経路で補間するために、内積が負のときは符号を反転させる
+    if (dot < 0.0) {
+        for (int i = 0; i < 4; i++) {
+            qb[i] = -qb[i];
+        }
+        dot = -dot;
+    }
+
+    double wa, wb;
+    if (dot > kSlerpThreshold) {
+        wa = 1.0 - t;
+        wb = t;
+    } else {
+        double theta = std::acos(dot);
+        double sinTheta = std::sin(theta);
+        wa = std::sin((1.0 - t) * theta) / sinTheta;
+        wb = std::sin(t * theta) / sinTheta;
+    }
+    double norm = 0.0;
+    for (int i = 0; i < 4; i++) {
+        record.rotation[i] = wa * a.rotation[i] + wb * qb[i];
+        norm += record.rotation[i] * record.rotation[i];
+    }
+    norm = std::sqrt(norm);
+    for (int i = 0; i < 4; i++) {
+        record.rotation[i] /= norm;
+    }
+    for (int i = 0; i < 3; i++) {
+        record.translation[i] = (1.0 - t) * a.translation[i] + t * b.translation[i];
+    }
+    record.time = (1.0 - t) * a.time + t * b.time;
+}
+
+static bool readHeader(int fd) {
+    char header[kHeaderSize];
+    if (pread(fd, header, kHeaderSize, 0) != static_cast<ssize_t>(kHeaderSize)) {
+        return false;
+    }
+    uint32_t recordSize;
+    memcpy(&recordSize, header + sizeof(kMagic), sizeof(recordSize));
+    return memcmp(header, kMagic, sizeof(kMagic)) == 0 && recordSize == sizeof(PoseRecord);
+}
+
+PoseLogWriter::PoseLogWriter() : fd_(-1), lastTime_(-HUGE_VAL) {
+}
+
+PoseLogWriter::~PoseLogWriter() {
+    close();
+}
+
+bool PoseLogWriter::open(const std::string& filename) {
+    close();
+    fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd_ == -1) {
+        std::cerr << "ERROR: Failed to open file: " << filename << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        close();
+        return false;
+    }
+
+    if (st.st_size == 0) {
+        char header[kHeaderSize];
+        uint32_t recordSize = sizeof(PoseRecord);
+        memset(header, 0, kHeaderSize);
+        memcpy(header, kMagic, sizeof(kMagic));
+        memcpy(header + sizeof(kMagic), &recordSize, sizeof(recordSize));
+        if (write(fd_, header, kHeaderSize) != static_cast<ssize_t>(kHeaderSize)) {
+            std::cerr << "ERROR: Failed to write file: " << filename << std::endl;
+            close();
+            return false;
+        }
+        lastTime_ = -HUGE_VAL;
+        return true;
+    }
+
+    if (!readHeader(fd_)) {
+        std::cerr << "ERROR: Not a pose log: " << filename << std::endl;
+        close();
+        return false;
+    }
+    // 書き込み途中で終了したレコードは切り捨てる
+    std::size_t numRecords = (st.st_size - kHeaderSize) / sizeof(PoseRecord);
+    off_t size = kHeaderSize + numRecords * sizeof(PoseRecord);
+    if (size != st.st_size && ftruncate(fd_, size) != 0) {
+        close();
+        return false;
+    }
+    PoseRecord last;
+    lastTime_ = -HUGE_VAL;
+    if (numRecords > 0 && pread(fd_, &last, sizeof(last), size - sizeof(last)) == sizeof(last)) {
+        lastTime_ = last.time;
+    }
+    return true;
+}
+
+bool PoseLogWriter::append(const PoseRecord& record) {
+    if (fd_ == -1) {
+        return false;
+    }
+    if (record.time < lastTime_) {
+        std::cerr << "ERROR: Pose time must not decrease: " << record.time << std::endl;
+        return false;
+    }
+    if (write(fd_, &record, sizeof(record)) != sizeof(record)) {
+        return false;
+    }
+    lastTime_ = record.time;
+    return true;
+}
+
+void PoseLogWriter::close() {
+    if (fd_ != -1) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+PoseLogReader::PoseLogReader() : data_(NULL), dataSize_(0), records_(NULL), numRecords_(0) {
+}
+
+PoseLogReader::~PoseLogReader() {
+    close();
+}
+
+bool PoseLogReader::open(const std::string& filename) {
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        std::cerr << "ERROR: Failed to open file: " << filename << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < kHeaderSize || !readHeader(fd)) {
+        std::cerr << "ERROR: Not a pose log: " << filename << std::endl;
+        ::close(fd);
+        return false;
+    }
+    dataSize_ = st.st_size;
+    data_ = mmap(NULL, dataSize_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data_ == MAP_FAILED) {
+        data_ = NULL;
+        std::cerr << "ERROR: Failed to map file: " << filename << std::endl;
+        return false;
+    }
+    madvise(data_, dataSize_, MADV_RANDOM);
+
+    records_ = reinterpret_cast<const PoseRecord*>(static_cast<const char*>(data_) + kHeaderSize);
+    numRecords_ = (dataSize_ - kHeaderSize) / sizeof(PoseRecord);
+    indexTimes_.clear();
+    indexTimes_.reserve(numRecords_ / kIndexStride + 1);
+    for (std::size_t i = 0; i < numRecords_; i += kIndexStride) {
+        indexTimes_.push_back(records_[i].time);
+    }
+    return true;
+}
+
+void PoseLogReader::close() {
+    if (data_ != NULL) {
+        munmap(data_, dataSize_);
+        data_ = NULL;
+    }
+    dataSize_ = 0;
+    records_ = NULL;
+    numRecords_ = 0;
+    indexTimes_.clear();
+}
+
+static bool compareTime(double time, const PoseRecord& record) {
+    return time < record.time;
+}
+
+/**
+ * time を挟む2つのレコードのうち、前のレコードの位置を求めます。
+ */
+std::size_t PoseLogReader::findRecord(double time) const {
+    // 索引で範囲を絞ってから、その範囲のレコードだけを二分探索する
+    std::size_t block = std::upper_bound(indexTimes_.begin(), indexTimes_.end(), time) - indexTimes_.begin();
+    std::size_t begin = (block > 0 ? block - 1 : 0) * kIndexStride;
+    std::size_t end = std::min(begin + kIndexStride + 1, numRecords_);
+    std::size_t i = std::upper_bound(records_ + begin, records_ + end, time, compareTime) - records_;
+    i = (i > 0) ? i - 1 : 0;
+    return std::min(i, numRecords_ - 2);
+}
+
+bool PoseLogReader::sample(double time, PoseRecord& record) const {
+    if (numRecords_ == 0 || time < records_[0].time || time > records_[numRecords_ - 1].time) {
+        return false;
+    }
+    if (numRecords_ == 1) {
+        record = records_[0];
+        return true;
+    }
+    std::size_t i = findRecord(time);
+    const PoseRecord& a = records_[i];
+    const PoseRecord& b = records_[i + 1];
+    double dt = b.time - a.time;
+    interpolate(a, b, (dt > 0.0) ? (time - a.time) / dt : 0.0, record);
+    record.time = time;
+    return true;
+}
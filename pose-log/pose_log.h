@@ -0,0 +1,133 @@
+#ifndef POSE_LOG_H
+#define POSE_LOG_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+//
+// 姿勢ログの形式（リトルエンディアン）
+//
+// ヘッダ（32バイト）:
+//   char     magic[8]    "POSELOG1"
+//   uint32_t recordSize  レコードのバイト数（64）
+//   uint8_t  reserved[20]
+//
+// レコード（64バイト、時刻の昇順に追記する）:
+//   double time            時刻 [ms]
+//   double rotation[4]     回転を表す単位四元数 (w, x, y, z)
+//   double translation[3]  並進ベクトル
+//
+
+/**
+ * 姿勢ログの1レコードです。
+ */
+struct PoseRecord {
+    double time;
+    double rotation[4];
+    double translation[3];
+};
+
+/**
+ * 回転ベクトルと並進ベクトルからレコードを作成します。
+ *
+ * @param[in] time 時刻 [ms]
+ * @param[in] rvec カメラの回転ベクトル
+ * @param[in] tvec カメラの並進ベクトル
+ * @return レコード
+ */
+PoseRecord makePoseRecord(double time, const cv::Vec3d& rvec, const cv::Vec3d& tvec);
+
+/**
+ * レコードの回転を回転ベクトルで取得します。
+ *
+ * @param[in] record レコード
+ * @return カメラの回転ベクトル
+ */
+cv::Vec3d getRotationVector(const PoseRecord& record);
+
+/**
+ * 姿勢ログに追記します。
+ */
+class PoseLogWriter {
+public:
+    PoseLogWriter();
+    ~PoseLogWriter();
+
+    /**
+     * 姿勢ログを開きます。ファイルがなければ作成します。
+     *
+     * @param[in] filename ファイル名
+     * @return 開けた場合はtrue、そうでなければfalse
+     */
+    bool open(const std::string& filename);
+
+    /**
+     * レコードを追記します。
+     *
+     * @param[in] record レコード（時刻は最後に書き込んだレコード以上でなければならない）
+     * @return 書き込めた場合はtrue、そうでなければfalse
+     */
+    bool append(const PoseRecord& record);
+
+    void close();
+
+private:
+    PoseLogWriter(const PoseLogWriter&);
+    PoseLogWriter& operator=(const PoseLogWriter&);
+
+    int fd_;
+    double lastTime_;
+};
+
+/**
+ * 姿勢ログをメモリマップして読み込みます。
+ * 開くときに一定間隔のレコードの時刻だけを集めた疎な索引を作成し、任意の時刻の姿勢を二分探索で求めます。
+ */
+class PoseLogReader {
+public:
+    PoseLogReader();
+    ~PoseLogReader();
+
+    /**
+     * 姿勢ログを開きます。
+     *
+     * @param[in] filename ファイル名
+     * @return 開けた場合はtrue、そうでなければfalse
+     */
+    bool open(const std::string& filename);
+
+    void close();
+
+    std::size_t size() const {
+        return numRecords_;
+    }
+
+    const PoseRecord& operator[](std::size_t i) const {
+        return records_[i];
+    }
+
+    /**
+     * 指定した時刻の姿勢を求めます。
+     * 前後のレコードの間を、回転は四元数の球面線形補間(SLERP)、並進は線形補間で補間します。
+     *
+     * @param[in] time 時刻 [ms]
+     * @param[out] record 補間した姿勢
+     * @return 時刻が記録された範囲内であればtrue、そうでなければfalse
+     */
+    bool sample(double time, PoseRecord& record) const;
+
+private:
+    PoseLogReader(const PoseLogReader&);
+    PoseLogReader& operator=(const PoseLogReader&);
+
+    std::size_t findRecord(double time) const;
+
+    void* data_;
+    std::size_t dataSize_;
+    const PoseRecord* records_;
+    std::size_t numRecords_;
+    std::vector<double> indexTimes_; // kIndexStride個ごとのレコードの時刻
+};
+
+#endif /* POSE_LOG_H */